@@ -0,0 +1,167 @@
+#ifndef CLOCK_SYNC_HPP
+#define CLOCK_SYNC_HPP
+
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <common/log_messages.h>
+
+#include <flatcat_telemetry.hpp>
+#include <udp_batch.hpp>
+
+/* Clock offset and drift between the robot and a terminal, NTP-style.
+
+   The terminal sends PNG=<id>,<t1> over the command channel, t1 taken from
+   its monotonic clock. The robot takes t2 on receiving the line and answers
+   with a pong datagram to the terminal's telemetry port (telemetry::Pong_t),
+   stamped with t3 right before sending. The terminal takes t4 on arrival:
+
+     offset = ((t2 - t1) + (t3 - t4)) / 2     robot minus terminal clock
+     delay  =  (t4 - t1) - (t3 - t2)          round trip without the robot's processing
+
+   A sample's offset is wrong by half the asymmetry of its delay, so only
+   samples with small delays are trusted: of the last 'window' samples the
+   half with the smallest delays is fitted with a line over the terminal's
+   time, its value at the newest sample is the offset, its slope the drift.
+   All times in us. */
+
+namespace supreme {
+
+namespace constants {
+    const uint64_t ping_interval_us = 1000000; /* terminals ping once a second */
+}
+
+/* robot side, a ping waiting for its answer */
+struct Ping_Request_t {
+    Destination_t destination; /* the terminal's telemetry port */
+    uint32_t id    = 0;
+    uint64_t t1_us = 0;
+    uint64_t t2_us = 0;
+};
+
+inline std::size_t encode_pong(uint8_t* buffer, uint32_t id, uint64_t t1_us, uint64_t t2_us, uint64_t t3_us)
+{
+    using namespace telemetry;
+    Pong_t pong;
+    pong.sync             = telemetry::sync;
+    pong.version          = telemetry::version;
+    pong.layout           = pong_layout;
+    pong.unit_id          = 0;
+    pong.number_of_motors = 0;
+    pong.id               = id;
+    pong.t1_us            = t1_us;
+    pong.t2_us            = t2_us;
+    pong.t3_us            = t3_us;
+    pong.checksum         = 0;
+    memcpy(buffer, &pong, sizeof(pong));
+    buffer[sizeof(pong) - 1] = telemetry_checksum(buffer, sizeof(pong) - 1);
+    return sizeof(pong);
+}
+
+/* terminal side, sync, version and layout already checked */
+inline Telemetry_Result_t decode_pong(telemetry::Pong_t& pong, const uint8_t* msg, std::size_t len)
+{
+    if (len < sizeof(pong)) return Telemetry_Result_t::truncated;
+    if (telemetry_checksum(msg, sizeof(pong)) != 0) return Telemetry_Result_t::bad_checksum;
+    memcpy(&pong, msg, sizeof(pong));
+    return Telemetry_Result_t::ok;
+}
+
+
+/* robot clock = local clock + offset + drift * (local - reference) */
+struct Clock_Estimate_t {
+    bool     valid        = false;
+    double   offset_us    = .0;
+    double   drift_ppm    = .0;
+    uint64_t reference_us = 0;   /* local time of the offset */
+    double   delay_us     = .0;  /* smallest round trip in the window */
+    uint64_t samples      = 0;
+
+    /* robot time to local time */
+    uint64_t to_local_us(uint64_t robot_us) const {
+        const double x = static_cast<double>(static_cast<int64_t>(robot_us - reference_us)) - offset_us;
+        return reference_us + static_cast<int64_t>(std::llround(x / (1.0 + 1e-6 * drift_ppm)));
+    }
+};
+
+
+class Clock_Sync
+{
+public:
+    static const std::size_t window = 32;
+
+    /* drift is only fitted over samples this far apart */
+    static constexpr double min_span_us = 2e6;
+
+    /* one ping answered, all times in us */
+    void add_sample(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4)
+    {
+        if (t4 < t1 or t3 < t2 or (t4 - t1) < (t3 - t2)) {
+            ++rejected;
+            return;
+        }
+        Sample_t& s = samples[count % window];
+        s.local_us  = t1 + (t4 - t1) / 2;
+        s.offset_us = .5 * ( static_cast<double>(static_cast<int64_t>(t2 - t1))
+                           + static_cast<double>(static_cast<int64_t>(t3 - t4)) );
+        s.delay_us  = static_cast<double>((t4 - t1) - (t3 - t2));
+        ++count;
+        estimate();
+    }
+
+    Clock_Estimate_t const& get_estimate(void) const { return current; }
+    uint64_t                get_rejected(void) const { return rejected; }
+
+private:
+    struct Sample_t {
+        uint64_t local_us  = 0;
+        double   offset_us = .0;
+        double   delay_us  = .0;
+    };
+
+    void estimate(void)
+    {
+        const std::size_t n = std::min<uint64_t>(count, window);
+        std::array<Sample_t, window> best;
+        std::copy(samples.begin(), samples.begin() + n, best.begin());
+        std::sort(best.begin(), best.begin() + n, [](Sample_t const& a, Sample_t const& b) { return a.delay_us < b.delay_us; });
+        const std::size_t k = std::max<std::size_t>(1, n / 2);
+
+        /* least squares over the local time relative to the newest sample */
+        const uint64_t reference = samples[(count - 1) % window].local_us;
+        double sx = .0, sy = .0, sxx = .0, sxy = .0;
+        double x_min = best[0].local_us, x_max = best[0].local_us;
+        for (std::size_t i = 0; i < k; ++i) {
+            const double x = static_cast<double>(static_cast<int64_t>(best[i].local_us - reference));
+            const double y = best[i].offset_us;
+            sx += x; sy += y; sxx += x*x; sxy += x*y;
+            x_min = std::min<double>(x_min, best[i].local_us);
+            x_max = std::max<double>(x_max, best[i].local_us);
+        }
+        const double det = k * sxx - sx * sx;
+        double slope = .0;
+        if (k >= 2 and x_max - x_min >= min_span_us and det > 0)
+            slope = (k * sxy - sx * sy) / det;
+        const double intercept = (sy - slope * sx) / k;
+
+        current.valid        = true;
+        current.offset_us    = intercept;
+        current.drift_ppm    = 1e6 * slope;
+        current.reference_us = reference;
+        current.delay_us     = best[0].delay_us;
+        current.samples      = count;
+    }
+
+    std::array<Sample_t, window> samples;
+    uint64_t count    = 0;
+    uint64_t rejected = 0;
+
+    Clock_Estimate_t current;
+};
+
+} /* namespace supreme */
+
+#endif /* CLOCK_SYNC_HPP */
@@ -0,0 +1,191 @@
+#ifndef COMMAND_PROTOCOL_HPP
+#define COMMAND_PROTOCOL_HPP
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+#include <flatcat_robot.hpp>
+#include <command_queue.hpp>
+
+/* Binary command protocol
+
+   Frame (9 bytes, little endian):
+     opcode   u8  (= Command_t)
+     index    u8  (e.g. midi channel)
+     seq      u16 (per connection, incremented by the client)
+     value    f32
+     checksum u8  (all bytes sum up to zero)
+
+   The command channel is line based on both ends (Socket_Server::get_next_line,
+   printf-style Socket_Client), so frames travel hex-encoded in a line with a
+   leading '#'. That line (20 bytes) is no shorter than most text commands
+   and is still read into a std::string by get_next_line, the frame saves
+   the text parsing and gets every command validated by one table lookup.
+   Text commands keep working, the server accepts binary frames after the
+   client sent 'BIN=1' following 'HELLO'.
+
+   Frames carry no unit, like text commands they address the unit
+   selected with 'UNT=<id>' on this connection (unit 0 by default).
+   The seq of the last command actuated is echoed in the telemetry header,
+   so the client can measure the command-to-actuator latency. */
+
+namespace supreme {
+
+namespace binary_protocol {
+
+    const char     marker     = '#';
+    const unsigned frame_size = 9;
+    const unsigned line_size  = 1 + 2*frame_size + 1; /* marker + hex + newline */
+
+    inline uint8_t checksum(const uint8_t* data, std::size_t len) {
+        uint8_t sum = 0;
+        for (std::size_t i = 0; i < len; ++i) sum += data[i];
+        return static_cast<uint8_t>(~sum + 1);
+    }
+
+    inline int from_hex(char c) {
+        if (c >= '0' and c <= '9') return c - '0';
+        if (c >= 'a' and c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' and c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    const char hex_digits[] = "0123456789abcdef";
+
+} /* namespace binary_protocol */
+
+
+/* client side, builds a line for Socket_Client::append("%s", ...) */
+class Binary_Command_Encoder
+{
+public:
+    const char* encode(Command_t type, float value, uint8_t index = 0)
+    {
+        using namespace binary_protocol;
+        uint8_t frame[frame_size];
+        frame[0] = static_cast<uint8_t>(type);
+        frame[1] = index;
+        memcpy(frame + 2, &seq  , sizeof(seq  ));
+        memcpy(frame + 4, &value, sizeof(value));
+        frame[8] = checksum(frame, frame_size - 1);
+        ++seq;
+
+        line[0] = marker;
+        for (unsigned i = 0; i < frame_size; ++i) {
+            line[1 + 2*i] = hex_digits[frame[i] >> 4];
+            line[2 + 2*i] = hex_digits[frame[i] & 0xf];
+        }
+        line[line_size - 1] = '\n';
+        line[line_size    ] = '\0';
+        return line;
+    }
+
+    /* sequence number of the frame encoded last */
+    uint16_t get_last_seq(void) const { return static_cast<uint16_t>(seq - 1); }
+
+private:
+    uint16_t seq = 0;
+    char     line[binary_protocol::line_size + 1];
+};
+
+
+/* server side, decodes one line into the command queue, no allocation beyond the line itself */
+class Binary_Command_Decoder
+{
+    typedef bool (*Validate_fn)(uint8_t index, float value);
+
+    /* largest value taken as a count or id, converting a float beyond the range of unsigned is undefined */
+    static constexpr float max_unsigned = 65535.f;
+
+    static bool any_value     (uint8_t      , float value) { return std::isfinite(value); }
+    static bool midi_channel  (uint8_t index, float value) { return index < constants::max_joints_per_unit and std::isfinite(value); }
+    static bool unsigned_value(uint8_t      , float value) { return value >= .0f and value <= max_unsigned; } /* false for NaN too */
+    static bool joint_target  (uint8_t index, float value) { return index < constants::max_joints_per_unit and std::isfinite(value); }
+
+    /* one entry per opcode, nullptr means not accepted as binary command */
+    static std::array<Validate_fn, 256> make_table(void) {
+        std::array<Validate_fn, 256> t;
+        t.fill(nullptr);
+        t[(uint8_t) Command_t::enable            ] = unsigned_value;
+        t[(uint8_t) Command_t::amplitude         ] = any_value;
+        t[(uint8_t) Command_t::modulate          ] = any_value;
+        t[(uint8_t) Command_t::inputgain         ] = any_value;
+        t[(uint8_t) Command_t::control_mode      ] = unsigned_value;
+        t[(uint8_t) Command_t::user_position     ] = unsigned_value;
+        t[(uint8_t) Command_t::midi              ] = midi_channel;
+        t[(uint8_t) Command_t::reset_statistics  ] = any_value;
+        t[(uint8_t) Command_t::calibration_enable] = any_value;
+        t[(uint8_t) Command_t::calibration_abort ] = any_value;
+        t[(uint8_t) Command_t::calibration_index ] = any_value;
+        t[(uint8_t) Command_t::show_timing       ] = any_value;
+        t[(uint8_t) Command_t::reset_timing      ] = any_value;
+        t[(uint8_t) Command_t::cpg_phase         ] = joint_target;
+        t[(uint8_t) Command_t::cpg_amplitude     ] = joint_target;
+        t[(uint8_t) Command_t::trajectory        ] = unsigned_value;
+        t[(uint8_t) Command_t::trajectory_scale  ] = unsigned_value;
+        t[(uint8_t) Command_t::trajectory_loop   ] = unsigned_value;
+        t[(uint8_t) Command_t::parameter_set     ] = unsigned_value;
+        return t;
+    }
+
+public:
+    Binary_Command_Decoder() : table(make_table()) {}
+
+    static bool is_binary(const char* line, std::size_t len) {
+        return len > 0 and line[0] == binary_protocol::marker;
+    }
+
+    bool decode(const char* line, std::size_t len, Command_Queue& queue, uint8_t unit)
+    {
+        using namespace binary_protocol;
+        if (len < 1 + 2*frame_size) return reject();
+
+        uint8_t frame[frame_size];
+        for (unsigned i = 0; i < frame_size; ++i) {
+            const int hi = from_hex(line[1 + 2*i]);
+            const int lo = from_hex(line[2 + 2*i]);
+            if (hi < 0 or lo < 0) return reject();
+            frame[i] = static_cast<uint8_t>((hi << 4) | lo);
+        }
+        if (checksum(frame, frame_size) != 0) return reject();
+
+        uint16_t seq;
+        float value;
+        memcpy(&seq  , frame + 2, sizeof(seq  ));
+        memcpy(&value, frame + 4, sizeof(value));
+
+        if (has_seq and seq != static_cast<uint16_t>(last_seq + 1)) seq_gaps.fetch_add(1, std::memory_order_relaxed);
+        last_seq = seq;
+        has_seq  = true;
+
+        const Validate_fn validate = table[frame[0]];
+        if (validate == nullptr or not validate(frame[1], value)) return reject();
+
+        queue.push(static_cast<Command_t>(frame[0]), value, frame[1], unit, seq);
+        return true;
+    }
+
+    void reset_connection(void) { has_seq = false; }
+
+    uint64_t get_errors  (void) const { return errors  .load(std::memory_order_relaxed); }
+    uint64_t get_seq_gaps(void) const { return seq_gaps.load(std::memory_order_relaxed); }
+
+private:
+    bool reject(void) { errors.fetch_add(1, std::memory_order_relaxed); return false; }
+
+    const std::array<Validate_fn, 256> table;
+
+    uint16_t last_seq = 0;
+    bool     has_seq  = false;
+
+    /* read by the control loop for statistics */
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> seq_gaps{0};
+};
+
+} /* namespace supreme */
+
+#endif /* COMMAND_PROTOCOL_HPP */
@@ -0,0 +1,185 @@
+#ifndef COMMAND_QUEUE_HPP
+#define COMMAND_QUEUE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include <periodic_scheduler.hpp>
+
+namespace supreme {
+
+/* Bounded lock-free multi-producer/single-consumer ring buffer,
+   after D. Vyukov's bounded queue. Each cell carries a sequence number
+   telling producers and the consumer whose turn it is. */
+template <typename T, std::size_t Capacity>
+class MPSC_Queue
+{
+    static_assert(Capacity >= 2 and (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two.");
+
+    struct Cell_t {
+        std::atomic<std::size_t> seq;
+        T data;
+    };
+
+public:
+    MPSC_Queue() : cells() {
+        for (std::size_t i = 0; i < Capacity; ++i)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    MPSC_Queue(const MPSC_Queue& other) = delete;
+    MPSC_Queue& operator=(const MPSC_Queue& other) = delete;
+
+    /* any thread, returns false if the queue is full */
+    bool push(T const& item)
+    {
+        std::size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell_t& cell = cells[pos & mask];
+            const std::size_t seq = cell.seq.load(std::memory_order_acquire);
+            const intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = item;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false; /* full */
+            else
+                pos = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    /* consumer thread only, returns false if the queue is empty */
+    bool pop(T& item)
+    {
+        Cell_t& cell = cells[tail & mask];
+        const std::size_t seq = cell.seq.load(std::memory_order_acquire);
+        if ((intptr_t) seq - (intptr_t) (tail + 1) < 0)
+            return false; /* empty */
+
+        item = cell.data;
+        cell.seq.store(tail + Capacity, std::memory_order_release);
+        ++tail;
+        return true;
+    }
+
+    static constexpr std::size_t capacity(void) { return Capacity; }
+
+private:
+    static const std::size_t mask = Capacity - 1;
+
+    std::array<Cell_t, Capacity> cells;
+    std::atomic<std::size_t>     head{0}; /* shared by producers */
+    std::size_t                  tail = 0; /* owned by consumer */
+};
+
+
+enum class Command_t : uint8_t
+{
+    none,
+    enable,
+    amplitude,
+    modulate,
+    inputgain,
+    control_mode,
+    user_position,
+    midi,
+    reset_statistics,
+    calibration_enable,
+    calibration_abort,
+    calibration_index,
+    show_timing,
+    reset_timing,
+    cpg_phase,      /* degrees, per joint */
+    cpg_amplitude,  /* 0..1, per joint */
+    trajectory,     /* id, starts over when playing */
+    trajectory_scale,
+    trajectory_loop,
+    parameter_set,  /* gait id */
+    END_Command_t
+};
+
+struct Command {
+    Command_t type        = Command_t::none;
+    uint8_t   index       = 0;   /* e.g. midi channel */
+    uint8_t   unit        = 0;   /* addressed flatcat unit */
+    float     value       = 0.f;
+    uint64_t  enqueued_ns = 0;   /* monotonic time of enqueueing */
+    bool      tagged      = false;
+    uint16_t  seq         = 0;   /* binary protocol sequence number, if tagged */
+};
+
+/* time from enqueueing a command until the control loop applied it */
+struct Command_Latency {
+    uint64_t count  = 0;
+    uint64_t sum_ns = 0;
+    uint64_t max_ns = 0;
+
+    void add_sample(uint64_t ns) {
+        ++count;
+        sum_ns += ns;
+        if (ns > max_ns) max_ns = ns;
+    }
+
+    double mean_us(void) const { return count > 0 ? 1e-3 * sum_ns / count : .0; }
+    double max_us (void) const { return 1e-3 * max_ns; }
+
+    void reset(void) { *this = Command_Latency{}; }
+};
+
+class Command_Queue
+{
+public:
+    static const std::size_t capacity = 256;
+
+    /* called from any communication thread, seq < 0 for untagged commands */
+    bool push(Command_t type, float value = .0f, uint8_t index = 0, uint8_t unit = 0, int32_t seq = -1)
+    {
+        Command cmd;
+        cmd.type        = type;
+        cmd.index       = index;
+        cmd.unit        = unit;
+        cmd.value       = value;
+        cmd.enqueued_ns = monotonic_time_ns();
+        cmd.tagged      = (seq >= 0);
+        cmd.seq         = static_cast<uint16_t>(seq);
+        if (queue.push(cmd)) return true;
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /* called once per cycle from the control loop, applies all commands
+       enqueued so far, bounded by the capacity so producers cannot stall the loop */
+    template <typename Handler>
+    std::size_t drain(Handler&& apply)
+    {
+        const uint64_t now = monotonic_time_ns();
+        std::size_t n = 0;
+        Command cmd;
+        while (n < capacity and queue.pop(cmd)) {
+            apply(cmd);
+            latency.add_sample(now > cmd.enqueued_ns ? now - cmd.enqueued_ns : 0);
+            ++n;
+        }
+        return n;
+    }
+
+    Command_Latency const& get_latency (void) const { return latency; }
+    uint64_t               get_rejected(void) const { return rejected.load(std::memory_order_relaxed); }
+
+    void reset_statistics(void) { latency.reset(); rejected.store(0, std::memory_order_relaxed); }
+
+private:
+    MPSC_Queue<Command, capacity> queue;
+    Command_Latency               latency;  /* consumer only */
+    std::atomic<uint64_t>         rejected{0};
+};
+
+} /* namespace supreme */
+
+#endif /* COMMAND_QUEUE_HPP */
@@ -0,0 +1,250 @@
+#ifndef CPG_CONTROLLER_HPP
+#define CPG_CONTROLLER_HPP
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <common/modules.h>
+#include <common/log_messages.h>
+#include <robots/robot.h>
+#include <controller/csl_control.hpp>
+#include <joint_array.hpp>
+#include <so2_oscillator.hpp>
+#include <so2_controller.hpp>
+
+/* Central pattern generator, one SO2 oscillator per joint.
+
+   Oscillator i drives joint i with A_i * x1_i. Its phase target q_i is
+   relative to the wave, in degrees, like so2::Params_t::phs. The
+   oscillators are pulled towards their phase relations by coupling to
+   their neighbours j in the topology:
+
+     in_i = c / n_i * sum_j ( R(q_j - q_i) x_j - x_i )
+
+   R is the rotation and n_i the number of neighbours. The input vanishes
+   once i lags j by q_i - q_j, so the joints lock in phase like the single
+   oscillator of SO2_Controller did. Topologies are chain (i-1, i+1),
+   ring (chain closed from tail to head), all (every other joint) and none.
+
+   Phase and amplitude targets are set per joint at runtime. They are
+   approached at a limited rate, so the coupling pulls the oscillators
+   along smoothly without resetting them. A new gait is a new set of
+   targets, and the robot keeps walking while it changes.
+
+   The coupling adds at most 2c to the oscillators' inputs. For c <= 0.1
+   they stay within the range of fast_tanh's small error bound
+   (see so2_oscillator.hpp). */
+
+namespace jcl {
+
+namespace cpg {
+
+    enum class Topology_t : uint8_t { none, chain, ring, all };
+
+    inline bool parse_topology(std::string const& name, Topology_t& topology) {
+        if      (name == "none" ) topology = Topology_t::none;
+        else if (name == "chain") topology = Topology_t::chain;
+        else if (name == "ring" ) topology = Topology_t::ring;
+        else if (name == "all"  ) topology = Topology_t::all;
+        else return false;
+        return true;
+    }
+
+    /* on the limit cycle's order of magnitude, so a seeded oscillator settles within a few periods */
+    const float seed_amplitude = .5f;
+
+    inline float wrap_deg(float deg) {
+        deg = std::fmod(deg + 180.f, 360.f);
+        return (deg < .0f) ? deg + 180.f : deg - 180.f;
+    }
+
+} /* namespace cpg */
+
+
+template <std::size_t NumJoints>
+class CPG_Controller {
+
+    typedef supreme::Joint_Array<supreme::csl_control , NumJoints> Controls_t;
+    typedef supreme::Joint_Array<so2::Params_t        , NumJoints> Parameters_t;
+    typedef supreme::Joint_Array<float                , NumJoints> Targets_t;
+
+    struct Edge_t {
+        std::size_t      from; /* j */
+        std::size_t      to;   /* i */
+        float            weight;
+        so2::Projection_t rot; /* cos and sin of q_j - q_i */
+    };
+
+    robots::Robot_Interface& robot;
+    Controls_t&  controls;
+    Parameters_t pset;
+
+    SO2_Bank osc;
+    float freq = 0.85f;
+
+    Targets_t phase_target, phase; /* degrees */
+    Targets_t amp_target  , amp;
+
+    std::vector<Edge_t> edges;
+    std::vector<float>  in1, in2; /* coupling inputs, summed over the edges */
+
+    const float coupling;
+    const float phase_step;     /* degrees per cycle */
+    const float amplitude_step; /* per cycle */
+    bool phases_changed = true;
+
+public:
+
+    CPG_Controller( robots::Robot_Interface& robot
+                  , Controls_t& controls
+                  , std::size_t number_of_joints
+                  , cpg::Topology_t topology
+                  , float coupling
+                  , float phase_rate_deg_s
+                  , float amplitude_rate
+                  , float dt )
+    : robot(robot)
+    , controls(controls)
+    , pset(number_of_joints, so2::default_params)
+    , osc(number_of_joints, freq)
+    , phase_target(number_of_joints, [this](std::size_t i) { return pset[i].phs; })
+    , phase       (number_of_joints, [this](std::size_t i) { return pset[i].phs; })
+    , amp_target  (number_of_joints, [](std::size_t) { return 1.f; })
+    , amp         (number_of_joints, [](std::size_t) { return 1.f; })
+    , edges()
+    , in1(number_of_joints, .0f)
+    , in2(number_of_joints, .0f)
+    , coupling(coupling)
+    , phase_step(phase_rate_deg_s * dt)
+    , amplitude_step(amplitude_rate * dt)
+    {
+        connect(topology, number_of_joints);
+        reset();
+        sts_msg("CPG with %u oscillators, %u couplings of strength %.3f.", (unsigned) number_of_joints, (unsigned) edges.size(), coupling);
+    }
+
+    void set_frequency(float f /*-1..1*/) { freq = 0.75f + 0.2f*clip(f); }
+
+    /* targets of joint i, approached at the configured rates, false (and unchanged) if not finite */
+    bool set_phase(std::size_t i, float deg) {
+        if (not std::isfinite(deg)) return false;
+        phase_target[i] = cpg::wrap_deg(deg);
+        return true;
+    }
+    bool set_amplitude(std::size_t i, float a) {
+        if (not std::isfinite(a)) return false;
+        amp_target[i] = clip(a, 0.f, 1.f);
+        return true;
+    }
+
+    /* gait parameters of joint i, its phase is approached like set_phase() */
+    void set_params(std::size_t i, so2::Params_t const& p) {
+        pset[i] = p;
+        set_phase(i, p.phs);
+    }
+
+    float get_phase    (std::size_t i) const { return phase[i]; }
+    float get_amplitude(std::size_t i) const { return amp  [i]; }
+
+    SO2_Bank const& get_oscillators(void) const { return osc; }
+
+    /* each oscillator at its current phase */
+    void reset(void) { synchronize(cpg::seed_amplitude, .0f); }
+
+    /* continues a wave given by a single oscillator's state (x1, x2),
+       e.g. SO2_Controller's when switching over from it */
+    void synchronize(float x1, float x2) {
+        for (std::size_t i = 0; i < osc.size(); ++i) {
+            const so2::Projection_t p = so2::phase_projection(-phase[i]);
+            osc.set_state(i, p.a*x1 - p.b*x2, p.b*x1 + p.a*x2);
+        }
+    }
+
+    /* the wave as a single oscillator's state, inverse of synchronize() */
+    void get_wave(float& x1, float& x2) const {
+        const so2::Projection_t p = so2::phase_projection(phase[0]);
+        x1 = p.a*osc.get_x1(0) - p.b*osc.get_x2(0);
+        x2 = p.b*osc.get_x1(0) + p.a*osc.get_x2(0);
+    }
+
+    void execute_cycle(void)
+    {
+        approach_targets();
+        if (phases_changed)
+            update_rotations();
+
+        /* coupling from the current state */
+        std::fill(in1.begin(), in1.end(), .0f);
+        std::fill(in2.begin(), in2.end(), .0f);
+        for (auto const& e : edges) {
+            const float x1 = osc.get_x1(e.from), x2 = osc.get_x2(e.from);
+            in1[e.to] += e.weight * (e.rot.a*x1 - e.rot.b*x2 - osc.get_x1(e.to));
+            in2[e.to] += e.weight * (e.rot.b*x1 + e.rot.a*x2 - osc.get_x2(e.to));
+        }
+        for (std::size_t i = 0; i < osc.size(); ++i)
+            osc.set_input(i, in1[i], in2[i]);
+
+        osc.set_frequency(freq);
+        osc.step();
+
+        robots::Jointvector_t& joints = robot.set_joints();
+
+        assert(joints.size() == controls.size());
+        supreme::Joint_Loop<NumJoints>::apply(joints.size(), [&](std::size_t i)
+        {
+            const float A = so2::preamp * pset[i].amp * amp[i]; // amplitude
+            const float out = clip( A*osc.get_x1(i), so2::max_val * pset[i].minv
+                                                   , so2::max_val * pset[i].maxv );
+
+            const float target = clip(pset[i].pctrl * (pset[i].off - joints[i].s_ang),0.5)
+                               + out;
+
+            joints[i].motor = controls[i].step(joints[i].s_ang, clip(target));
+        });
+    }
+
+private:
+
+    void connect(cpg::Topology_t topology, std::size_t n)
+    {
+        std::vector<std::vector<std::size_t>> neighbours(n);
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j = 0; j < n; ++j) {
+                if (i == j) continue;
+                const bool adjacent = (j + 1 == i) or (i + 1 == j);
+                const bool closing  = (n > 2) and ((i == 0 and j == n-1) or (j == 0 and i == n-1));
+                if ( (topology == cpg::Topology_t::chain and adjacent)
+                  or (topology == cpg::Topology_t::ring  and (adjacent or closing))
+                  or (topology == cpg::Topology_t::all) )
+                    neighbours[i].push_back(j);
+            }
+
+        for (std::size_t i = 0; i < n; ++i)
+            for (std::size_t j : neighbours[i])
+                edges.push_back(Edge_t{ j, i, coupling / neighbours[i].size(), so2::Projection_t{1.f, .0f} });
+        phases_changed = true;
+    }
+
+    void approach_targets(void)
+    {
+        for (std::size_t i = 0; i < osc.size(); ++i) {
+            const float d = cpg::wrap_deg(phase_target[i] - phase[i]);
+            if (d != .0f) {
+                phase[i] = cpg::wrap_deg(phase[i] + clip(d, -phase_step, phase_step));
+                phases_changed = true;
+            }
+            amp[i] += clip(amp_target[i] - amp[i], -amplitude_step, amplitude_step);
+        }
+    }
+
+    void update_rotations(void) {
+        for (auto& e : edges)
+            e.rot = so2::phase_projection(phase[e.from] - phase[e.to]);
+        phases_changed = false;
+    }
+};
+
+} // namespace jcl
+
+#endif /* CPG_CONTROLLER_HPP */
@@ -0,0 +1,127 @@
+#ifndef CYCLE_TIMING_HPP
+#define CYCLE_TIMING_HPP
+
+#include <array>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+
+#include <periodic_scheduler.hpp>
+
+namespace supreme {
+
+enum class Phase_t : uint8_t
+{
+    write_motorcord,
+    motorcord,
+    read_motorcord,
+    control,
+    sendbuffer,
+    END_Phase_t
+};
+
+namespace constants {
+    const unsigned num_phases = static_cast<unsigned>(Phase_t::END_Phase_t);
+    const std::array<const char*, num_phases> phase_str = { "WR", "CORD", "RD", "CTRL", "SEND" };
+}
+
+struct Timing_Stats_t {
+    float mean_us = .0f;
+    float max_us  = .0f;
+    float p99_us  = .0f;
+};
+
+typedef std::array<Timing_Stats_t, constants::num_phases> Cycle_Timing_Stats_t;
+
+
+/* keeps the durations of the last 'window' cycles and recomputes
+   mean, max and 99th percentile every 'update_interval' samples,
+   so the per-cycle cost is a single store */
+class Phase_Timer
+{
+public:
+    static const std::size_t window                  = 1024;
+    static const std::size_t default_update_interval = 128;
+
+    explicit Phase_Timer(std::size_t update_interval = default_update_interval)
+    : update_interval(std::max<std::size_t>(update_interval, 1))
+    {}
+
+    void add_sample(uint64_t duration_ns)
+    {
+        samples[pos] = static_cast<uint32_t>(std::min<uint64_t>(duration_ns, std::numeric_limits<uint32_t>::max()));
+        pos = (pos + 1) % window;
+        if (count < window) ++count;
+
+        if (++since_update >= update_interval) {
+            update_statistics();
+            since_update = 0;
+        }
+    }
+
+    Timing_Stats_t const& get_stats(void) const { return stats; }
+
+    void reset(void) {
+        pos = count = since_update = 0;
+        stats = Timing_Stats_t{};
+    }
+
+private:
+    void update_statistics(void)
+    {
+        uint64_t sum  = 0;
+        uint32_t maxv = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            sorted[i] = samples[i];
+            sum += samples[i];
+            maxv = std::max(maxv, samples[i]);
+        }
+        auto p99 = sorted.begin() + (count * 99) / 100;
+        std::nth_element(sorted.begin(), p99, sorted.begin() + count);
+
+        stats.mean_us = 1e-3f * sum / count;
+        stats.max_us  = 1e-3f * maxv;
+        stats.p99_us  = 1e-3f * (*p99);
+    }
+
+    std::size_t update_interval;
+
+    std::array<uint32_t, window> samples = {};
+    std::array<uint32_t, window> sorted  = {};
+    std::size_t pos          = 0;
+    std::size_t count        = 0;
+    std::size_t since_update = 0;
+
+    Timing_Stats_t stats;
+};
+
+
+/* times consecutive phases of one control cycle, each lap() ends the
+   current phase and starts the next one, the end of each phase in the
+   last cycle is kept (monotonic) for timestamping */
+class Cycle_Timing
+{
+public:
+    void start(void) { t0 = monotonic_time_ns(); }
+
+    void lap(Phase_t phase) {
+        const uint64_t t = monotonic_time_ns();
+        timers[static_cast<unsigned>(phase)].add_sample(t - t0);
+        ends[static_cast<unsigned>(phase)] = t;
+        t0 = t;
+    }
+
+    Timing_Stats_t const& get_stats (Phase_t phase) const { return timers[static_cast<unsigned>(phase)].get_stats(); }
+    uint64_t              get_end_ns(Phase_t phase) const { return ends  [static_cast<unsigned>(phase)]; }
+
+    void reset(void) { for (auto& t : timers) t.reset(); }
+
+private:
+    std::array<Phase_Timer, constants::num_phases> timers;
+    std::array<uint64_t   , constants::num_phases> ends = {};
+    uint64_t t0 = 0;
+};
+
+} /* namespace supreme */
+
+#endif /* CYCLE_TIMING_HPP */
@@ -0,0 +1,303 @@
+/*
+ +----------------------------------+
+ | Flatcat microbenchmarks          |
+ | hot paths of controllers,        |
+ | learners and telemetry coding    |
+ +----------------------------------+
+
+ usage: flatcat_bench [-o results.json]
+
+ Runs against the simulated motorcord, results are written as JSON
+ with ns/op, allocations/op and cycles/op (median of several repeats).
+ Without -o the JSON goes to stdout and all log messages to stderr.
+*/
+
+#ifndef FLATCAT_SIMULATION
+#error "flatcat_bench must be built with FLATCAT_SIMULATION (scons builds it that way)."
+#endif
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <common/log_messages.h>
+#include <common/udp.hpp>
+
+#include <flatcat_robot.hpp>
+#include <flatcat_control.hpp>
+#include <flatcat_settings.hpp>
+#include <flatcat_telemetry.hpp>
+#include <periodic_scheduler.hpp>
+#include <so2_oscillator.hpp>
+
+#include <learning/gmes.h>
+#include <learning/payload.h>
+#include <learning/action_selection.h>
+#include "gmes_joint_group.hpp"
+
+
+namespace bench {
+
+std::atomic<uint64_t> allocations{0};
+
+inline uint64_t read_cycle_counter(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0; /* not available, reported as zero */
+#endif
+}
+
+struct Result_t {
+    std::string name;
+    uint64_t    iterations;
+    double      ns_per_op;
+    double      allocs_per_op;
+    double      cycles_per_op;
+};
+
+inline double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    return v[v.size()/2];
+}
+
+class Runner
+{
+public:
+    template <typename Function_t>
+    void run(std::string const& name, Function_t&& fn, uint64_t iterations = 100000)
+    {
+        for (uint64_t i = 0; i < iterations/10; ++i) fn(i); /* warm up */
+
+        std::vector<double> ns, allocs, cycles;
+        for (unsigned r = 0; r < repeats; ++r)
+        {
+            const uint64_t a0 = allocations.load();
+            const uint64_t c0 = read_cycle_counter();
+            const uint64_t t0 = supreme::monotonic_time_ns();
+
+            for (uint64_t i = 0; i < iterations; ++i) fn(i);
+
+            const uint64_t t1 = supreme::monotonic_time_ns();
+            const uint64_t c1 = read_cycle_counter();
+            const uint64_t a1 = allocations.load();
+
+            ns    .push_back(double(t1 - t0) / iterations);
+            cycles.push_back(double(c1 - c0) / iterations);
+            allocs.push_back(double(a1 - a0) / iterations);
+        }
+        results.push_back({ name, iterations, median(ns), median(allocs), median(cycles) });
+        sts_msg("%-32s %10.1f ns/op %8.3f allocs/op %10.1f cycles/op"
+               , name.c_str(), results.back().ns_per_op, results.back().allocs_per_op, results.back().cycles_per_op);
+    }
+
+    void write_json(FILE* fd) const
+    {
+        fprintf(fd, "{\n  \"benchmarks\": [\n");
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            auto const& r = results[i];
+            fprintf(fd, "    { \"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, \"allocs_per_op\": %.3f, \"cycles_per_op\": %.1f }%s\n"
+                   , r.name.c_str(), (unsigned long long) r.iterations, r.ns_per_op, r.allocs_per_op, r.cycles_per_op
+                   , (i + 1 < results.size()) ? "," : "");
+        }
+        fprintf(fd, "  ]\n}\n");
+    }
+
+private:
+    static const unsigned repeats = 5;
+    std::vector<Result_t> results;
+};
+
+
+/* stands in for RemoteRobotActions, the super layer only needs the number of actions */
+class Dummy_Actions : public Action_Module_Interface {
+public:
+    std::size_t get_number_of_actions(void) const { return 8; }
+    std::size_t get_number_of_actions_available(void) const { return 8; }
+    bool exists(const std::size_t /*action_index*/) const { return true; }
+    void execute_cycle(learning::RL_Interface const& /*learner*/) {}
+};
+
+/* same members as FlatcatUDPRobot, so decode_telemetry_frame can write into it */
+struct Telemetry_t {
+    uint8_t  unit_id = 0;
+    uint16_t sync   = 0;
+    uint64_t cycles = 0;
+    uint64_t sample_us   = 0; /* robot clock, see telemetry_schema.hpp */
+    uint16_t command_seq = 0;
+    uint64_t actuated_us = 0;
+    uint8_t  chksum = 0;
+
+    std::vector<supreme::sim::Motor_Data_t> motors;
+    supreme::Cycle_Timing_Stats_t timing;
+    supreme::Compact_Telemetry_Key compact_key;
+
+    struct Control_t {
+        bool enabled = false;
+        bool usr_pos = false;
+        float amplitude = 0.f;
+        float modulate  = 0.f;
+        float inputgain = 0.f;
+        supreme::ControlMode_t mode = supreme::ControlMode_t::none;
+    } control;
+
+    Telemetry_t(std::size_t num_motors) : motors(num_motors), timing(), compact_key(), control() {}
+};
+
+/* every control mode plus the bare oscillator, names prefixed by the variant */
+template <typename Control_t>
+void run_controllers(Runner& bench, std::string const& variant, Control_t& control)
+{
+    control.enabled   = true;
+    control.amplitude = 1.f;
+    for (unsigned m = 0; m < (unsigned) supreme::ControlMode_t::END_ControlMode_t; ++m) {
+        control.tar_mode = static_cast<supreme::ControlMode_t>(m);
+        control.execute_cycle(); /* switch mode outside of the measurement */
+        bench.run("control/" + variant + "/" + supreme::constants::mode_str[m], [&](uint64_t) { control.execute_cycle(); });
+    }
+    bench.run("so2/" + variant + "/execute_cycle", [&](uint64_t) { control.so2_ctrl.execute_cycle(); });
+}
+
+/* largest difference of the fast oscillators to std::tanh, running side by side from reset */
+void report_so2_deviation(uint64_t cycles)
+{
+    const std::array<float, 4> freqs = {{ .0f, .5f, .85f, 1.f }};
+    jcl::SO2_Bank fast(freqs.size()), reference(freqs.size());
+    for (std::size_t i = 0; i < freqs.size(); ++i) {
+        fast     .set_frequency(i, freqs[i]);
+        reference.set_frequency(i, freqs[i]);
+    }
+    float max_step = .0f, max_total = .0f;
+    for (uint64_t c = 0; c < cycles; ++c) {
+        fast.step();
+        reference.step_reference();
+        for (std::size_t i = 0; i < freqs.size(); ++i) {
+            const float d = std::max(std::fabs(fast.get_x1(i) - reference.get_x1(i)), std::fabs(fast.get_x2(i) - reference.get_x2(i)));
+            max_total = std::max(max_total, d);
+            if (c == 0) max_step = std::max(max_step, d);
+        }
+    }
+    sts_msg("so2/bank_deviation: %g after one step, %g within %llu cycles", max_step, max_total, (unsigned long long) cycles);
+    assertion(max_step < 5e-7f and max_total < 5e-5f, "SO2 oscillators exceed their error bound.");
+}
+
+} /* namespace bench */
+
+
+/* count heap allocations */
+void* operator new(std::size_t size) {
+    bench::allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+
+
+int main(int argc, char* argv[])
+{
+    srand(1); /* repeatable learner initialization */
+
+    const char* output = nullptr;
+    for (int i = 1; i + 1 < argc; ++i)
+        if (strcmp(argv[i], "-o") == 0) output = argv[i+1];
+
+    /* results to stdout: keep it for the JSON, log messages go to stderr */
+    int json_fd = -1;
+    if (output == nullptr) {
+        fflush(stdout);
+        json_fd = dup(STDOUT_FILENO);
+        assertion(json_fd >= 0 and dup2(STDERR_FILENO, STDOUT_FILENO) >= 0, "Cannot redirect log messages to stderr.");
+    }
+
+    supreme::FlatcatSettings settings(argc, argv);
+    supreme::FlatcatRobot    flatcat(settings);
+    supreme::FlatcatControl  control(flatcat, settings);
+
+    bench::Runner bench;
+
+    /* controllers, specialized on the joint count against runtime-sized */
+    supreme::FlatcatControl_T<supreme::constants::num_joints> control_fixed  (flatcat, settings);
+    supreme::FlatcatControl_T<supreme::dynamic_joints       > control_dynamic(flatcat, settings);
+    bench::run_controllers(bench, "fixed"  , control_fixed  );
+    bench::run_controllers(bench, "dynamic", control_dynamic);
+
+    /* oscillators, 64 at once, fast tanh against std::tanh */
+    jcl::SO2_Bank so2_bank(64, .85f);
+    bench.run("so2/bank64/step"          , [&](uint64_t) { so2_bank.step(); });
+    bench.run("so2/bank64/step_reference", [&](uint64_t) { so2_bank.step_reference(); });
+    bench::report_so2_deviation(/*cycles=*/100000);
+
+    bench.run("robot/sim_cycle", [&](uint64_t) { flatcat.execute_cycle(); });
+
+    /* learners */
+    auto move_joints = [&](uint64_t i) {
+        for (auto& j : flatcat.set_joints()) {
+            j.s_ang = 0.5 * sin(0.01 * i + j.joint_id);
+            j.s_vel = 0.5 * cos(0.01 * i + j.joint_id);
+        }
+    };
+
+    learning::GMES_Joint_Group gmes_joint_group(flatcat.get_joints(), 64, 100.0, 0.001, 1);
+    bench.run("gmes_joint_group/execute_cycle", [&](uint64_t i) {
+        move_joints(i);
+        gmes_joint_group.execute_cycle();
+    }, 10000);
+
+    bench::Dummy_Actions actions;
+    learning::GMES_Layer super_layer(16, gmes_joint_group.get_activations(), actions, 2, .1, 10.0, 0.0005, 1);
+    bench.run("gmes_layer/execute_cycle", [&](uint64_t) { super_layer.execute_cycle(); }, 10000);
+
+    /* telemetry */
+    std::array<uint8_t, supreme::constants::max_telemetry_frame_size> frame;
+    std::size_t frame_size = 0;
+    bench.run("telemetry/fill_sendbuffer", [&](uint64_t i) {
+        frame_size = supreme::encode_telemetry_frame(frame.data(), frame.size(), flatcat, control, i);
+    });
+
+    bench::Telemetry_t telemetry(flatcat.get_motors().size());
+    bench.run("telemetry/get_UDP_data", [&](uint64_t) {
+        const supreme::Telemetry_Result_t result = supreme::decode_telemetry_frame(telemetry, frame.data(), frame_size);
+        assertion(result == supreme::Telemetry_Result_t::ok, "Cannot decode telemetry frame: %s"
+                 , supreme::constants::telemetry_result_str[(unsigned) result]);
+    });
+
+    /* compact frames, key frame every 100 frames as configured by default */
+    supreme::Compact_Telemetry_Encoder compact_encoder(100, true);
+    bench.run("telemetry/encode_compact", [&](uint64_t i) {
+        frame_size = compact_encoder.encode(frame.data(), frame.size(), flatcat, control, i);
+    });
+    sts_msg("Telemetry frame size: %u bytes full, %u bytes compact", (unsigned) supreme::telemetry_frame_size(flatcat.get_motors().size()), (unsigned) frame_size);
+
+    compact_encoder.encode(frame.data(), frame.size(), flatcat, control, 0); /* let the decoder see a key frame */
+    supreme::decode_telemetry_frame(telemetry, frame.data(), frame.size());
+    frame_size = compact_encoder.encode(frame.data(), frame.size(), flatcat, control, 1);
+    bench.run("telemetry/decode_compact", [&](uint64_t) {
+        const supreme::Telemetry_Result_t result = supreme::decode_telemetry_frame(telemetry, frame.data(), frame_size);
+        assertion(result == supreme::Telemetry_Result_t::ok, "Cannot decode compact telemetry frame: %s"
+                 , supreme::constants::telemetry_result_str[(unsigned) result]);
+    });
+
+    if (output != nullptr) {
+        FILE* fd = fopen(output, "w");
+        assertion(fd != nullptr, "Cannot open output file: %s", output);
+        bench.write_json(fd);
+        fclose(fd);
+        sts_msg("Results written to %s", output);
+    } else {
+        fflush(stdout);
+        FILE* fd = fdopen(json_fd, "w");
+        assertion(fd != nullptr, "Cannot write results to stdout.");
+        bench.write_json(fd);
+        fclose(fd);
+    }
+
+    return 0;
+}
@@ -5,16 +5,27 @@
 #include <control/controlmixer.h>
 #include <control/control_vector.h>
 
+#include <cmath>
+#include <utility>
+
 #include <flatcat_robot.hpp>
 #include <flatcat_settings.hpp>
 
 #include <controller/csl_control.hpp>
 #include <controller/pid_control.hpp>
 #include <so2_controller.hpp>
+#include <cpg_controller.hpp>
+#include <trajectory_player.hpp>
+#include <gait_library.hpp>
+#include <joint_array.hpp>
 
-namespace supreme {
+/* number of joints the control path is compiled for,
+   0 selects the runtime-sized variant (scons joints=dynamic) */
+#ifndef FLATCAT_JOINTS
+#define FLATCAT_JOINTS 3
+#endif
 
-typedef std::array<float, constants::num_joints> TargetPosition_t;
+namespace supreme {
 
 enum class ControlMode_t : uint8_t
 {
@@ -23,35 +34,33 @@ enum class ControlMode_t : uint8_t
     csl_hold,
     so2_osc,
     behavior,
+    cpg,
+    trajectory,
     END_ControlMode_t
 };
 
 namespace constants {
 
- /* current default position for Hannah standing */
-    const TargetPosition_t default_position =
-    { 0.25, /* HEAD */
-      0.25, /* BODY */
-      0.25, /* TAIL */
-    };
-
-    const TargetPosition_t test_position0 =
-    { 0.00, /* HEAD */
-      0.00, /* BODY */
-      0.00, /* TAIL */
-    };
+ /* current default position for Hannah standing, same for all joints */
+    const float default_position = 0.25;
+    const float test_position0   = 0.00;
 
     const float Kp = 3.0;
     const float Ki = 0.01;
     const float Kd = 0.0;
 
-    const std::array<const char*, (unsigned) ControlMode_t::END_ControlMode_t> mode_str = { "NONE", "POS", "HOLD", "SO2", "BEHV" };
+    const std::array<const char*, (unsigned) ControlMode_t::END_ControlMode_t> mode_str = { "NONE", "POS", "HOLD", "SO2", "BEHV", "CPG", "TRAJ" };
 
 } /* constants */
 
-class FlatcatControl {
+template <std::size_t NumJoints>
+class FlatcatControl_T {
 public:
 
+    typedef Joint_Array<float      , NumJoints> TargetPosition_t;
+    typedef Joint_Array<csl_control, NumJoints> CSL_Vector_t;
+    typedef Joint_Array<pid_control, NumJoints> PID_Vector_t;
+
     bool enabled = false;
     bool usr_pos = false;
 
@@ -68,21 +77,53 @@ public:
 
     ControlMode_t             cur_mode, tar_mode;
 
-    std::vector<csl_control>  csl_ctrl;
-    std::vector<pid_control>  pid_ctrl;
+    const float               dt;             // controllers run at the scheduled loop rate
+
+    CSL_Vector_t              csl_ctrl;
+    PID_Vector_t              pid_ctrl;
+
+    /* crossfade on mode changes, the outgoing mode keeps running on its own
+       copy of the CSLs and PIDs while its output fades out and the incoming one's in */
+    const unsigned            fade_cycles;    // 0 switches at once, resetting the controllers
+    unsigned                  fade;
+    ControlMode_t             out_mode;
+    CSL_Vector_t              csl_fade;
+    PID_Vector_t              pid_fade;
+    TargetPosition_t          fade_out;
+
+    jcl::SO2_Controller<NumJoints> so2_ctrl;
+    jcl::CPG_Controller<NumJoints> cpg_ctrl;
+
+    Trajectory_Player<NumJoints> player;
+    const float               feedforward;    // motor output per joint velocity of the trajectory
 
-    jcl::SO2_Controller       so2_ctrl;
+    /* gait parameter_id, modulate blends from it towards the next one */
+    Gait_Library              gaits;
+    bool                      gait_changed = true;
+    float                     gait_modulate = 0.f;
 
-    FlatcatControl(FlatcatRobot& robot, FlatcatSettings const& settings)
+    FlatcatControl_T(FlatcatRobot& robot, FlatcatSettings const& settings)
     : robot(robot)
     //, jointcontrol(robot)
     //, parameter_set(settings.max_number_of_gaits, settings.lib_folder)
-    , usr_params()
+    , usr_params(checked_number_of_joints(robot), [](std::size_t) { return .0f; })
     , cur_mode(ControlMode_t::none)
     , tar_mode(ControlMode_t::none)
-    , csl_ctrl()
-    , pid_ctrl()
+    , dt(1.f / settings.update_rate_Hz)
+    , csl_ctrl(robot.get_number_of_joints(), [this](std::size_t i) { return make_csl(i); })
+    , pid_ctrl(robot.get_number_of_joints(), [this](std::size_t i) { return make_pid(i); })
+    , fade_cycles(static_cast<unsigned>(std::lround(settings.mode_crossfade_s * settings.update_rate_Hz)))
+    , fade(fade_cycles)
+    , out_mode(ControlMode_t::none)
+    , csl_fade(robot.get_number_of_joints(), [this](std::size_t i) { return make_csl(i); })
+    , pid_fade(robot.get_number_of_joints(), [this](std::size_t i) { return make_pid(i); })
+    , fade_out(robot.get_number_of_joints(), [](std::size_t) { return .0f; })
     , so2_ctrl(robot, csl_ctrl, usr_params)
+    , cpg_ctrl(robot, csl_ctrl, robot.get_number_of_joints(), checked_topology(settings.cpg_topology)
+              , settings.cpg_coupling, settings.cpg_phase_rate, settings.cpg_amplitude_rate, dt)
+    , player(settings.lib_folder, robot.get_number_of_joints(), settings.max_number_of_trajectories)
+    , feedforward(settings.trajectory_feedforward)
+    , gaits(settings.lib_folder + settings.gait_file, robot.get_number_of_joints(), settings.max_number_of_gaits, settings.gait_reload_interval_ms)
     {
         //parameter_set.add(control::get_initial_parameter(robot, {0.1,-0.4, 1.0}, true));
         //parameter_set.add(control::get_initial_parameter(robot, {0.0, -.5, 0.0}, true));
@@ -100,33 +141,54 @@ public:
         //mixed_jointcontrol.set_control_parameter(0, parameter_set.get(1));
         //mixed_jointcontrol.set_control_parameter(1, parameter_set.get(0));
 
-        for (unsigned i = 0; i < constants::num_joints; ++i)
+        for (unsigned i = 0; i < robot.get_number_of_joints(); ++i)
         {
-            /* configure CSLs */
-            csl_ctrl.emplace_back(i, 0.01f /*100Hz*/);
-            auto & c = csl_ctrl.back();
-            auto const& j = robot.get_joints()[i];
-            c.target_csl_mode = 1.0;
-            c.target_csl_fb   = 1.0;
-            c.limit_lo = j.limit_lo + 0.05;
-            c.limit_hi = j.limit_hi - 0.05;
-            c.update_mode();
-
-            /* setup and configure PID controller */
-            pid_ctrl.emplace_back(i, 0.01f /*100Hz*/);
-            auto & p = pid_ctrl.back();
-            p.set_pid(constants::Kp, constants::Ki, constants::Kd);
-            //TODO: p.set_dead_band(0.02); //1%
-            //TODO: p.set_pulse_mode_threshold(0.05);
-
             /* general */
 			sts_msg("setting controller voltage and type for motor %u", i);
             auto & m = robot.set_motors()[i];
             m.set_voltage_limit(settings.voltage_limit);
-            m.set_controller_type(supreme::sensorimotor::Controller_t::voltage);
+            m.set_controller_type(Controller_t::voltage);
         }
     }
 
+    static std::size_t checked_number_of_joints(FlatcatRobot const& robot) {
+        assertion(NumJoints == dynamic_joints or NumJoints == robot.get_number_of_joints()
+                 , "Control is built for %u joints, unit %u has %u. Rebuild with scons joints=%u or joints=dynamic."
+                 , (unsigned) NumJoints, robot.get_unit_id(), (unsigned) robot.get_number_of_joints(), (unsigned) robot.get_number_of_joints());
+        return robot.get_number_of_joints();
+    }
+
+    static jcl::cpg::Topology_t checked_topology(std::string const& name) {
+        jcl::cpg::Topology_t topology = jcl::cpg::Topology_t::chain;
+        assertion(jcl::cpg::parse_topology(name, topology), "Unknown CPG topology: %s (none, chain, ring or all)", name.c_str());
+        return topology;
+    }
+
+    /* configure CSLs */
+    csl_control make_csl(std::size_t i) const {
+        csl_control c(i, dt);
+        auto const& j = robot.get_joints()[i];
+        c.target_csl_mode = 1.0;
+        c.target_csl_fb   = 1.0;
+        c.limit_lo = j.limit_lo + 0.05;
+        c.limit_hi = j.limit_hi - 0.05;
+        c.update_mode();
+        return c;
+    }
+
+    /* setup and configure PID controller */
+    pid_control make_pid(std::size_t i) const {
+        pid_control p(i, dt);
+        p.set_pid(constants::Kp, constants::Ki, constants::Kd);
+        //TODO: p.set_dead_band(0.02); //1%
+        //TODO: p.set_pulse_mode_threshold(0.05);
+        return p;
+    }
+
+    /* unrolled for fixed joint counts */
+    template <typename Fn>
+    void for_each_joint(Fn&& fn) const { Joint_Loop<NumJoints>::apply(usr_params.size(), fn); }
+
    /* void set_control_parameter(unsigned idx) {
         if (idx < parameter_set.size())
             control.set_control_parameter(parameter_set.get(idx));
@@ -136,87 +198,231 @@ public:
     void position_control() {
 
         const float a = clip(modulate, 0.f, 1.f);
+        auto& joints = robot.set_joints();
 
         if (!usr_pos) {
 			//sts_msg("posenabled");
-            for (auto& j : robot.set_joints())
-                pid_ctrl.at(j.joint_id).set_target_value( (1.f - a) * constants::default_position.at(j.joint_id)
-                                                         +       a  * constants::test_position0  .at(j.joint_id) );
+            const float target = (1.f - a) * constants::default_position
+                               +       a  * constants::test_position0;
+            for_each_joint([&](std::size_t i) { pid_ctrl[i].set_target_value(target); });
         } else {
-            for (auto const& j : robot.get_joints())
-                pid_ctrl.at(j.joint_id).set_target_value( usr_params.at(j.joint_id) );
+            for_each_joint([&](std::size_t i) { pid_ctrl[i].set_target_value(usr_params[i]); });
         }
 
-        for (auto& j : robot.set_joints())
+        for_each_joint([&](std::size_t i)
         {
-            const float out = pid_ctrl.at(j.joint_id).step(j.s_ang);
-            j.motor = enabled ? out : .0; // apply only if enabled
-        }
+            const float out = pid_ctrl[i].step(joints[i].s_ang);
+            joints[i].motor = enabled ? out : .0; // apply only if enabled
+        });
     }
 
     void resetting_pid(void) { for (auto& p : pid_ctrl) p.reset(); }
 
+    /* follows the trajectory being played, velocity fed forward */
+    void trajectory_control(void)
+    {
+        auto& joints = robot.set_joints();
+        player.execute_cycle(dt);
+
+        for_each_joint([&](std::size_t i)
+        {
+            pid_ctrl[i].set_target_value(player.get_position(i));
+            const float out = pid_ctrl[i].step(joints[i].s_ang) + feedforward * player.get_velocity(i);
+            joints[i].motor = enabled ? out : .0; // apply only if enabled
+        });
+    }
+
+    /* starts over if a trajectory is playing already */
+    void select_trajectory(unsigned id) {
+        if (player.select(id) and cur_mode == ControlMode_t::trajectory)
+            player.start(robot.get_joints());
+    }
+
     void csl_hold_mode(void)
     {
-        for (auto& j : robot.set_joints())
+        auto& joints = robot.set_joints();
+        for_each_joint([&](std::size_t i)
         {
-            auto &csl = csl_ctrl.at(j.joint_id);
+            auto &csl = csl_ctrl[i];
             csl.target_csl_fb = 1.0;
             csl.gi_pos = 2.5;
-            float out = csl.step(j.s_ang, usr_params.at(j.joint_id));
-            j.motor = enabled ? out : .0; // apply only if enabled
-        }
+            float out = csl.step(joints[i].s_ang, usr_params[i]);
+            joints[i].motor = enabled ? out : .0; // apply only if enabled
+        });
     }
 
     void csl_behavioral_mode(void) {
-        for (auto& j : robot.set_joints())
+        auto& joints = robot.set_joints();
+        for_each_joint([&](std::size_t i)
         {
-            auto &csl = csl_ctrl.at(j.joint_id);
-            csl.target_csl_mode = clip(usr_params.at(j.joint_id),-1.f,+1.f);
+            auto &csl = csl_ctrl[i];
+            csl.target_csl_mode = clip(usr_params[i],-1.f,+1.f);
             csl.target_csl_fb = 1.006;
             csl.gi_pos = 2.0;
-            float out = csl.step(j.s_ang);
-            j.motor = enabled ? out : .0; // apply only if enabled
-        }
+            float out = csl.step(joints[i].s_ang);
+            joints[i].motor = enabled ? out : .0; // apply only if enabled
+        });
     }
 
     void resetting_csl(void) {
-        for (auto const& j : robot.get_joints())
-        {
-            csl_ctrl.at(j.joint_id).reset(j.s_ang);
+        auto const& joints = robot.get_joints();
+        for_each_joint([&](std::size_t i) { csl_ctrl[i].reset(joints[i].s_ang); });
+    }
+
+
+    void select_gait(unsigned id) {
+        if (id < gaits.size()) {
+            parameter_id = id;
+            gait_changed = true;
+        } else wrn_msg("No gait with ID = %u", id);
+    }
+
+    /* oscillator parameters from the gait library, when the selection, modulate or the file changed */
+    void apply_gait(void)
+    {
+        if (gaits.update() or modulate != gait_modulate)
+            gait_changed = true;
+        if (not gait_changed or gaits.size() == 0)
+            return;
+        gait_changed  = false;
+        gait_modulate = modulate;
+
+        if (parameter_id >= gaits.size())
+            parameter_id = 0; /* reloaded with less gaits */
+        const std::size_t g0 = parameter_id;
+        const std::size_t g1 = std::min<std::size_t>(parameter_id + 1, gaits.size() - 1);
+        const float m = clip(modulate, 0.f, 1.f);
+
+        const float freq = (1.f - m) * gaits.get_frequency(g0) + m * gaits.get_frequency(g1);
+        so2_ctrl.set_frequency(freq);
+        cpg_ctrl.set_frequency(freq);
+
+        for_each_joint([&](std::size_t i) {
+            const jcl::so2::Params_t p = jcl::so2::blend(gaits.get_params(g0, i), gaits.get_params(g1, i), m);
+            so2_ctrl.set_params(i, p);
+            cpg_ctrl.set_params(i, p);
+        });
+    }
+
+    static bool uses_pid(ControlMode_t mode) {
+        return mode == ControlMode_t::position or mode == ControlMode_t::trajectory;
+    }
+
+    static bool uses_csl(ControlMode_t mode) {
+        return mode == ControlMode_t::csl_hold or mode == ControlMode_t::so2_osc
+            or mode == ControlMode_t::behavior or mode == ControlMode_t::cpg;
+    }
+
+    /* the oscillators keep running through mode changes,
+       the single one and the CPG taking over each other's wave */
+    void hand_over_oscillators(void)
+    {
+        if (tar_mode == ControlMode_t::cpg and cur_mode == ControlMode_t::so2_osc)
+            cpg_ctrl.synchronize(so2_ctrl.get_oscillator().get_x1(0), so2_ctrl.get_oscillator().get_x2(0));
+
+        if (tar_mode == ControlMode_t::so2_osc) {
+            if (cur_mode == ControlMode_t::cpg) {
+                float x1, x2;
+                cpg_ctrl.get_wave(x1, x2);
+                so2_ctrl.synchronize(x1, x2);
+            } else
+                so2_ctrl.reset();
+        }
+    }
+
+    void change_mode(void)
+    {
+        if (fade_cycles == 0) {
+            resetting_csl();
+            resetting_pid();
+            hand_over_oscillators();
+            if (tar_mode == ControlMode_t::trajectory)
+                player.start(robot.get_joints());
+            cur_mode = tar_mode;
+            return;
+        }
+
+        /* running controllers are handed over as they are, idle CSLs start from the current angles
+           and idle PIDs anew, a mode change while fading drops the older outgoing mode */
+        if (not uses_csl(cur_mode))
+            resetting_csl();
+        if (not uses_pid(cur_mode))
+            resetting_pid();
+        for_each_joint([&](std::size_t i) { csl_fade[i] = csl_ctrl[i]; pid_fade[i] = pid_ctrl[i]; });
+
+        hand_over_oscillators();
+        if (tar_mode == ControlMode_t::trajectory)
+            player.start(robot.get_joints());
+
+        out_mode = cur_mode;
+        cur_mode = tar_mode;
+        fade = 0;
+    }
+
+    void run_mode(ControlMode_t mode)
+    {
+        switch(mode) {
+            case ControlMode_t::csl_hold: csl_hold_mode();          break;
+            case ControlMode_t::position: position_control();       break;
+            case ControlMode_t::so2_osc : so2_ctrl.execute_cycle(); break;
+            case ControlMode_t::behavior: csl_behavioral_mode();    break;
+            case ControlMode_t::cpg     : cpg_ctrl.execute_cycle(); break;
+            case ControlMode_t::trajectory: trajectory_control();   break;
+            case ControlMode_t::none    :
+            default: {
+                auto& joints = robot.set_joints();
+                for_each_joint([&](std::size_t i) { joints[i].motor = .0f; });
+            }   break;
         }
     }
 
+    void swap_controllers(void) {
+        using std::swap;
+        for_each_joint([&](std::size_t i) { swap(csl_ctrl[i], csl_fade[i]); swap(pid_ctrl[i], pid_fade[i]); });
+    }
+
+    /* both modes run, their outputs mixed linearly over the fade */
+    void crossfade(void)
+    {
+        const float w = static_cast<float>(++fade) / fade_cycles;
+        auto& joints = robot.set_joints();
+
+        swap_controllers();
+        run_mode(out_mode);
+        swap_controllers();
+        for_each_joint([&](std::size_t i) { fade_out[i] = joints[i].motor.get(); });
+
+        run_mode(cur_mode);
+        for_each_joint([&](std::size_t i) { joints[i].motor = (1.f - w) * fade_out[i] + w * joints[i].motor.get(); });
+    }
 
     void execute_cycle(void)
     {
+        apply_gait();
 
         if (enabled)
         {
-            /* update and reset if mode changes */
-            if (cur_mode != tar_mode) {
-                resetting_csl();
-                resetting_pid();
-                so2_ctrl.reset();
-                cur_mode = tar_mode;
-            }
-
-            switch(cur_mode) {
-                case ControlMode_t::csl_hold: csl_hold_mode();          break;
-                case ControlMode_t::position: position_control();       break;
-                case ControlMode_t::so2_osc : so2_ctrl.execute_cycle(); break;
-                case ControlMode_t::behavior: csl_behavioral_mode();    break;
-                case ControlMode_t::none    :
-                default:                      robot.disable_motors();   break;
+            if (cur_mode != tar_mode)
+                change_mode();
+
+            if (fade < fade_cycles)
+                crossfade();
+            else {
+                run_mode(cur_mode);
+                if (cur_mode == ControlMode_t::none)
+                    robot.disable_motors();
             }
-
         }
-        else
+        else {
+            fade = fade_cycles; /* nothing to fade from when enabled again */
             robot.disable_motors();
+        }
     }
 
 };
 
+typedef FlatcatControl_T<FLATCAT_JOINTS> FlatcatControl;
+
 } /* namespace supreme */
 
 #endif /* HANNAH_CONTROL_HPP */
@@ -175,10 +175,7 @@ public:
 
     std::vector<MotorPlot> plots;
 
-    std::vector<MotorPlot::PlotConf> confs = {{0x0, "0 Head", 0.0, +0.50, 1.2, 0.5}
-                                             ,{0x1, "1 Body", 0.0, +0.00, 1.2, 0.5}
-                                             ,{0x2, "2 Tail", 0.0, -0.50, 1.2, 0.5}
-                                             };
+    std::vector<MotorPlot::PlotConf> confs; /* one per motor, stacked from head to tail */
 
     //MotorPlot::PlotConf  accel_conf = {0, "acceleration", +0.0, +1.10, 1.8, 0.20};
     //TODO AccelPlot accel_plot;
@@ -186,6 +183,7 @@ public:
     template <typename RobotType, typename TargetPositionType>
     FlatcatGraphics(RobotType const& robot, TargetPositionType const& targets)
     : plots()
+    , confs()
     //TODO, accel_plot(robot.get_accels(), accel_conf)
     {
         sts_msg("Creating Flatcat Graphics");
@@ -193,7 +191,12 @@ public:
         assert(motors.size() > 0);
         plots.reserve(motors.size());
         assert(targets.size() >= motors.size());
-        assert(confs  .size() >= motors.size());
+
+        /* plots keep a reference to their conf, so fill all before creating plots */
+        const float h = 1.5f / motors.size();
+        confs.reserve(motors.size());
+        for (unsigned i = 0; i < motors.size(); ++i)
+            confs.push_back({i, std::to_string(i) + " " + joint_name(i, motors.size()), 0.0, 0.75f - h*(i + 0.5f), 1.2, h});
 
         for (std::size_t i = 0; i < motors.size(); ++i) {
             plots.emplace_back(motors[i], confs[i], targets[i]);
@@ -3,29 +3,56 @@
 
 #include <cassert>
 #include <array>
+#include <string>
+#include <cstdio>
 #include <common/log_messages.h>
 
 #include <robots/robot.h>
 #include <robots/joint.h>
 #include <robots/accel.h>
 
+#ifdef FLATCAT_SIMULATION
+#include <simulated_motorcord.hpp>
+#else
 #include <communication_ctrl.hpp>
 #include <motorcord.hpp>
+#endif
+
 #include <flatcat_settings.hpp>
+#include <cycle_timing.hpp>
 
 namespace supreme {
 
 namespace constants {
-    const unsigned num_joints = 3;
+    const unsigned num_joints = 3; /* default flatcat, head, body and tail */
 
-    const std::array<int16_t, num_joints> dir = { +1, +1, +1};
+    const int16_t dir = +1;
     const double position_scale = 270.0/360.0;
 
 } /* namespace constants */
 
+/* HEAD, MIDL, TAIL for the three-segment flatcat, numbered body segments for longer ones */
+inline std::string joint_name(unsigned index, unsigned number_of_joints) {
+    if (index == 0) return "HEAD";
+    if (index + 1 == number_of_joints) return "TAIL";
+    if (number_of_joints == constants::num_joints) return "MIDL";
+    char name[8];
+    snprintf(name, sizeof(name), "MD%02u", index);
+    return name;
+}
+
+#ifdef FLATCAT_SIMULATION
+typedef sim::motorcord                 Motorcord_t;
+typedef sim::Controller_t              Controller_t;
+#else
+typedef supreme::motorcord             Motorcord_t;
+typedef supreme::sensorimotor::Controller_t Controller_t;
+#endif
+
 class FlatcatRobot : public robots::Robot_Interface
 {
-    supreme::motorcord motorcord;
+    const unsigned unit_id;
+    Motorcord_t motorcord;
 
     std::size_t number_of_joints;
     std::size_t number_of_joints_sym;
@@ -37,26 +64,40 @@ class FlatcatRobot : public robots::Robot_Interface
     double voltage_amp = 0.;
     bool   enabled = false;
 
+    Cycle_Timing timing;
+
+    /* last tagged command (binary protocol seq) and the bus cycle that
+       first carried its effect to the motors */
+    struct Command_Echo_t {
+        bool     pending     = false; /* applied, outputs not yet written */
+        bool     armed       = false; /* outputs written in the next bus cycle */
+        uint16_t seq         = 0;
+        uint16_t armed_seq   = 0;
+        uint16_t actuated    = 0;
+        uint64_t actuated_us = 0;
+    } echo;
+
 public:
 
 
-    FlatcatRobot(FlatcatSettings const& settings)
-    : motorcord(constants::num_joints, 100.0/*Hz*/, false)
+    FlatcatRobot(FlatcatSettings const& settings, unsigned unit_id = 0)
+    : unit_id(unit_id)
+    , motorcord(settings.number_of_joints(unit_id), settings.update_rate_Hz, false)
     , number_of_joints(motorcord.size())
     , number_of_joints_sym(/* will be counted */)
     , number_of_accels(1)
     , joints()
     , accels()
+    , timing()
     {
 
-        assert(motorcord.size() == constants::num_joints);
-        sts_msg("Creating Flatcat Robot Interface");
+        assert(motorcord.size() == settings.number_of_joints(unit_id));
+        sts_msg("Creating Flatcat Robot Interface for unit %u with %u joints", unit_id, settings.number_of_joints(unit_id));
         joints.reserve(number_of_joints);
 
         /* define joints */
-        joints.emplace_back(  0, robots::Joint_Type_Normal,  0, "HEAD" , -0.75, +0.75, .0 );
-        joints.emplace_back(  1, robots::Joint_Type_Normal,  1, "MIDL" , -0.75, +0.75, .0 );
-        joints.emplace_back(  2, robots::Joint_Type_Normal,  2, "TAIL" , -0.75, +0.75, .0 );
+        for (unsigned i = 0; i < number_of_joints; ++i)
+            joints.emplace_back(  i, robots::Joint_Type_Normal,  i, joint_name(i, number_of_joints), -0.75, +0.75, .0 );
 
         unsigned i = 0;
         for (auto const& j : joints) {
@@ -66,18 +107,21 @@ public:
 
         accels.emplace_back();
 
-        /* configure joints */
-        assertion(settings.joint_offsets.size() == joints.size(), "%u =!= %u", settings.joint_offsets.size(), joints.size());
+        /* configure joints, offsets of all units are listed one after another */
+        const unsigned first = settings.first_joint(unit_id);
+        assertion(settings.joint_offsets.size() >= first + joints.size(), "%u =!= %u", (unsigned) settings.joint_offsets.size(), (unsigned) (first + joints.size()));
         for (auto const& j : joints) {
             unsigned i = j.joint_id;
-            assert(i < constants::num_joints);
+            assert(i < number_of_joints);
             auto& m  = motorcord[i];
-            m.set_direction  (constants::dir.at(i)        );
-            m.set_scalefactor(constants::position_scale   );
-            m.set_offset     (settings.joint_offsets.at(i));
+            m.set_direction  (constants::dir                      );
+            m.set_scalefactor(constants::position_scale           );
+            m.set_offset     (settings.joint_offsets.at(first + i));
         }
     }
 
+    unsigned get_unit_id(void) const { return unit_id; }
+
     std::size_t get_number_of_joints           (void) const { return number_of_joints;     }
     std::size_t get_number_of_symmetric_joints (void) const { return number_of_joints_sym; }
     std::size_t get_number_of_accel_sensors    (void) const { return number_of_accels;     }
@@ -90,9 +134,14 @@ public:
 
     bool execute_cycle(void)
     {
+        timing.start();
         write_motorcord();          /* write motors     */
+        timing.lap(Phase_t::write_motorcord);
         motorcord.execute_cycle();  /* read motor cord  */
+        timing.lap(Phase_t::motorcord);
+        update_command_echo();
         read_motorcord();           /* read sensors     */
+        timing.lap(Phase_t::read_motorcord);
         return true;
     }
 
@@ -142,12 +191,40 @@ public:
             motorcord[j.joint_id].set_target_voltage(.0);
 	}
 
+    /* a command is applied to the controller before this cycle's
+       execute_cycle(), the outputs computed from it reach the motors with
+       the bus transaction of the following cycle */
+    void note_command(uint16_t seq) {
+        echo.pending = true;
+        echo.seq     = seq;
+    }
+
+    void update_command_echo(void) {
+        if (echo.armed) {
+            echo.actuated    = echo.armed_seq;
+            echo.actuated_us = get_sample_time_us();
+            echo.armed       = false;
+        }
+        if (echo.pending) {
+            echo.armed     = true;
+            echo.armed_seq = echo.seq;
+            echo.pending   = false;
+        }
+    }
+
+    /* end of the last bus transaction, which wrote the outputs and read the sensors (robot clock) */
+    uint64_t get_sample_time_us (void) const { return timing.get_end_ns(Phase_t::motorcord) / constants::ns_per_us; }
+    uint16_t get_command_seq    (void) const { return echo.actuated;    }
+    uint64_t get_actuated_us    (void) const { return echo.actuated_us; }
+
     /* non-robot interface member function */
-    //SpinalCord::TimingStats const& get_motorcord_timing(void) const { return spinalcord.get_timing(); }
-    void reset_motor_statistics(void) { /**TODO spinalcord.reset_statistics();*/ }
+    Cycle_Timing const& get_cycle_timing(void) const { return timing; }
+    Cycle_Timing      & set_cycle_timing(void)       { return timing; }
+
+    void reset_motor_statistics(void) { timing.reset(); }
 
-    supreme::motorcord const& get_motors(void) const { return motorcord; }
-    supreme::motorcord      & set_motors(void)       { return motorcord; }
+    Motorcord_t const& get_motors(void) const { return motorcord; }
+    Motorcord_t      & set_motors(void)       { return motorcord; }
 };
 
 } /* namespace supreme */
@@ -2,6 +2,12 @@
 #define FLATCAT_SETTINGS_HPP
 
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <common/log_messages.h>
 #include <common/settings.h>
 #include <common/vector_n.h>
 
@@ -12,6 +18,10 @@ namespace defaults {
     const std::string lib_folder = "./data/lib_flatcat/";
     const std::string settings_filename = "flatcat.dat";
     const std::size_t max_number_of_gaits = 8;
+
+    /* gait library in lib_folder, checked for changes every n ms (0 loads once) */
+    const std::string gait_file = "gaits.bin";
+    const unsigned    gait_reload_interval_ms = 500;
     const std::string group = "224.0.0.1";//"239.255.255.252";
     const unsigned port = 1900;
     const VectorN joint_offsets = { .0, /* HEAD 0 */
@@ -19,7 +29,74 @@ namespace defaults {
                                     .0  /* TAIL 2 */
                                   };
 
+    /* one entry per unit (motorcord), number of joints each,
+       joint_offsets lists the offsets of all units one after another */
+    const VectorN unit_joints = { 3 };
+
     const float voltage_limit = 0.25;
+
+    const unsigned update_rate_Hz = 100;
+    const std::string overrun_policy = "catchup"; // or "skip"
+
+    /* central pattern generator (control mode CPG): coupling of the joints'
+       oscillators (none, chain, ring or all) and its strength, the rates at
+       which phase (degrees per s) and amplitude targets (per s) are approached */
+    const std::string cpg_topology       = "chain";
+    const float       cpg_coupling       = 0.1f;
+    const float       cpg_phase_rate     = 90.f;
+    const float       cpg_amplitude_rate = 1.f;
+
+    /* seconds over which the outputs of two control modes are crossfaded
+       when switching, 0 switches at once and resets the controllers */
+    const float       mode_crossfade_s   = 0.5f;
+
+    /* trajectories, lib_folder/trajectory_<id>.trj with ids below the maximum,
+       and the motor output fed forward per unit of joint velocity (1/s) */
+    const unsigned    max_number_of_trajectories = 16;
+    const float       trajectory_feedforward     = 0.1f;
+
+    /* several cycles per datagram when batching, always sent with sendmmsg */
+    const bool     telemetry_batching            = false;
+    const unsigned telemetry_cycles_per_datagram = 1;
+
+    /* telemetry to the group as well, otherwise only to the subscribers */
+    const bool     telemetry_multicast           = false;
+
+    /* command clients silent for n seconds are dropped (0 keeps them), every
+       command line counts, SUB=... subscribers stay until UNS=... */
+    const unsigned subscriber_timeout_s          = 10;
+
+    /* receivers always sent to, <ip>:<port>[,<decimation>[,<fields>]] separated by spaces */
+    const std::string subscribers                = "";
+
+    /* fixed-point telemetry with a key frame every n frames,
+       slow fields (temperature, supply voltage) delta-coded in between */
+    const bool     telemetry_compact             = false;
+    const unsigned telemetry_key_interval        = 100;
+    const bool     telemetry_delta_slow_fields   = true;
+
+    /* flight recorder, ring file of the last n seconds of all units, empty name disables,
+       about 78 kB per second and unit at 100 Hz */
+    const std::string recorder_file             = "";      // e.g. "flight.rec"
+    const unsigned    recorder_duration_s       = 60;
+    const unsigned    recorder_sync_interval_ms = 1000;
+
+    /* terminals, what they ask the robot for when connecting: every n-th cycle
+       and which fields, e.g. "position,velocity,timing" (see telemetry_schema.hpp) */
+    const unsigned    subscribe_decimation      = 1;
+    const std::string subscribe_fields          = "all";
+
+    /* real-time profile of the control loop */
+    const bool        rt_enable       = false;
+    const unsigned    rt_priority     = 80;
+    const std::string rt_control_cpus = "";    // e.g. "3" (isolated core)
+    const std::string rt_comm_cpus    = "";    // e.g. "0-2"
+    const bool        rt_lock_memory  = true;
+}
+
+namespace constants {
+    const unsigned max_units           = 8;
+    const unsigned max_joints_per_unit = 16;
 }
 
 class FlatcatSettings : public Settings_Base
@@ -28,10 +105,47 @@ public:
 
     unsigned max_number_of_gaits;
     std::string lib_folder;
+    std::string gait_file;
+    unsigned gait_reload_interval_ms;
     std::string group;
     unsigned port;
     VectorN joint_offsets;
+    VectorN unit_joints;
     float voltage_limit;
+    unsigned update_rate_Hz;
+    std::string overrun_policy;
+
+    std::string cpg_topology;
+    float       cpg_coupling;
+    float       cpg_phase_rate;
+    float       cpg_amplitude_rate;
+
+    float       mode_crossfade_s;
+
+    unsigned    max_number_of_trajectories;
+    float       trajectory_feedforward;
+
+    bool        telemetry_batching;
+    unsigned    telemetry_cycles_per_datagram;
+    bool        telemetry_multicast;
+    unsigned    subscriber_timeout_s;
+    std::string subscribers;
+    bool        telemetry_compact;
+    unsigned    telemetry_key_interval;
+    bool        telemetry_delta_slow_fields;
+
+    std::string recorder_file;
+    unsigned    recorder_duration_s;
+    unsigned    recorder_sync_interval_ms;
+
+    unsigned    subscribe_decimation;
+    std::string subscribe_fields;
+
+    bool        rt_enable;
+    unsigned    rt_priority;
+    std::string rt_control_cpus;
+    std::string rt_comm_cpus;
+    bool        rt_lock_memory;
 
     VectorN sarsa_learning_rates = {0.05, 0.05, 0.005, 0.005};
     uint64_t trial_time_s = 60;
@@ -44,21 +158,114 @@ public:
     std::string save_state_name;
     std::string save_folder = "./data/";
     bool clear_state;
+    bool free_running;
+    unsigned unit_id; /* unit observed by the terminals */
+
+    /* learning terminal, replays a flight recorder file instead of the live telemetry */
+    std::string replay_file;
+    double      replay_speed;      /* times real-time, 0 = as fast as possible */
+    uint64_t    replay_from_cycle;
 
     FlatcatSettings(int argc, char **argv)
     : Settings_Base       (argc, argv                          , defaults::settings_filename.c_str())
     , max_number_of_gaits (read_uint ("max_number_of_gaits"    , defaults::max_number_of_gaits     ))
     , lib_folder          (read_str  ("lib_folder"             , defaults::lib_folder              ))
+    , gait_file           (read_str  ("gait_file"              , defaults::gait_file               ))
+    , gait_reload_interval_ms(read_uint("gait_reload_interval_ms", defaults::gait_reload_interval_ms))
     , group               (read_str  ("group"                  , defaults::group                   ))
     , port                (read_uint ("port"                   , defaults::port                    ))
     , joint_offsets       (read_vec  ("joint_offsets"          , defaults::joint_offsets           ))
+    , unit_joints         (read_vec  ("unit_joints"            , defaults::unit_joints             ))
     , voltage_limit       (read_float("voltage_limit"          , defaults::voltage_limit           ))
+    , update_rate_Hz      (read_uint ("update_rate_Hz"         , defaults::update_rate_Hz          ))
+    , overrun_policy      (read_str  ("overrun_policy"         , defaults::overrun_policy          ))
+    , cpg_topology        (read_str  ("cpg_topology"           , defaults::cpg_topology            ))
+    , cpg_coupling        (read_float("cpg_coupling"           , defaults::cpg_coupling            ))
+    , cpg_phase_rate      (read_float("cpg_phase_rate"         , defaults::cpg_phase_rate          ))
+    , cpg_amplitude_rate  (read_float("cpg_amplitude_rate"     , defaults::cpg_amplitude_rate      ))
+    , mode_crossfade_s    (read_float("mode_crossfade_s"       , defaults::mode_crossfade_s        ))
+    , max_number_of_trajectories(read_uint("max_number_of_trajectories", defaults::max_number_of_trajectories))
+    , trajectory_feedforward(read_float("trajectory_feedforward", defaults::trajectory_feedforward    ))
+    , telemetry_batching  (read_uint ("telemetry_batching"     , defaults::telemetry_batching) != 0 )
+    , telemetry_cycles_per_datagram(read_uint("telemetry_cycles_per_datagram", defaults::telemetry_cycles_per_datagram))
+    , telemetry_multicast (read_uint ("telemetry_multicast"    , defaults::telemetry_multicast) != 0)
+    , subscriber_timeout_s(read_uint ("subscriber_timeout_s"   , defaults::subscriber_timeout_s    ))
+    , subscribers         (read_str  ("subscribers"            , defaults::subscribers             ))
+    , telemetry_compact   (read_uint ("telemetry_compact"      , defaults::telemetry_compact ) != 0 )
+    , telemetry_key_interval(read_uint("telemetry_key_interval", defaults::telemetry_key_interval   ))
+    , telemetry_delta_slow_fields(read_uint("telemetry_delta_slow_fields", defaults::telemetry_delta_slow_fields) != 0)
+    , recorder_file       (read_str  ("recorder_file"          , defaults::recorder_file           ))
+    , recorder_duration_s (read_uint ("recorder_duration_s"    , defaults::recorder_duration_s     ))
+    , recorder_sync_interval_ms(read_uint("recorder_sync_interval_ms", defaults::recorder_sync_interval_ms))
+    , subscribe_decimation(read_uint ("subscribe_decimation"   , defaults::subscribe_decimation    ))
+    , subscribe_fields    (read_str  ("subscribe_fields"       , defaults::subscribe_fields        ))
+    , rt_enable           (read_uint ("rt_enable"              , defaults::rt_enable      ) != 0   )
+    , rt_priority         (read_uint ("rt_priority"            , defaults::rt_priority             ))
+    , rt_control_cpus     (read_str  ("rt_control_cpus"        , defaults::rt_control_cpus         ))
+    , rt_comm_cpus        (read_str  ("rt_comm_cpus"           , defaults::rt_comm_cpus            ))
+    , rt_lock_memory      (read_uint ("rt_lock_memory"         , defaults::rt_lock_memory ) != 0   )
     , save_state_name     (read_string_option(argc, argv, "-n", "--name", "default"                ))
     , clear_state         (read_option_flag  (argc, argv, "-c", "--clear"                          ))
+    , free_running        (read_option_flag  (argc, argv, "-f", "--free-running"                   ))
+    , unit_id             (parse_uint  (read_string_option(argc, argv, "-u", "--unit" , "0"), "--unit" ))
+    , replay_file         (read_string_option(argc, argv, "-r", "--replay", ""                     ))
+    , replay_speed        (parse_double(read_string_option(argc, argv, "-s", "--speed", "0"), "--speed"))
+    , replay_from_cycle   (parse_uint64(read_string_option(argc, argv, "-F", "--from" , "0"), "--from" ))
     {
+        assertion(number_of_units() > 0 and number_of_units() <= constants::max_units
+                 , "Number of units must be within 1..%u, got %u.", constants::max_units, number_of_units());
+        for (unsigned u = 0; u < number_of_units(); ++u)
+            assertion(number_of_joints(u) > 0 and number_of_joints(u) <= constants::max_joints_per_unit
+                     , "Number of joints of unit %u must be within 1..%u.", u, constants::max_joints_per_unit);
+        assertion(unit_id < number_of_units(), "Unit %u does not exist.", unit_id);
+        assertion(telemetry_cycles_per_datagram > 0, "Telemetry cycles per datagram must be at least 1.");
+        assertion(telemetry_key_interval > 0, "Telemetry key interval must be at least 1.");
+        assertion(subscribe_decimation > 0, "Subscribe decimation must be at least 1.");
+        assertion(replay_speed >= 0, "Replay speed must not be negative.");
+        assertion(cpg_phase_rate > 0 and cpg_amplitude_rate > 0, "CPG rates must be positive.");
+        assertion(mode_crossfade_s >= 0, "Mode crossfade must not be negative.");
 
         save_folder += save_state_name + "/";
     }
+
+    unsigned number_of_units(void) const { return unit_joints.size(); }
+    unsigned number_of_joints(unsigned unit) const { return static_cast<unsigned>(unit_joints.at(unit)); }
+
+    /* index of the unit's first joint in joint_offsets */
+    unsigned first_joint(unsigned unit) const {
+        unsigned index = 0;
+        for (unsigned u = 0; u < unit; ++u) index += number_of_joints(u);
+        return index;
+    }
+
+private:
+    /* numeric command line options, reject what is not entirely a number */
+    static unsigned parse_uint(std::string const& str, const char* option) {
+        char* end = nullptr;
+        errno = 0;
+        const unsigned long value = strtoul(str.c_str(), &end, 10);
+        assertion(end != str.c_str() and *end == '\0' and errno == 0 and value <= UINT_MAX and str.find('-') == std::string::npos
+                 , "Option %s expects an unsigned number, got '%s'.", option, str.c_str());
+        return static_cast<unsigned>(value);
+    }
+
+    static uint64_t parse_uint64(std::string const& str, const char* option) {
+        char* end = nullptr;
+        errno = 0;
+        const unsigned long long value = strtoull(str.c_str(), &end, 10);
+        assertion(end != str.c_str() and *end == '\0' and errno == 0 and str.find('-') == std::string::npos
+                 , "Option %s expects an unsigned number, got '%s'.", option, str.c_str());
+        return static_cast<uint64_t>(value);
+    }
+
+    static double parse_double(std::string const& str, const char* option) {
+        char* end = nullptr;
+        errno = 0;
+        const double value = strtod(str.c_str(), &end);
+        assertion(end != str.c_str() and *end == '\0' and errno == 0
+                 , "Option %s expects a number, got '%s'.", option, str.c_str());
+        return value;
+    }
 };
 
 } /* namespace supreme */
@@ -0,0 +1,711 @@
+#ifndef FLATCAT_TELEMETRY_HPP
+#define FLATCAT_TELEMETRY_HPP
+
+#include <array>
+#include <cmath>
+#include <limits>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+#include <flatcat_robot.hpp>
+#include <flatcat_control.hpp>
+#include <cycle_timing.hpp>
+#include <telemetry_schema.hpp>
+
+/* Telemetry frames sent by flatcat_udp, one per unit and cycle,
+   shared by the robot, both terminals and the benchmarks.
+   The layout is declared in telemetry_schema.hpp, encoder and decoder
+   below are generated from its field lists. All frames of one cycle are
+   published as one batch and sent as separate datagrams, receivers pick
+   their unit by id.
+
+   Frames are either full (float fields), compact (fixed-point, with
+   key frames) or projections (a subset of the full fields, see
+   Telemetry_Projection), the decoder handles all of them depending on
+   the layout id. */
+
+namespace supreme {
+
+namespace constants {
+    const std::size_t max_telemetry_frame_size = telemetry::max_frame_size;
+    const std::size_t max_telemetry_batch_size = telemetry::max_batch_size;
+}
+
+constexpr std::size_t telemetry_frame_size(std::size_t number_of_motors) { return telemetry::frame_size(number_of_motors); }
+
+inline uint8_t telemetry_unit_id         (const uint8_t* frame) { return frame[offsetof(telemetry::Header_t, unit_id         )]; }
+inline uint8_t telemetry_number_of_motors(const uint8_t* frame) { return frame[offsetof(telemetry::Header_t, number_of_motors)]; }
+
+inline uint16_t telemetry_layout(const uint8_t* frame) {
+    uint16_t layout;
+    memcpy(&layout, frame + offsetof(telemetry::Header_t, layout), sizeof(layout));
+    return layout;
+}
+
+inline uint32_t telemetry_field_mask(const uint8_t* frame) {
+    uint32_t mask;
+    memcpy(&mask, frame + offsetof(telemetry::Projection_Header_t, fields), sizeof(mask));
+    return mask;
+}
+
+/* true if len bytes hold the part of the header telemetry_frame_length() reads */
+inline bool telemetry_length_readable(const uint8_t* frame, std::size_t len) {
+    if (len < offsetof(telemetry::Header_t, layout) + sizeof(uint16_t))
+        return false;
+    const uint16_t layout = telemetry_layout(frame);
+    if (layout == telemetry::compact_layout)
+        return len >= sizeof(telemetry::Compact_Header_t);
+    if (layout == telemetry::projection_layout)
+        return len >= sizeof(telemetry::Projection_Header_t);
+    if (layout == telemetry::pong_layout)
+        return true;
+    return len > offsetof(telemetry::Header_t, number_of_motors);
+}
+
+/* length of a full, compact or projected frame, from its header */
+inline std::size_t telemetry_frame_length(const uint8_t* frame) {
+    const uint16_t layout = telemetry_layout(frame);
+    if (layout == telemetry::compact_layout) {
+        const uint8_t flags = frame[offsetof(telemetry::Compact_Header_t, flags)];
+        return telemetry::compact_frame_size( telemetry_number_of_motors(frame)
+                                            , flags & telemetry::compact_flags::key_frame
+                                            , flags & telemetry::compact_flags::delta_slow );
+    }
+    if (layout == telemetry::projection_layout)
+        return telemetry::projection_frame_size(telemetry_number_of_motors(frame), telemetry_field_mask(frame));
+    if (layout == telemetry::pong_layout)
+        return sizeof(telemetry::Pong_t);
+    return telemetry_frame_size(telemetry_number_of_motors(frame));
+}
+
+/* compact key frames are needed by all frames up to the next one */
+inline bool telemetry_is_key_frame(const uint8_t* frame) {
+    return telemetry_layout(frame) == telemetry::compact_layout
+       and (frame[offsetof(telemetry::Compact_Header_t, flags)] & telemetry::compact_flags::key_frame);
+}
+
+/* all bytes of a frame including the checksum sum up to zero */
+inline uint8_t telemetry_checksum(const uint8_t* data, std::size_t len) {
+    uint8_t sum = 0;
+    for (std::size_t i = 0; i < len; ++i) sum += data[i];
+    return static_cast<uint8_t>(~sum + 1);
+}
+
+/* fixed-point conversion of the compact layout, saturating */
+template <typename T>
+T telemetry_quantize(float value, float scale) {
+    const float q = std::round(value * scale);
+    if (q != q) return 0; /* NaN */
+    return static_cast<T>(std::min(std::max(q, (float) std::numeric_limits<T>::min()), (float) std::numeric_limits<T>::max()));
+}
+
+enum class Telemetry_Result_t : uint8_t {
+    ok,
+    other_unit,
+    truncated,
+    bad_sync,
+    bad_version,
+    bad_layout,
+    bad_size,
+    bad_checksum,
+    missing_key,
+    stale,
+    END_Telemetry_Result_t
+};
+
+namespace constants {
+    const std::array<const char*, (unsigned) Telemetry_Result_t::END_Telemetry_Result_t> telemetry_result_str =
+        {{ "ok", "other unit", "truncated", "bad sync", "bad version", "bad layout", "bad size", "bad checksum", "missing key frame", "stale" }};
+}
+
+#define FLATCAT_TELEMETRY_ENCODE(type, name, source) rec.name = source;
+#define FLATCAT_TELEMETRY_DECODE(type, name, source) target.name = rec.name;
+#define FLATCAT_TELEMETRY_QUANTIZE(type, name, scale) c.name = telemetry_quantize<type>(rec.name, scale);
+#define FLATCAT_TELEMETRY_DEQUANTIZE(type, name, scale) rec.name = static_cast<decltype(rec.name)>(c.name / (scale));
+
+/* robot side, collects the records of one unit */
+template <typename Control_t>
+void make_telemetry_records( telemetry::Records_t& records
+                           , FlatcatRobot const& flatcat
+                           , Control_t const& control
+                           , uint64_t cycles )
+{
+    {   auto& rec = records.header;
+        FLATCAT_TELEMETRY_HEADER_FIELDS(FLATCAT_TELEMETRY_ENCODE)
+    }
+
+    /* N motors */
+    auto const& motors = flatcat.get_motors();
+    for (unsigned i = 0; i < motors.size(); ++i)
+    {
+        auto const& m = motors[i];
+        auto const& d = m.get_data();
+        auto& rec = records.motors[i];
+        FLATCAT_TELEMETRY_MOTOR_FIELDS(FLATCAT_TELEMETRY_ENCODE)
+    }
+
+    /* cycle timing per phase */
+    auto const& t = flatcat.get_cycle_timing();
+    for (unsigned p = 0; p < constants::num_phases; ++p)
+    {
+        auto const& s = t.get_stats(static_cast<Phase_t>(p));
+        auto& rec = records.timing[p];
+        FLATCAT_TELEMETRY_TIMING_FIELDS(FLATCAT_TELEMETRY_ENCODE)
+    }
+
+    {   auto const& c = control;
+        auto& rec = records.control;
+        FLATCAT_TELEMETRY_CONTROL_FIELDS(FLATCAT_TELEMETRY_ENCODE)
+    }
+}
+
+/* robot side, writes the full frame of one unit to buffer, returns its size */
+template <typename Control_t>
+std::size_t encode_telemetry_frame( uint8_t* buffer
+                                  , std::size_t capacity
+                                  , FlatcatRobot const& flatcat
+                                  , Control_t const& control
+                                  , uint64_t cycles )
+{
+    using namespace telemetry;
+    Records_t records;
+    make_telemetry_records(records, flatcat, control, cycles);
+
+    const unsigned n = records.header.number_of_motors;
+    const std::size_t size = frame_size(n);
+    assertion(size <= capacity, "Telemetry frame of %zu bytes exceeds buffer of %zu bytes.", size, capacity);
+    uint8_t* pos = buffer;
+
+    memcpy(pos, &records.header       , sizeof(records.header) ); pos += sizeof(records.header);
+    memcpy(pos, records.motors.data() , n * sizeof(Motor_t)    ); pos += n * sizeof(Motor_t);
+    memcpy(pos, records.timing.data() , sizeof(records.timing) ); pos += sizeof(records.timing);
+    memcpy(pos, &records.control      , sizeof(records.control)); pos += sizeof(records.control);
+
+    *pos = telemetry_checksum(buffer, size - 1);
+    assert(pos + 1 == buffer + size);
+    return size;
+}
+
+
+#define FLATCAT_TELEMETRY_DELTA(type, name, scale) d.name = static_cast<int8_t>(slow[i].name - key_slow[i].name);
+#define FLATCAT_TELEMETRY_FITS_DELTA(type, name, scale) \
+    if (slow[i].name - key_slow[i].name < std::numeric_limits<int8_t>::min() \
+     or slow[i].name - key_slow[i].name > std::numeric_limits<int8_t>::max()) return false;
+
+/* robot side, compact frames of one unit (telemetry_compact = 1).
+   A key frame is sent every key_interval frames and whenever the slow
+   fields moved too far or the cycle offset would overflow. */
+class Compact_Telemetry_Encoder
+{
+public:
+    Compact_Telemetry_Encoder(unsigned key_interval, bool delta_slow)
+    : key_interval(std::max(key_interval, 1u))
+    , delta_slow(delta_slow)
+    , key_slow()
+    {}
+
+    template <typename Control_t>
+    std::size_t encode( uint8_t* buffer
+                      , std::size_t capacity
+                      , FlatcatRobot const& flatcat
+                      , Control_t const& control
+                      , uint64_t cycles )
+    {
+        using namespace telemetry;
+        Records_t records;
+        make_telemetry_records(records, flatcat, control, cycles);
+        const unsigned n = records.header.number_of_motors;
+
+        std::array<Compact_Slow_t, constants::max_joints_per_unit> slow;
+        for (unsigned i = 0; i < n; ++i) {
+            auto const& rec = records.motors[i];
+            auto& c = slow[i];
+            FLATCAT_TELEMETRY_COMPACT_SLOW_FIELDS(FLATCAT_TELEMETRY_QUANTIZE)
+        }
+
+        const uint64_t sample_us = records.header.sample_us;
+        const bool key = not has_key
+                      or ++frames_since_key >= key_interval
+                      or cycles - key_cycles > std::numeric_limits<uint16_t>::max()
+                      or sample_us - key_sample_us > std::numeric_limits<uint32_t>::max()
+                      or (delta_slow and not fits_delta(slow, n));
+        if (key) {
+            has_key          = true;
+            key_cycles       = cycles;
+            key_sample_us    = sample_us;
+            frames_since_key = 0;
+            key_slow         = slow;
+            ++key_id;
+        }
+
+        const std::size_t size = compact_frame_size(n, key, delta_slow);
+        assertion(size <= capacity, "Telemetry frame of %zu bytes exceeds buffer of %zu bytes.", size, capacity);
+        uint8_t* pos = buffer;
+
+        const Compact_Header_t header = { telemetry::sync, telemetry::version, compact_layout
+                                        , records.header.unit_id, records.header.number_of_motors
+                                        , static_cast<uint8_t>((key ? compact_flags::key_frame : 0) | (delta_slow ? compact_flags::delta_slow : 0))
+                                        , key_id };
+        memcpy(pos, &header, sizeof(header));
+        pos += sizeof(header);
+
+        /* cycles and sample time, delta-coded to the key frame */
+        if (key) {
+            memcpy(pos, &cycles, sizeof(cycles));
+            pos += sizeof(cycles);
+            memcpy(pos, &sample_us, sizeof(sample_us));
+            pos += sizeof(sample_us);
+        } else {
+            const uint16_t offset = static_cast<uint16_t>(cycles - key_cycles);
+            memcpy(pos, &offset, sizeof(offset));
+            pos += sizeof(offset);
+            const uint32_t time_offset = static_cast<uint32_t>(sample_us - key_sample_us);
+            memcpy(pos, &time_offset, sizeof(time_offset));
+            pos += sizeof(time_offset);
+        }
+
+        /* command echo, age of the actuation */
+        {   const uint64_t age = (records.header.actuated_us > 0 and records.header.actuated_us <= sample_us)
+                               ? sample_us - records.header.actuated_us : std::numeric_limits<uint32_t>::max();
+            const Compact_Echo_t echo = { records.header.command_seq
+                                        , static_cast<uint32_t>(std::min<uint64_t>(age, std::numeric_limits<uint32_t>::max())) };
+            memcpy(pos, &echo, sizeof(echo));
+            pos += sizeof(echo);
+        }
+
+        for (unsigned i = 0; i < n; ++i) {
+            auto const& rec = records.motors[i];
+            Compact_Motor_t c;
+            FLATCAT_TELEMETRY_COMPACT_MOTOR_FIELDS(FLATCAT_TELEMETRY_QUANTIZE)
+            memcpy(pos, &c, sizeof(c));
+            pos += sizeof(c);
+        }
+
+        if (key or not delta_slow) {
+            memcpy(pos, slow.data(), n * sizeof(Compact_Slow_t));
+            pos += n * sizeof(Compact_Slow_t);
+        } else {
+            for (unsigned i = 0; i < n; ++i) {
+                Delta_Slow_t d;
+                FLATCAT_TELEMETRY_COMPACT_SLOW_FIELDS(FLATCAT_TELEMETRY_DELTA)
+                memcpy(pos, &d, sizeof(d));
+                pos += sizeof(d);
+            }
+        }
+
+        for (unsigned p = 0; p < constants::num_phases; ++p) {
+            auto const& rec = records.timing[p];
+            Compact_Timing_t c;
+            FLATCAT_TELEMETRY_COMPACT_TIMING_FIELDS(FLATCAT_TELEMETRY_QUANTIZE)
+            memcpy(pos, &c, sizeof(c));
+            pos += sizeof(c);
+        }
+
+        memcpy(pos, &records.control, sizeof(records.control));
+        pos += sizeof(records.control);
+
+        *pos = telemetry_checksum(buffer, size - 1);
+        assert(pos + 1 == buffer + size);
+        return size;
+    }
+
+private:
+
+    bool fits_delta(std::array<telemetry::Compact_Slow_t, constants::max_joints_per_unit> const& slow, unsigned n) const {
+        for (unsigned i = 0; i < n; ++i) {
+            FLATCAT_TELEMETRY_COMPACT_SLOW_FIELDS(FLATCAT_TELEMETRY_FITS_DELTA)
+        }
+        return true;
+    }
+
+    const unsigned key_interval;
+    const bool     delta_slow;
+
+    bool     has_key          = false;
+    uint8_t  key_id           = 0;
+    uint64_t key_cycles       = 0;
+    uint64_t key_sample_us    = 0;
+    unsigned frames_since_key = 0;
+    std::array<telemetry::Compact_Slow_t, constants::max_joints_per_unit> key_slow;
+};
+
+#undef FLATCAT_TELEMETRY_DELTA
+#undef FLATCAT_TELEMETRY_FITS_DELTA
+
+
+/* receiver side state of the compact layout, the last key frame */
+struct Compact_Telemetry_Key {
+    bool     valid     = false;
+    uint8_t  key_id    = 0;
+    uint64_t cycles    = 0;
+    uint64_t sample_us = 0;
+    std::array<telemetry::Compact_Slow_t, constants::max_joints_per_unit> slow;
+};
+
+
+/* Projection of full frames to the fields selected by a mask (FLD=), for
+   subscribers which do not need everything. The copies are taken from the
+   field table once per mask, adjacent fields merged into one, so projecting
+   a frame on the robot and expanding it on the terminal are a few memcpy.
+   Fields not sent are left zero on the terminal. */
+class Telemetry_Projection
+{
+public:
+    Telemetry_Projection(uint32_t mask = telemetry::all_fields)
+    : mask(mask & telemetry::all_fields)
+    , groups()
+    {
+        using namespace telemetry;
+        for (Group_t g : { Group_t::motor, Group_t::timing, Group_t::control }) {
+            Group_Copies_t& c = groups[static_cast<std::size_t>(g)];
+            for (std::size_t i = first_field(g); i < first_field(g) + number_of_fields(g); ++i) {
+                if (not (this->mask & field_bit(i)))
+                    continue;
+                if (c.count > 0 and c.copies[c.count-1].src + c.copies[c.count-1].size == fields[i].offset)
+                    c.copies[c.count-1].size += fields[i].size;
+                else
+                    c.copies[c.count++] = { fields[i].offset, c.size, fields[i].size };
+                c.size += fields[i].size;
+            }
+        }
+    }
+
+    uint32_t get_mask(void) const { return mask; }
+    bool     is_full (void) const { return mask == telemetry::all_fields; }
+
+    std::size_t frame_size(std::size_t number_of_motors) const {
+        return sizeof(telemetry::Projection_Header_t)
+             + group(telemetry::Group_t::motor  ).size * number_of_motors
+             + group(telemetry::Group_t::timing ).size * constants::num_phases
+             + group(telemetry::Group_t::control).size
+             + sizeof(uint8_t); /* checksum */
+    }
+
+    /* robot side, projects a full frame, returns the length or 0 if it cannot */
+    std::size_t project(const uint8_t* frame, uint8_t* buffer, std::size_t capacity) const
+    {
+        using namespace telemetry;
+        if (telemetry_layout(frame) != layout)
+            return 0;
+        const std::size_t n = telemetry_number_of_motors(frame);
+        const std::size_t size = frame_size(n);
+        if (size > capacity)
+            return 0;
+
+        Projection_Header_t header;
+        memcpy(&header.header, frame, sizeof(Header_t));
+        header.header.layout = projection_layout;
+        header.fields        = mask;
+        memcpy(buffer, &header, sizeof(header));
+
+        const uint8_t* src = frame + sizeof(Header_t);
+        uint8_t*       dst = buffer + sizeof(Projection_Header_t);
+        for (std::size_t i = 0; i < n; ++i, src += sizeof(Motor_t))
+            dst = gather(group(Group_t::motor), src, dst);
+        for (std::size_t p = 0; p < constants::num_phases; ++p, src += sizeof(Timing_t))
+            dst = gather(group(Group_t::timing), src, dst);
+        dst = gather(group(Group_t::control), src, dst);
+
+        *dst = telemetry_checksum(buffer, size - 1);
+        return size;
+    }
+
+    /* terminal side, header already checked */
+    Telemetry_Result_t expand(telemetry::Records_t& records, const uint8_t* msg, std::size_t len) const
+    {
+        using namespace telemetry;
+        const std::size_t n = telemetry_number_of_motors(msg);
+        const std::size_t size = frame_size(n);
+        if (len < size) return Telemetry_Result_t::truncated;
+        if (telemetry_checksum(msg, size) != 0) return Telemetry_Result_t::bad_checksum;
+
+        records = Records_t();
+        memcpy(&records.header, msg, sizeof(Header_t));
+
+        const uint8_t* src = msg + sizeof(Projection_Header_t);
+        for (std::size_t i = 0; i < n; ++i)
+            src = scatter(group(Group_t::motor), src, reinterpret_cast<uint8_t*>(&records.motors[i]));
+        for (std::size_t p = 0; p < constants::num_phases; ++p)
+            src = scatter(group(Group_t::timing), src, reinterpret_cast<uint8_t*>(&records.timing[p]));
+        src = scatter(group(Group_t::control), src, reinterpret_cast<uint8_t*>(&records.control));
+        records.checksum = *src;
+        return Telemetry_Result_t::ok;
+    }
+
+private:
+    struct Copy_t {
+        std::size_t src;  /* offset in the full record */
+        std::size_t dst;  /* offset in the projected record */
+        std::size_t size;
+    };
+
+    struct Group_Copies_t {
+        std::array<Copy_t, telemetry::number_of_selectable_fields> copies;
+        std::size_t count = 0;
+        std::size_t size  = 0; /* projected record */
+    };
+
+    Group_Copies_t const& group(telemetry::Group_t g) const { return groups[static_cast<std::size_t>(g)]; }
+
+    static uint8_t* gather(Group_Copies_t const& c, const uint8_t* record, uint8_t* dst) {
+        for (std::size_t k = 0; k < c.count; ++k)
+            memcpy(dst + c.copies[k].dst, record + c.copies[k].src, c.copies[k].size);
+        return dst + c.size;
+    }
+
+    static const uint8_t* scatter(Group_Copies_t const& c, const uint8_t* src, uint8_t* record) {
+        for (std::size_t k = 0; k < c.count; ++k)
+            memcpy(record + c.copies[k].src, src + c.copies[k].dst, c.copies[k].size);
+        return src + c.size;
+    }
+
+    uint32_t mask;
+    std::array<Group_Copies_t, 3> groups;
+};
+
+namespace telemetry {
+
+/* header already checked */
+inline Telemetry_Result_t decode_full_records(Records_t& records, const uint8_t* msg, std::size_t len)
+{
+    memcpy(&records.header, msg, sizeof(Header_t));
+    const unsigned n = records.header.number_of_motors;
+    const std::size_t size = frame_size(n);
+    if (len < size) return Telemetry_Result_t::truncated;
+    if (telemetry_checksum(msg, size) != 0) return Telemetry_Result_t::bad_checksum;
+
+    const uint8_t* pos = msg + sizeof(Header_t);
+    memcpy(records.motors.data(), pos, n * sizeof(Motor_t)   ); pos += n * sizeof(Motor_t);
+    memcpy(records.timing.data(), pos, sizeof(records.timing)); pos += sizeof(records.timing);
+    memcpy(&records.control     , pos, sizeof(records.control)); pos += sizeof(records.control);
+    records.checksum = *pos;
+    return Telemetry_Result_t::ok;
+}
+
+#define FLATCAT_TELEMETRY_UNDELTA(type, name, scale) c.name = static_cast<type>(key.slow[i].name + d.name);
+
+/* header already checked, key frames update the key */
+inline Telemetry_Result_t decode_compact_records(Records_t& records, const uint8_t* msg, std::size_t len, Compact_Telemetry_Key& key)
+{
+    Compact_Header_t header;
+    memcpy(&header, msg, sizeof(header));
+    const unsigned n = header.number_of_motors;
+    const bool key_frame  = header.flags & compact_flags::key_frame;
+    const bool delta_slow = header.flags & compact_flags::delta_slow;
+
+    const std::size_t size = compact_frame_size(n, key_frame, delta_slow);
+    if (len < size) return Telemetry_Result_t::truncated;
+    if (telemetry_checksum(msg, size) != 0) return Telemetry_Result_t::bad_checksum;
+    if (not key_frame and (not key.valid or key.key_id != header.key_id)) return Telemetry_Result_t::missing_key;
+
+    const uint8_t* pos = msg + sizeof(header);
+
+    records.header.sync             = header.sync;
+    records.header.version          = header.version;
+    records.header.layout           = header.layout;
+    records.header.unit_id          = header.unit_id;
+    records.header.number_of_motors = header.number_of_motors;
+
+    if (key_frame) {
+        memcpy(&records.header.cycles, pos, sizeof(uint64_t));
+        pos += sizeof(uint64_t);
+        memcpy(&records.header.sample_us, pos, sizeof(uint64_t));
+        pos += sizeof(uint64_t);
+    } else {
+        uint16_t offset;
+        memcpy(&offset, pos, sizeof(offset));
+        pos += sizeof(offset);
+        records.header.cycles = key.cycles + offset;
+        uint32_t time_offset;
+        memcpy(&time_offset, pos, sizeof(time_offset));
+        pos += sizeof(time_offset);
+        records.header.sample_us = key.sample_us + time_offset;
+    }
+
+    {   Compact_Echo_t echo;
+        memcpy(&echo, pos, sizeof(echo));
+        pos += sizeof(echo);
+        records.header.command_seq = echo.command_seq;
+        records.header.actuated_us = (echo.actuated_age_us == std::numeric_limits<uint32_t>::max())
+                                   ? 0 : records.header.sample_us - echo.actuated_age_us;
+    }
+
+    for (unsigned i = 0; i < n; ++i) {
+        Compact_Motor_t c;
+        memcpy(&c, pos, sizeof(c));
+        pos += sizeof(c);
+        auto& rec = records.motors[i];
+        FLATCAT_TELEMETRY_COMPACT_MOTOR_FIELDS(FLATCAT_TELEMETRY_DEQUANTIZE)
+    }
+
+    std::array<Compact_Slow_t, constants::max_joints_per_unit> slow;
+    if (key_frame or not delta_slow) {
+        memcpy(slow.data(), pos, n * sizeof(Compact_Slow_t));
+        pos += n * sizeof(Compact_Slow_t);
+    } else {
+        for (unsigned i = 0; i < n; ++i) {
+            Delta_Slow_t d;
+            memcpy(&d, pos, sizeof(d));
+            pos += sizeof(d);
+            auto& c = slow[i];
+            FLATCAT_TELEMETRY_COMPACT_SLOW_FIELDS(FLATCAT_TELEMETRY_UNDELTA)
+        }
+    }
+    for (unsigned i = 0; i < n; ++i) {
+        auto const& c = slow[i];
+        auto& rec = records.motors[i];
+        FLATCAT_TELEMETRY_COMPACT_SLOW_FIELDS(FLATCAT_TELEMETRY_DEQUANTIZE)
+    }
+
+    for (unsigned p = 0; p < constants::num_phases; ++p) {
+        Compact_Timing_t c;
+        memcpy(&c, pos, sizeof(c));
+        pos += sizeof(c);
+        auto& rec = records.timing[p];
+        FLATCAT_TELEMETRY_COMPACT_TIMING_FIELDS(FLATCAT_TELEMETRY_DEQUANTIZE)
+    }
+
+    memcpy(&records.control, pos, sizeof(records.control));
+    pos += sizeof(records.control);
+    records.checksum = *pos;
+
+    if (key_frame) {
+        key.valid  = true;
+        key.key_id = header.key_id;
+        key.cycles    = records.header.cycles;
+        key.sample_us = records.header.sample_us;
+        key.slow      = slow;
+    }
+    return Telemetry_Result_t::ok;
+}
+
+#undef FLATCAT_TELEMETRY_UNDELTA
+
+/* header already checked, the copies are derived from the frame's mask */
+inline Telemetry_Result_t decode_projection_records(Records_t& records, const uint8_t* msg, std::size_t len)
+{
+    if (len < sizeof(Projection_Header_t)) return Telemetry_Result_t::truncated;
+    const uint32_t mask = telemetry_field_mask(msg);
+    if (mask & ~all_fields) return Telemetry_Result_t::bad_layout; /* fields unknown here */
+    return Telemetry_Projection(mask).expand(records, msg, len);
+}
+
+} /* namespace telemetry */
+
+/* terminal side, checks and decodes a frame of the given unit into records.
+   len is the number of bytes readable at msg. Only the compact key is
+   updated here, the target itself is written by apply_telemetry_records(). */
+inline Telemetry_Result_t decode_telemetry_records( uint8_t unit_id
+                                                  , std::size_t number_of_motors
+                                                  , Compact_Telemetry_Key& compact_key
+                                                  , const uint8_t* msg
+                                                  , std::size_t len
+                                                  , telemetry::Records_t& records )
+{
+    using namespace telemetry;
+
+    /* the shorter of both headers */
+    if (len < sizeof(Compact_Header_t)) return Telemetry_Result_t::truncated;
+
+    uint16_t sync;
+    memcpy(&sync, msg, sizeof(sync));
+    if (sync != telemetry::sync) return Telemetry_Result_t::bad_sync;
+    if (msg[offsetof(Header_t, version)] != telemetry::version) return Telemetry_Result_t::bad_version;
+
+    const uint16_t msg_layout = telemetry_layout(msg);
+    if (msg_layout != layout and msg_layout != compact_layout and msg_layout != projection_layout)
+        return Telemetry_Result_t::bad_layout;
+    if (telemetry_unit_id(msg) != unit_id) return Telemetry_Result_t::other_unit;
+
+    const unsigned n = telemetry_number_of_motors(msg);
+    if (n != number_of_motors or n > constants::max_joints_per_unit) return Telemetry_Result_t::bad_size;
+
+    if (msg_layout == compact_layout)
+        return decode_compact_records(records, msg, len, compact_key);
+    if (msg_layout == projection_layout)
+        return decode_projection_records(records, msg, len);
+    if (len < sizeof(Header_t))
+        return Telemetry_Result_t::truncated;
+    return decode_full_records(records, msg, len);
+}
+
+/* writes decoded records to the members sync, cycles, sample_us,
+   command_seq, actuated_us, motors, timing, control and chksum of the target */
+template <typename UDPRobot_t>
+void apply_telemetry_records(UDPRobot_t& r, telemetry::Records_t const& records)
+{
+    r.sync        = records.header.sync;
+    r.cycles      = records.header.cycles;
+    r.sample_us   = records.header.sample_us;
+    r.command_seq = records.header.command_seq;
+    r.actuated_us = records.header.actuated_us;
+
+    /* sensorimotor data */
+    for (unsigned i = 0; i < records.header.number_of_motors; ++i) {
+        auto const& rec = records.motors[i];
+        auto& target = r.motors[i];
+        FLATCAT_TELEMETRY_MOTOR_FIELDS(FLATCAT_TELEMETRY_DECODE)
+    }
+
+    /* timing */
+    for (unsigned p = 0; p < constants::num_phases; ++p) {
+        auto const& rec = records.timing[p];
+        auto& target = r.timing[p];
+        FLATCAT_TELEMETRY_TIMING_FIELDS(FLATCAT_TELEMETRY_DECODE)
+    }
+
+    /* control read back */
+    {   auto const& rec = records.control;
+        auto& target = r.control;
+        FLATCAT_TELEMETRY_CONTROL_FIELDS(FLATCAT_TELEMETRY_DECODE)
+    }
+
+    r.chksum = records.checksum;
+}
+
+/* decodes and applies a frame regardless of its cycle, for anything that has
+   the members unit_id, motors and compact_key as well, terminals receive
+   with the Telemetry_Receiver from telemetry_receiver.hpp instead */
+template <typename UDPRobot_t>
+Telemetry_Result_t decode_telemetry_frame(UDPRobot_t& r, const uint8_t* msg, std::size_t len)
+{
+    telemetry::Records_t records;
+    const Telemetry_Result_t result = decode_telemetry_records(r.unit_id, r.motors.size(), r.compact_key, msg, len, records);
+    if (result == Telemetry_Result_t::ok)
+        apply_telemetry_records(r, records);
+    return result;
+}
+
+/* batched mode, a datagram holds one or more consecutive frames, each is
+   passed to receive(frame, bytes_left), which returns its result. Walking
+   stops at the first frame with a broken header or checksum, since the
+   length of what follows is unknown. Returns the number of frames accepted. */
+template <typename Receive_fn>
+unsigned for_each_telemetry_frame(const uint8_t* msg, std::size_t len, Receive_fn receive)
+{
+    unsigned accepted = 0;
+    for (std::size_t pos = 0; pos < len; ) {
+        const Telemetry_Result_t result = receive(msg + pos, len - pos);
+        if (result == Telemetry_Result_t::ok)
+            ++accepted;
+        else if (result != Telemetry_Result_t::other_unit
+             and result != Telemetry_Result_t::missing_key
+             and result != Telemetry_Result_t::stale)
+            break;
+        if (not telemetry_length_readable(msg + pos, len - pos)
+            or len - pos < telemetry_frame_length(msg + pos))
+            break;
+        pos += telemetry_frame_length(msg + pos);
+    }
+    return accepted;
+}
+
+#undef FLATCAT_TELEMETRY_ENCODE
+#undef FLATCAT_TELEMETRY_DECODE
+#undef FLATCAT_TELEMETRY_QUANTIZE
+#undef FLATCAT_TELEMETRY_DEQUANTIZE
+
+} /* namespace supreme */
+
+#endif /* FLATCAT_TELEMETRY_HPP */
@@ -2,12 +2,6 @@
 
 GlobalFlag do_quit;
 
-namespace constants {
-    const unsigned us_per_sec = 1000*1000;
-    const unsigned update_rate_Hz = 100;
-    const unsigned timeframe_us = us_per_sec/update_rate_Hz;
-}
-
 void
 signal_terminate_handler(int signum)
 {
@@ -18,61 +12,220 @@ signal_terminate_handler(int signum)
 inline bool starts_with(std::string msg, const char c_str[]) { return (msg.compare(0, strlen(c_str), c_str) == 0); }
 
 template <typename T>
-void parse_command(T& result, std::string const& msg, const char* keystr) {
-    T value;
-    if (1 == sscanf(msg.c_str(), keystr, &value)) {
-        result = static_cast<T>(value);
-        //dbg_msg("'%s' command received.", keystr);
-    } else wrn_msg("'%s' command broken.", keystr);
+bool parse_command(T& result, std::string const& msg, const char* keystr) {
+    if (1 == sscanf(msg.c_str(), keystr, &result))
+        return true;
+    wrn_msg("'%s' command broken.", keystr);
+    return false;
 }
 
+void enqueue_value_command(supreme::Command_Queue& queue, supreme::Command_t type, std::string const& msg, const char* keystr, uint8_t unit) {
+    float value;
+    if (parse_command(value, msg, keystr)) queue.push(type, value, 0, unit);
+}
 
-template <typename Vector_t>
-void parse_midi_channel(Vector_t& vec, std::string const& msg) {
+void enqueue_unsigned_command(supreme::Command_Queue& queue, supreme::Command_t type, std::string const& msg, const char* keystr, uint8_t unit) {
+    unsigned value;
+    if (parse_command(value, msg, keystr)) queue.push(type, value, 0, unit);
+}
+
+/* per-joint commands, e.g. MDI<joint>=<value> */
+void enqueue_joint_command(supreme::Command_Queue& queue, supreme::Command_t type, std::string const& msg, const char* keystr, uint8_t unit) {
     unsigned idx;
     float value;
-    if (2 == sscanf(msg.c_str(), "MDI%u=%f", &idx, &value) and idx < vec.size()) {
-        vec.at(idx) = value;
+    if (2 == sscanf(msg.c_str(), keystr, &idx, &value) and idx < supreme::constants::max_joints_per_unit) {
+        queue.push(type, value, idx, unit);
         //dbg_msg("MIDI %02u = %+5.2f", idx, value);
-    } else wrn_msg("Midi command broken.", msg);
+    } else wrn_msg("'%s' command broken: %s", keystr, msg.c_str());
 }
 
-/* simple command parser, replace if there is some time (TM) */
+/* receivers that are always there, e.g. a logger, separated by spaces */
+void MainApplication::subscribe_from_settings(void)
+{
+    std::istringstream entries(settings.subscribers);
+    std::string entry, address;
+    unsigned port;
+    supreme::Subscription_t subscription;
+    while (entries >> entry)
+        if (supreme::parse_subscriber(entry, address, port, subscription))
+            subscribers.subscribe(address, port, subscription, supreme::Lifetime_t::permanent);
+        else wrn_msg("Subscriber setting broken: %s", entry.c_str());
+}
+
+/* simple command parser, replace if there is some time (TM)
+   runs in the TCP thread, commands are only enqueued here
+   and applied by the control loop in apply_command(),
+   unit commands address the unit selected with UNT=<id> */
 void MainApplication::handle_tcp_commands(std::string const& msg)
 {
-    if (starts_with(msg, "ENA")) { parse_command(control.enabled  , msg, "ENA=%u"); return; }
-
-    /*
-    if (starts_with(msg, "PAR")) {
-        parse_command(control.parameter_id, msg, "PAR=%u");
-        if (control.parameter_id < control.parameter_set.size()) {
-            sts_msg("Set control parameter set number %u.", control.parameter_id);
-            //control.mixed_jointcontrol.set_active(control.parameter_id);
-            control.jointcontrol.set_control_parameter(control.parameter_set.get(control.parameter_id));
-            control.modulate = (control.parameter_id == 0) ? 0.f : 1.f;
-        } else wrn_msg("No control parameters for ID = %u", control.parameter_id);
+    using supreme::Command_t;
+
+    if (binary_commands and supreme::Binary_Command_Decoder::is_binary(msg.c_str(), msg.size())) {
+        if (!binary_decoder.decode(msg.c_str(), msg.size(), commands, selected_unit))
+            wrn_msg("Binary command broken.");
+        return;
+    }
+
+    if (starts_with(msg, "UNT")) {
+        unsigned value;
+        if (parse_command(value, msg, "UNT=%u")) {
+            if (value < units.size()) {
+                selected_unit = value;
+                sts_msg("Selected unit %u.", value);
+            } else wrn_msg("Unit %u does not exist.", value);
+        }
+        return;
+    }
+
+    if (starts_with(msg, "SUB")) {
+        std::string address;
+        unsigned port;
+        supreme::Subscription_t subscription;
+        if (starts_with(msg, "SUB=") and supreme::parse_subscriber(msg.substr(4), address, port, subscription))
+            subscribers.subscribe(address, port, subscription, supreme::Lifetime_t::until_unsubscribed);
+        else wrn_msg("Subscribe command broken: %s", msg.c_str());
+        return;
+    }
+
+    /* what the connected client gets, every n-th cycle and which fields */
+    if (starts_with(msg, "DEC")) {
+        unsigned decimation;
+        if (parse_command(decimation, msg, "DEC=%u") and !subscribers.set_decimation(client_address, settings.port, decimation))
+            wrn_msg("Client %s is not subscribed.", client_address.c_str());
+        return;
+    }
+    if (starts_with(msg, "FLD=")) {
+        uint32_t fields;
+        if (!supreme::telemetry::parse_field_mask(msg.substr(4), fields))
+            wrn_msg("Unknown telemetry fields: %s", msg.c_str());
+        else if (!subscribers.set_fields(client_address, settings.port, fields))
+            wrn_msg("Client %s is not subscribed.", client_address.c_str());
+        else if (settings.telemetry_compact)
+            wrn_msg("Compact telemetry is sent as it is, fields apply to full frames only.");
+        return;
+    }
+    if (starts_with(msg, "UNS")) {
+        char address[INET_ADDRSTRLEN];
+        unsigned port;
+        if (sscanf(msg.c_str(), "UNS=%15[0-9.]:%u", address, &port) == 2) {
+            if (!subscribers.unsubscribe(address, port))
+                wrn_msg("No telemetry subscriber %s:%u.", address, port);
+        } else wrn_msg("Unsubscribe command broken: %s", msg.c_str());
+        return;
+    }
+    if (msg == "LSS")   { subscribers.print(); return; }
+
+    /* clock synchronization, answered by the UDP thread (see clock_sync.hpp) */
+    if (starts_with(msg, "PNG")) {
+        const uint64_t t2_us = supreme::monotonic_time_ns() / supreme::constants::ns_per_us;
+        supreme::Ping_Request_t ping;
+        unsigned long long t1_us;
+        if (sscanf(msg.c_str(), "PNG=%u,%llu", &ping.id, &t1_us) == 2
+            and supreme::make_destination(ping.destination, client_address, settings.port)) {
+            ping.t1_us = t1_us;
+            ping.t2_us = t2_us;
+            if (!pings.push(ping))
+                wrn_msg("Too many pings pending.");
+        } else wrn_msg("Ping command broken: %s", msg.c_str());
         return;
-    }*/
+    }
+
+    if (starts_with(msg, "ENA")) { enqueue_unsigned_command(commands, Command_t::enable       , msg, "ENA=%u", selected_unit); return; }
+
+    /* gait from the library, modulate blends towards the next one */
+    if (starts_with(msg, "PAR")) { enqueue_unsigned_command(commands, Command_t::parameter_set, msg, "PAR=%u", selected_unit); return; }
 
-    if (starts_with(msg, "AMP")) { parse_command(control.amplitude, msg, "AMP=%f"); return; }
-    if (starts_with(msg, "MOD")) { parse_command(control.modulate , msg, "MOD=%f"); return; }
-    if (starts_with(msg, "ING")) { parse_command(control.inputgain, msg, "ING=%f"); return; }
+    if (starts_with(msg, "AMP")) { enqueue_value_command   (commands, Command_t::amplitude    , msg, "AMP=%f", selected_unit); return; }
+    if (starts_with(msg, "MOD")) { enqueue_value_command   (commands, Command_t::modulate     , msg, "MOD=%f", selected_unit); return; }
+    if (starts_with(msg, "ING")) { enqueue_value_command   (commands, Command_t::inputgain    , msg, "ING=%f", selected_unit); return; }
 
-    if (starts_with(msg, "CTL")) { parse_command(control.tar_mode , msg, "CTL=%u"); return; }
-    if (starts_with(msg, "POS")) { parse_command(control.usr_pos  , msg, "POS=%u"); return; }
+    if (starts_with(msg, "CTL")) { enqueue_unsigned_command(commands, Command_t::control_mode , msg, "CTL=%u", selected_unit); return; }
+    if (starts_with(msg, "POS")) { enqueue_unsigned_command(commands, Command_t::user_position, msg, "POS=%u", selected_unit); return; }
 
-    if (starts_with(msg, "MDI")) { parse_midi_channel(control.usr_params, msg); return; }
+    if (starts_with(msg, "MDI")) { enqueue_joint_command(commands, Command_t::midi         , msg, "MDI%u=%f", selected_unit); return; }
 
-    if (msg == "RST")   { sts_msg("Reset motor statistics."); flatcat.reset_motor_statistics(); return; }
-    if (msg == "HELLO") { sts_msg("client says hello"   ); return; }
+    /* central pattern generator, phase (degrees) and amplitude (0..1) targets per joint */
+    if (starts_with(msg, "CPH")) { enqueue_joint_command(commands, Command_t::cpg_phase    , msg, "CPH%u=%f", selected_unit); return; }
+    if (starts_with(msg, "CPA")) { enqueue_joint_command(commands, Command_t::cpg_amplitude, msg, "CPA%u=%f", selected_unit); return; }
 
-    if (msg == "CEN")   { calibrate.trigger(1); return; }
-    if (msg == "CAB")   { calibrate.trigger(2); return; }
-    if (msg == "CID")   { calibrate.toggle_index(); return; }
+    /* trajectories from lib_folder, selected by id, time scale (0 pauses) and looping */
+    if (starts_with(msg, "TRJ")) { enqueue_unsigned_command(commands, Command_t::trajectory      , msg, "TRJ=%u", selected_unit); return; }
+    if (starts_with(msg, "TRS")) { enqueue_value_command   (commands, Command_t::trajectory_scale, msg, "TRS=%f", selected_unit); return; }
+    if (starts_with(msg, "TRL")) { enqueue_unsigned_command(commands, Command_t::trajectory_loop , msg, "TRL=%u", selected_unit); return; }
+
+    if (msg == "RST")   { commands.push(Command_t::reset_statistics  , 0, 0, selected_unit); return; }
+    if (msg == "HELLO") { sts_msg("client says hello"); return; }
+    if (starts_with(msg, "BIN")) {
+        unsigned value;
+        if (parse_command(value, msg, "BIN=%u")) {
+            binary_commands = (value != 0);
+            sts_msg("Binary commands %s.", binary_commands ? "enabled" : "disabled");
+        }
+        return;
+    }
+    if (msg == "JIT")   { commands.push(Command_t::show_timing       ); return; }
+    if (msg == "JRS")   { commands.push(Command_t::reset_timing      ); return; }
+
+    if (msg == "CEN")   { commands.push(Command_t::calibration_enable, 0, 0, selected_unit); return; }
+    if (msg == "CAB")   { commands.push(Command_t::calibration_abort , 0, 0, selected_unit); return; }
+    if (msg == "CID")   { commands.push(Command_t::calibration_index , 0, 0, selected_unit); return; }
 
     dbg_msg("unknown msg: %s", msg.c_str());
 }
 
+/* runs in the control loop */
+void MainApplication::apply_command(supreme::Command const& cmd)
+{
+    using supreme::Command_t;
+
+    if (cmd.unit >= units.size()) {
+        wrn_msg("Command for non-existing unit %u.", (unsigned) cmd.unit);
+        return;
+    }
+    auto& flatcat   = units[cmd.unit]->robot;
+    auto& calibrate = units[cmd.unit]->calibrate;
+
+    recorder.note_command(cmd);
+    if (cmd.tagged)
+        flatcat.note_command(cmd.seq); /* echoed in the telemetry once actuated */
+
+    if (units[cmd.unit]->apply_command(cmd))
+        return;
+
+    switch (cmd.type) {
+    case Command_t::reset_statistics:
+        sts_msg("Reset motor statistics of unit %u.", (unsigned) cmd.unit);
+        flatcat.reset_motor_statistics();
+        break;
+
+    case Command_t::calibration_enable: calibrate.trigger(1);     break;
+    case Command_t::calibration_abort : calibrate.trigger(2);     break;
+    case Command_t::calibration_index : calibrate.toggle_index(); break;
+
+    case Command_t::show_timing:
+        scheduler.print_statistics();
+        print_telemetry_statistics();
+        sts_msg("Binary commands: %llu errors, %llu sequence gaps"
+               , (unsigned long long) binary_decoder.get_errors()
+               , (unsigned long long) binary_decoder.get_seq_gaps());
+        sts_msg("Commands: latency mean %5.1f us max %5.1f us, %llu rejected"
+               , commands.get_latency().mean_us(), commands.get_latency().max_us()
+               , (unsigned long long) commands.get_rejected());
+        break;
+
+    case Command_t::reset_timing:
+        sts_msg("Reset scheduler statistics.");
+        scheduler.reset_statistics();
+        commands.reset_statistics();
+        break;
+
+    case Command_t::none:
+    default:
+        wrn_msg("Unhandled command type: %u", (unsigned) cmd.type);
+        break;
+    }
+}
+
 int main(int argc, char* argv[])
 {
     sts_msg("Initializing Flatcat <3");
@@ -81,9 +234,16 @@ int main(int argc, char* argv[])
 
     MainApplication app(argc, argv, do_quit);
 
+    auto& realtime = app.set_realtime_profile();
+    realtime.lock_and_prefault();
+
     std::thread tcp_thread(&MainApplication::tcp_serv_loop, &app);
     std::thread udp_thread(&MainApplication::udp_send_loop, &app);
 
+    realtime.apply_to_communication_thread(tcp_thread, "TCP");
+    realtime.apply_to_communication_thread(udp_thread, "UDP");
+    realtime.apply_to_control_thread();
+
     Stopwatch watch;
 
     const bool verbose = (argc == 2 && strcmp (argv[1],"-v") == 0) ? true : false;
@@ -93,11 +253,13 @@ int main(int argc, char* argv[])
     watch.reset();
     while(!do_quit.status())
     {
+        const bool in_time = app.wait_for_next_cycle();
         app.execute_cycle();
 
         if (verbose)
-            sts_msg("%05.2f ms", watch.get_time_passed_us()/1000.0);
+            sts_msg("%05.2f ms%s", watch.get_time_passed_us()/1000.0, in_time ? "" : " (overrun)");
     }
+    app.get_scheduler().print_statistics();
     sts_msg("Waiting for UDP communication thread to join.");
     udp_thread.join();
     sts_msg("Waiting for TCP communication thread to join.");
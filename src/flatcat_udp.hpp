@@ -2,7 +2,11 @@
 #define FLATCAT_UDP_HPP
 
 #include <array>
+#include <memory>
+#include <sstream>
+#include <string>
 #include <thread>
+#include <vector>
 #include <signal.h>
 
 #include <common/log_messages.h>
@@ -10,6 +14,7 @@
 #include <common/stopwatch.h>
 #include <common/basic.h>
 #include <common/modules.h>
+#include <common/file_io.h>
 
 #include <control/jointcontrol.h>
 #include <control/control_vector.h>
@@ -17,6 +22,16 @@
 #include <flatcat_robot.hpp>
 #include <flatcat_control.hpp>
 #include <flatcat_settings.hpp>
+#include <periodic_scheduler.hpp>
+#include <frame_slot.hpp>
+#include <command_queue.hpp>
+#include <command_protocol.hpp>
+#include <flatcat_telemetry.hpp>
+#include <udp_batch.hpp>
+#include <telemetry_subscribers.hpp>
+#include <clock_sync.hpp>
+#include <flight_recorder.hpp>
+#include <realtime_profile.hpp>
 //#include <spinalcord.hpp> //TODO replace with motorcord for timing information
 
 #include <common/udp.hpp>
@@ -43,7 +58,7 @@ namespace supreme {
 class FlatcatCalibration
 {
     robots::Jointvector_t& joints;
-    supreme::motorcord& motors;
+    supreme::Motorcord_t& motors;
     file_io::CSV_File<float> csvfile;
 
     enum CalibrationState { done, init, select, calib, save, finish } state = done;
@@ -168,6 +183,144 @@ public:
     }
 };
 
+/* calib.csv for the first unit, calib_<id>.csv for the others */
+inline std::string calibration_filename(unsigned unit_id) {
+    return (unit_id == 0) ? "calib.csv" : "calib_" + std::to_string(unit_id) + ".csv";
+}
+
+/* one flatcat on its own motorcord, with controller and calibration,
+   not movable since control and calibration refer to the robot.
+   The controller's type depends on the unit's joint count (see make_unit),
+   everything touching it goes through the virtual methods, once per cycle. */
+struct FlatcatUnit
+{
+    FlatcatUnit(FlatcatSettings const& settings, unsigned unit_id)
+    : id(unit_id)
+    , robot(settings, unit_id)
+    , calibrate(robot, calibration_filename(unit_id))
+    , compact_encoder(settings.telemetry_key_interval, settings.telemetry_delta_slow_fields)
+    {}
+
+    virtual ~FlatcatUnit() {}
+
+    FlatcatUnit(const FlatcatUnit& other) = delete;
+    FlatcatUnit& operator=(const FlatcatUnit& other) = delete;
+
+    /* robot and control, calibration keeps the motors off while it runs */
+    virtual void execute_cycle(void) = 0;
+
+    virtual std::size_t encode_frame(uint8_t* buffer, std::size_t capacity, uint64_t cycles, bool compact) = 0;
+    virtual void        record      (Flight_Recorder& recorder, uint64_t cycles) const = 0;
+
+    /* applies a command to the controller, false if it is none of its commands */
+    virtual bool apply_command(Command const& cmd) = 0;
+
+    const unsigned     id;
+    FlatcatRobot       robot;
+    FlatcatCalibration calibrate;
+
+    Compact_Telemetry_Encoder compact_encoder;
+};
+
+template <std::size_t NumJoints>
+struct FlatcatUnit_T : public FlatcatUnit
+{
+    FlatcatUnit_T(FlatcatSettings const& settings, unsigned unit_id)
+    : FlatcatUnit(settings, unit_id)
+    , control(robot, settings)
+    {}
+
+    void execute_cycle(void)
+    {
+        if (calibrate.is_enabled()) {
+            control.amplitude = .0f;
+            control.enabled = false; // assure robot motors turned off
+        }
+        calibrate.execute_cycle();
+
+        robot.set_voltage_amplitude(control.amplitude);
+        robot.set_enable(control.enabled);
+
+        robot.execute_cycle();
+        control.execute_cycle();
+        robot.set_cycle_timing().lap(Phase_t::control);
+    }
+
+    std::size_t encode_frame(uint8_t* buffer, std::size_t capacity, uint64_t cycles, bool compact) {
+        if (compact)
+            return compact_encoder.encode(buffer, capacity, robot, control, cycles);
+        return encode_telemetry_frame(buffer, capacity, robot, control, cycles);
+    }
+
+    void record(Flight_Recorder& recorder, uint64_t cycles) const { recorder.record(robot, control, cycles); }
+
+    bool apply_command(Command const& cmd);
+
+    FlatcatControl_T<NumJoints> control;
+};
+
+template <std::size_t NumJoints>
+bool FlatcatUnit_T<NumJoints>::apply_command(Command const& cmd)
+{
+    switch (cmd.type) {
+    case Command_t::enable            : control.enabled   = (cmd.value != .0f);                         break;
+    case Command_t::amplitude         : control.amplitude = cmd.value;                                  break;
+    case Command_t::modulate          : control.modulate  = cmd.value;                                  break;
+    case Command_t::inputgain         : control.inputgain = cmd.value;                                  break;
+    case Command_t::user_position     : control.usr_pos   = (cmd.value != .0f);                         break;
+
+    case Command_t::midi:
+        if (cmd.index < control.usr_params.size())
+            control.usr_params[cmd.index] = cmd.value;
+        else wrn_msg("Unit %u has no joint %u.", id, (unsigned) cmd.index);
+        break;
+
+    case Command_t::cpg_phase:
+        if (cmd.index >= control.usr_params.size())
+            wrn_msg("Unit %u has no joint %u.", id, (unsigned) cmd.index);
+        else if (not control.cpg_ctrl.set_phase(cmd.index, cmd.value))
+            wrn_msg("Invalid CPG phase of joint %u: %f", (unsigned) cmd.index, cmd.value);
+        break;
+
+    case Command_t::cpg_amplitude:
+        if (cmd.index >= control.usr_params.size())
+            wrn_msg("Unit %u has no joint %u.", id, (unsigned) cmd.index);
+        else if (not control.cpg_ctrl.set_amplitude(cmd.index, cmd.value))
+            wrn_msg("Invalid CPG amplitude of joint %u: %f", (unsigned) cmd.index, cmd.value);
+        break;
+
+    case Command_t::parameter_set   : control.select_gait((unsigned) cmd.value);                        break;
+    case Command_t::trajectory      : control.select_trajectory((unsigned) cmd.value);                  break;
+    case Command_t::trajectory_scale:
+        if (not control.player.set_time_scale(cmd.value))
+            wrn_msg("Invalid trajectory time scale: %f", cmd.value);
+        break;
+    case Command_t::trajectory_loop : control.player.set_looping(cmd.value != .0f);                     break;
+
+    case Command_t::control_mode:
+        if (cmd.value < (float) ControlMode_t::END_ControlMode_t)
+            control.tar_mode = static_cast<ControlMode_t>(cmd.value);
+        else wrn_msg("Invalid control mode: %u", (unsigned) cmd.value);
+        break;
+
+    default:
+        return false;
+    }
+    return true;
+}
+
+/* the control specialized on FLATCAT_JOINTS if the unit has as many joints,
+   the runtime-sized one otherwise */
+inline FlatcatUnit* make_unit(FlatcatSettings const& settings, unsigned unit_id)
+{
+    const unsigned number_of_joints = settings.number_of_joints(unit_id);
+    if (FLATCAT_JOINTS != dynamic_joints and number_of_joints == FLATCAT_JOINTS)
+        return new FlatcatUnit_T<FLATCAT_JOINTS>(settings, unit_id);
+    if (FLATCAT_JOINTS != dynamic_joints)
+        sts_msg("Unit %u has %u joints, control is built for %u, running it runtime-sized.", unit_id, number_of_joints, FLATCAT_JOINTS);
+    return new FlatcatUnit_T<dynamic_joints>(settings, unit_id);
+}
+
 } /* namespace supreme */
 
 class MainApplication
@@ -176,55 +329,157 @@ public:
     MainApplication(int argc, char** argv, GlobalFlag const& do_quit)
     : do_quit(do_quit)
     , settings(argc, argv)
-    , flatcat(settings)
-    , control(flatcat, settings)
-    , calibrate(flatcat, "calib.csv")
+    , realtime(settings) /* before any thread is started */
+    , units()
     , command_server(7332 /*TODO command port*/)
-    , udp_sender(settings.group, settings.port)
-    , sendbuffer()
+    , commands()
+    , binary_decoder()
+    , subscribers(settings.subscriber_timeout_s)
+    , pings()
+    , batch_sender()
+    , packer(settings.telemetry_cycles_per_datagram)
+    , projections()
+    , projected()
+    , frame_slot()
+    , recorder(settings)
+    , scheduler(settings.update_rate_Hz, supreme::overrun_policy_from_string(settings.overrun_policy), not settings.free_running)
     {
-        sts_msg("____\nDONE initializing Flatcat controller.");
+#ifndef FLATCAT_SIMULATION
+        /* the motorcord has no device setting, every unit would open the same bus */
+        assertion(settings.number_of_units() == 1, "Hardware supports a single unit, got %u.", settings.number_of_units());
+#endif
+        units.reserve(settings.number_of_units());
+        for (unsigned u = 0; u < settings.number_of_units(); ++u)
+            units.emplace_back(supreme::make_unit(settings, u));
+
+        supreme::telemetry::print_schema(settings.number_of_joints(0));
+
+        if (settings.telemetry_multicast)
+            subscribers.subscribe(settings.group, settings.port, supreme::Subscription_t(), supreme::Lifetime_t::permanent);
+        subscribe_from_settings();
+
+        if (settings.telemetry_batching) {
+            sts_msg("Batched telemetry with %u cycle(s) per datagram.", packer.get_frames_per_datagram());
+            for (unsigned u = 0; u < settings.number_of_units(); ++u)
+                if (packer.get_frames_per_datagram() * supreme::telemetry_frame_size(settings.number_of_joints(u)) > supreme::constants::max_datagram_size)
+                    wrn_msg("Unit %u: %u cycles do not fit into one datagram, sending fewer.", u, packer.get_frames_per_datagram());
+        }
+
+        sts_msg("____\nDONE initializing Flatcat controller with %u unit(s).", settings.number_of_units());
     }
 
     bool execute_cycle() {
 
-        if (calibrate.is_enabled()) {
-            control.amplitude = .0f;
-            control.enabled = false; // assure robot motors turned off
-        }
-        calibrate.execute_cycle();
+        /* apply all commands received since the last cycle at once */
+        commands.drain([this](supreme::Command const& cmd) { apply_command(cmd); });
 
-        flatcat.set_voltage_amplitude(control.amplitude);
-        flatcat.set_enable(control.enabled);
+        /* all units are driven one after another, their telemetry frames
+           are assembled in place and published as one batch */
+        uint8_t* batch = frame_slot.acquire();
+        std::size_t batch_size = 0;
 
-        flatcat.execute_cycle();
-        control.execute_cycle();
+        for (auto& unit : units)
+        {
+            unit->execute_cycle();
 
-        fill_sendbuffer();
-        udp_sender.set_buffer(sendbuffer.get(), sendbuffer.size());
+            batch_size += unit->encode_frame(batch + batch_size, supreme::constants::max_telemetry_batch_size - batch_size
+                                            , cycles, settings.telemetry_compact);
+            unit->record(recorder, cycles);
+            unit->robot.set_cycle_timing().lap(supreme::Phase_t::sendbuffer);
+        }
+        frame_slot.commit(batch_size);
 
         ++cycles;
 
         return true; // not used
     }
 
-    void finish() {/*TODO implement*/};
+    /* blocks until the next cycle is due, false if the previous one overran */
+    bool wait_for_next_cycle(void) { return scheduler.wait_for_next_cycle(); }
+
+    supreme::Periodic_Scheduler const& get_scheduler(void) const { return scheduler; }
+
+    supreme::realtime::Profile& set_realtime_profile(void) { return realtime; }
+
+    /* after all threads have joined */
+    void finish() { recorder.close(); }
 
     void udp_send_loop(void)
     {
         while(!do_quit.status())
         {
-            if (udp_sender.data_ready()) {
-                udp_sender.transmit();
+            /* wakes once per published frame, timeout only to check for quit */
+            if (!frame_slot.wait_for_frame(100/*ms*/))
+                continue;
+
+            auto const* batch = frame_slot.take();
+            if (batch == nullptr)
+                continue;
+
+            /* offsets of the projections are taken once per change of the list */
+            if (subscribers.update()) {
+                auto const& list = subscribers.get();
+                batch_sender.set_destinations(list.entries.data(), list.size);
+                for (std::size_t s = 0; s < list.number_of_streams; ++s)
+                    projections[s] = supreme::Telemetry_Projection(list.streams[s].fields);
+            }
+            auto const& list = subscribers.get();
+
+            /* every frame is serialized once, each stream due in this cycle gets
+               the frame or its projection, whatever the number of its subscribers */
+            for (std::size_t pos = 0; pos < batch->size; ) {
+                const uint8_t* frame = batch->data.data() + pos;
+                const std::size_t len = supreme::telemetry_frame_length(frame);
+                for (unsigned s = 0; s < list.number_of_streams; ++s) {
+                    /* compact key frames are needed by all frames up to the next one */
+                    if (batch->seq % list.streams[s].decimation != 0 and !supreme::telemetry_is_key_frame(frame))
+                        continue;
+                    std::size_t size = 0;
+                    if (!projections[s].is_full()) /* not for compact frames */
+                        size = projections[s].project(frame, projected.data(), projected.size());
+                    if (size > 0)
+                        send_frame(projected.data(), size, supreme::telemetry_unit_id(frame), s);
+                    else
+                        send_frame(frame, len, supreme::telemetry_unit_id(frame), s);
+                }
+                pos += len;
+            }
+
+            /* all datagrams completed in this cycle to all subscribers with a single sendmmsg */
+            batch_sender.flush();
+
+            /* answers to pings, stamped right before sending */
+            supreme::Ping_Request_t ping;
+            while (pings.pop(ping)) {
+                uint8_t pong[sizeof(supreme::telemetry::Pong_t)];
+                const uint64_t t3_us = supreme::monotonic_time_ns() / supreme::constants::ns_per_us;
+                batch_sender.send_to(pong, supreme::encode_pong(pong, ping.id, ping.t1_us, ping.t2_us, t3_us), ping.destination);
             }
-            else usleep(100); // reduce polling
         }
+        print_telemetry_statistics();
+    }
+
+    void send_frame(const uint8_t* frame, std::size_t len, uint8_t unit_id, unsigned stream) {
+        if (settings.telemetry_batching)
+            packer.append(batch_sender, stream * supreme::constants::max_units + unit_id, frame, len, stream);
+        else
+            batch_sender.add(frame, len, stream); /* one datagram per unit and stream */
+    }
 
+    void print_telemetry_statistics(void) const {
+        typedef unsigned long long ull;
+        sts_msg("Telemetry: %llu frames published, %llu overwritten"
+               , (ull) frame_slot.get_published()
+               , (ull) frame_slot.get_overwritten());
+        sts_msg("Telemetry: %llu datagrams in %llu calls, %llu errors"
+               , (ull) batch_sender.get_datagrams_sent()
+               , (ull) batch_sender.get_syscalls()
+               , (ull) batch_sender.get_errors());
     }
 
     void tcp_serv_loop(void)
     {
-        std::string msg = ""; //TODO handle this thread-safe, hahahaha!
+        std::string msg = "";
 
         sts_msg("Starting TCP command server, waiting for incoming connections.");
         while(!do_quit.status())
@@ -232,80 +487,37 @@ public:
             while(!command_server.open_connection()) {
                 if (do_quit.status())
                     break;
+                subscribers.expire();
             }
 
-            if (!do_quit.status())
-                udp_sender.change_destination(command_server.get_current_client_address());
+            /* with multicast the clients join the group instead */
+            client_address = command_server.get_current_client_address();
+            if (!do_quit.status() and !settings.telemetry_multicast)
+                subscribers.subscribe(client_address, settings.port);
 
             while(!do_quit.status()) {
                 msg = command_server.get_next_line();
                 if (msg == "EXIT") {
                     sts_msg("Client requested to close connection.");
+                    subscribers.unsubscribe(client_address, settings.port);
                     break;
-                } else
-                    handle_tcp_commands(msg);
+                }
+                subscribers.keep_alive(client_address, settings.port);
+                subscribers.expire();
+                handle_tcp_commands(msg);
             }
 
             command_server.close_connection();
+            binary_commands = false; /* must be negotiated again by the next client */
+            binary_decoder.reset_connection();
+            selected_unit = 0;
         }
     }
 
 
-    void fill_sendbuffer(void) {
-        sendbuffer.reset();
-
-        sendbuffer.add(cycles);
-
-        /* N motors */
-        for (unsigned i = 0; i < flatcat.get_motors().size(); ++i)
-        {
-            auto const& m = flatcat.get_motors()[i];
-            auto const& d = m.get_data();
-            sendbuffer
-            .add(m.get_id()         )
-            .add(d.position         )
-            .add(d.last_p           )
-            .add(d.velocity         )
-            .add(d.current          )
-            .add(d.voltage_supply   )
-            .add(d.output_voltage   )
-//TODO            .add(d.voltage_backemf  )
-//TODO            .add(d.last_output      )
-            .add(d.temperature      )
-//TODO            .add(d.is_connected     )
-            //.add(m.connection_losses)
-            //.add(m.dir              )
-            //.add(m.scale            )
-            //.add(m.offset           );
-            ;
-        }
-
-        /**TODO
-        auto const& t = flatcat.get_spinalcord_timing();
-        sendbuffer
-        .add(t.mean                    )
-        .add(t.maxv                    )
-        .add(t.syncfaults              )
-        .add(t.board_dropouts          )
-        .add(t.transparent_errors      )
-        .add(t.transparent_packets_recv)
-        .add(t.collected_ids           );
-        */
-
-        auto const& c = control;
-        sendbuffer
-        .add(c.enabled  )
-        .add(c.usr_pos  )
-        .add(c.amplitude)
-        .add(c.modulate )
-        .add(c.inputgain)
-        .add(c.cur_mode );
-
-        sendbuffer.add_checksum();
-    }
-
-
+    void subscribe_from_settings(void);
     void handle_tcp_commands(std::string const& msg);
+    void apply_command(supreme::Command const& cmd);
 
     void calibration_procedure(void);
 
@@ -313,14 +525,31 @@ private:
 
     GlobalFlag const&           do_quit;
     supreme::FlatcatSettings    settings;
-    supreme::FlatcatRobot       flatcat;
-    supreme::FlatcatControl     control;
-    supreme::FlatcatCalibration calibrate;
+    supreme::realtime::Profile  realtime;
 
-    network::Socket_Server     command_server;
+    std::vector<std::unique_ptr<supreme::FlatcatUnit>> units;
 
-    network::UDPSender <113>   udp_sender;
-    network::Sendbuffer<113>   sendbuffer;
+    network::Socket_Server     command_server;
+    supreme::Command_Queue     commands;
+
+    /* owned by the TCP thread */
+    supreme::Binary_Command_Decoder binary_decoder;
+    bool                            binary_commands = false;
+    uint8_t                         selected_unit   = 0;
+    std::string                     client_address;
+
+    supreme::Subscriber_Table   subscribers;
+    supreme::MPSC_Queue<supreme::Ping_Request_t, 16> pings; /* to the UDP thread */
+
+    /* owned by the UDP thread, one datagram or channel per unit and stream */
+    supreme::Batch_UDP_Sender<supreme::constants::max_units * supreme::constants::max_subscribers, supreme::constants::max_subscribers> batch_sender;
+    supreme::Datagram_Packer <supreme::constants::max_units * supreme::constants::max_subscribers> packer;
+    std::array<supreme::Telemetry_Projection, supreme::constants::max_subscribers> projections;
+    std::array<uint8_t, supreme::constants::max_telemetry_frame_size>               projected;
+    supreme::Frame_Slot<supreme::constants::max_telemetry_batch_size> frame_slot;
+
+    supreme::Flight_Recorder    recorder;
+    supreme::Periodic_Scheduler scheduler;
 
     uint64_t cycles = 0;
 };
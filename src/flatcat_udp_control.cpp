@@ -12,21 +12,32 @@ Application::draw(const pref& p) const {
     flatcat_gfx.draw(p);
 
     auto const& ctrl = flatcat_UDP.control;
-   /**TODO:
-    auto const& ts = flatcat_UDP.get_spinalcord_timing();
-    glprintf(-1.f, 0.97f, 0.f, .025f, "(stat) <%x> sync_err=%u (dropped=%u) [trans_error=%u] %4.1f %5.1f\n"
-                                    , ts.collected_ids
-                                    , ts.syncfaults
-                                    , ts.board_dropouts
-                                    , ts.transparent_errors
-                                    , ts.mean, ts.maxv );
-    */
+    auto const& ts = flatcat_UDP.get_cycle_timing();
+    for (unsigned i = 0; i < supreme::constants::num_phases; ++i)
+        glprintf(-1.f, 0.97f - 0.03f*i, 0.f, .025f, "%-4s %5.3f %5.3f %5.3f ms"
+                                                 , supreme::constants::phase_str[i]
+                                                 , 1e-3f*ts[i].mean_us, 1e-3f*ts[i].p99_us, 1e-3f*ts[i].max_us);
     glprintf(+.4f, 0.97f, 0.f, .025f, "I = %4.2f M = %4.2f A = %4.2f %s\n", ctrl.inputgain
                                                                           , ctrl.modulate
                                                                           , ctrl.amplitude
                                                                           , (ctrl.enabled) ? "EN" : "--");
     glprintf(+.7f, 0.94f, 0.f, .025f, "MODE = %s", supreme::constants::mode_str[(unsigned)ctrl.mode]);
 
+    auto const& link = flatcat_UDP.link;
+    glprintf(+.4f, 0.90f, 0.f, .025f, "LINK loss %4.1f%% jitter %5.2f ms drops %llu/%llu %s"
+                                    , 100.0 * link.get_loss_rate(), 1e-3 * link.get_jitter_us()
+                                    , (unsigned long long) link.get_consecutive_lost(), (unsigned long long) link.get_max_consecutive_lost()
+                                    , link.is_alive(/*timeout_ms=*/250) ? "" : "NO CONN");
+    glprintf(+.4f, 0.87f, 0.f, .025f, "AGE  %5.2f ms", 1e-6 * (supreme::monotonic_time_ns() - flatcat_UDP.arrival_ns));
+
+    auto const& clk = flatcat_UDP.clock;
+    auto const& s2s = latency.get_sensor_to_screen();
+    auto const& c2a = latency.get_command_to_actuator();
+    glprintf(+.4f, 0.84f, 0.f, .025f, "CLK  %s offset %+8.3f ms drift %+6.2f ppm rtt %5.2f ms"
+                                    , clk.valid ? "" : "--", 1e-3 * clk.offset_us, clk.drift_ppm, 1e-3 * clk.delay_us);
+    glprintf(+.4f, 0.81f, 0.f, .025f, "S2S  %5.2f %5.2f %5.2f ms", 1e-3f*s2s.mean_us, 1e-3f*s2s.p99_us, 1e-3f*s2s.max_us);
+    glprintf(+.4f, 0.78f, 0.f, .025f, "C2A  %5.2f %5.2f %5.2f ms", 1e-3f*c2a.mean_us, 1e-3f*c2a.p99_us, 1e-3f*c2a.max_us);
+
 }
 
 bool
@@ -35,23 +46,26 @@ Application::loop(void)
     sts_msg("%05.2f ms %llu", watch.get_time_passed_us()/1000.0, cycles);
 
     /* get controller status from midi buttons and pots */
-    if (midi.has_changed(33)) remote.append("POS=%u\n", (unsigned) midi[33]);
-    if (midi.has_changed(23)) remote.append("ENA=%u\n", (unsigned) midi[23]);
-    if (midi.has_changed(22)) remote.append("AMP=%f\n", clip(midi.get(22), 0.f, 1.f));
-    if (midi.has_changed(21)) remote.append("MOD=%f\n", clip(midi.get(21), 0.f, 1.f));
-    if (midi.has_changed(20)) remote.append("ING=%f\n", clip(midi.get(20), 0.f, 1.f));
+    using supreme::Command_t;
+    if (midi.has_changed(33)) append_command(Command_t::user_position, (unsigned) midi[33]);
+    if (midi.has_changed(23)) append_command(Command_t::enable       , (unsigned) midi[23]);
+    if (midi.has_changed(22)) append_command(Command_t::amplitude    , clip(midi.get(22), 0.f, 1.f));
+    if (midi.has_changed(21)) append_command(Command_t::modulate     , clip(midi.get(21), 0.f, 1.f));
+    if (midi.has_changed(20)) append_command(Command_t::inputgain    , clip(midi.get(20), 0.f, 1.f));
 
     auto& ctrl = flatcat_UDP.control;
 
-    for (std::size_t i = 0; i < ctrl.user_target_position.size(); ++i) {
+    /* the korg kontrol covers the first three joints */
+    const std::size_t num_channels = std::min(ctrl.user_target_position.size(), supreme::constants::FlatcatMidiMap.size());
+    for (std::size_t i = 0; i < num_channels; ++i) {
         auto const& idx = supreme::constants::FlatcatMidiMap[i];
         if (midi.has_changed(idx)) {
             ctrl.user_target_position[i] = midi.get(idx);
-            remote.append("MDI%02u=%f\n", i, clip(ctrl.user_target_position[i], -1.f, 1.f));
+            append_command(Command_t::midi, clip(ctrl.user_target_position[i], -1.f, 1.f), i);
         }
         if (j_axis_changed) {
             ctrl.user_target_position[i] = j_val[i];
-            remote.append("MDI%02u=%f\n", i, clip(ctrl.user_target_position[i], -1.f, 1.f));
+            append_command(Command_t::midi, clip(ctrl.user_target_position[i], -1.f, 1.f), i);
         }
     }
     j_axis_changed = false;
@@ -64,10 +78,34 @@ Application::loop(void)
     cycles++;
 
     remote.flush();
+    measure_latency();
     midi.fetch();
     return true;
 }
 
+/* after the flush: stamps the commands just sent, pings for the clock
+   once in a while and takes the latencies of the newest state */
+void
+Application::measure_latency(void)
+{
+    const uint64_t now_us = supreme::monotonic_time_ns() / supreme::constants::ns_per_us;
+
+    /* all commands of a cycle leave together, the robot echoes the last one applied */
+    if (encoder.get_last_seq() != stamped_seq) {
+        stamped_seq = encoder.get_last_seq();
+        latency.command_sent(stamped_seq, now_us);
+    }
+
+    if (now_us - last_ping_us >= supreme::constants::ping_interval_us) {
+        last_ping_us = now_us;
+        remote.send("PNG=%u,%llu\n", ++ping_id, (unsigned long long) now_us);
+    }
+
+    auto const& r = flatcat_UDP;
+    latency.sample_shown  (r.cycles, r.sample_us, r.clock, now_us);
+    latency.command_echoed(r.command_seq, r.actuated_us, r.clock);
+}
+
 void
 Application::user_callback_key_pressed(const SDL_Keysym& key)
 {
@@ -78,7 +116,14 @@ Application::user_callback_key_pressed(const SDL_Keysym& key)
         case SDLK_2 : send_control_mode(supreme::ControlMode_t::position); break;
         case SDLK_3 : send_control_mode(supreme::ControlMode_t::csl_hold); break;
         case SDLK_4 : send_control_mode(supreme::ControlMode_t::so2_osc ); break;
-        case SDLK_5 : send_control_mode(supreme::ControlMode_t::walking ); break;
+        case SDLK_5 : send_control_mode(supreme::ControlMode_t::behavior); break;
+        case SDLK_6 : send_control_mode(supreme::ControlMode_t::cpg     ); break;
+        case SDLK_7 : send_control_mode(supreme::ControlMode_t::trajectory); break;
+
+        /* gaits of the CPG, changed while it runs */
+        case SDLK_f : send_cpg_wave(+jcl::so2::phase_per_joint); break; // travelling wave head to tail
+        case SDLK_g : send_cpg_wave(-jcl::so2::phase_per_joint); break; // tail to head
+        case SDLK_h : send_cpg_wave(0.f);                        break; // all joints in phase
 
         case SDLK_q : send_parameter_id(0); break; // stop
         case SDLK_w : send_parameter_id(1); break; // walk
@@ -134,6 +179,8 @@ void Application::user_callback_joystick_motion_axis(SDL_JoyAxisEvent const& joy
 void
 Application::finish(void)
 {
+    flatcat_UDP.link.print_statistics();
+    latency.print_statistics(flatcat_UDP.clock);
     sts_msg("Finished shutting down all subsystems.");
     quit();
     remote.send("EXIT\n");
@@ -18,6 +18,10 @@
 
 #include <flatcat_graphics.hpp>
 #include <flatcat_control.hpp>
+#include <command_protocol.hpp>
+#include <flatcat_telemetry.hpp>
+#include <telemetry_receiver.hpp>
+#include <latency_monitor.hpp>
 #include <robots/accel.h>
 
 
@@ -41,12 +45,18 @@ namespace constants {
 
 class FlatcatUDPRobot {
 public:
-    typedef std::array<float, constants::num_joints> TargetPosition_t;
+    typedef std::vector<float> TargetPosition_t;
 
-    network::UDPReceiver<101> receiver;
+    /* receives in its own thread, single and batched datagrams alike */
+    Telemetry_Receiver<supreme::interface_data> receiver;
+
+    const uint8_t unit_id;
 
     uint16_t sync   = 0;
     uint64_t cycles = 0;
+    uint64_t sample_us   = 0; /* robot clock, see telemetry_schema.hpp */
+    uint16_t command_seq = 0;
+    uint64_t actuated_us = 0;
     uint8_t  chksum = 0;
 
     typedef std::vector<supreme::interface_data> Motordata_t;
@@ -54,100 +64,58 @@ public:
 
     //robots::Accelvector_t accels; /**TODO*/
 
-    //typedef supreme::SpinalCord::TimingStats timestats_t;
-    //TODO: timestats_t timing;
-
-    struct Control_t {
-        bool enabled = false;
-        bool def_pos = false;
-        float amplitude = 0.f;
-        float modulate  = 0.f;
-        float inputgain = 0.f;
-        supreme::ControlMode_t mode = ControlMode_t::none;
-        TargetPosition_t user_target_position = TargetPosition_t{.0};
+    supreme::Cycle_Timing_Stats_t timing;
+
+    uint64_t        arrival_ns = 0; /* monotonic arrival time of the newest frame */
+    Link_Statistics link;           /* as of the newest frame */
+    Clock_Estimate_t clock;         /* robot minus terminal clock */
+
+    struct Control_t : Telemetry_Control_State_t {
+        TargetPosition_t user_target_position;
     } control;
 
 
-    FlatcatUDPRobot()
-    : receiver("239.255.255.252", 7331)
-    , motors(3 /**TODO determine automatically*/)
+    FlatcatUDPRobot(std::string const& group, unsigned port, unsigned unit_id, unsigned number_of_joints, double update_rate_Hz, unsigned decimation = 1)
+    : receiver(group, port, unit_id, number_of_joints, update_rate_Hz, decimation)
+    , unit_id(unit_id)
+    , motors(number_of_joints)
     //, accels(1)/**TODO*/
-    //, timing()
+    , timing()
+    , link(update_rate_Hz)
+    , clock()
     , control()
     {
-        sts_msg("Creating Flatcat UDP Robot.");
+        sts_msg("Creating Flatcat UDP Robot for unit %u with %u joints.", unit_id, number_of_joints);
+        control.user_target_position.assign(number_of_joints, .0f);
 
     }
 
     Motordata_t const& get_motors(void) const { return motors; }
     //const robots::Accelvector_t& get_accels(void) const { return accels; }
 
-    //TODO SpinalCord::TimingStats const& get_spinalcord_timing(void) const { return timing; }
-
-    void execute_cycle(void) {
-        receiver.receive_message();
-        if (receiver.data_received())
-        {
-            const uint8_t* msg = receiver.get_message();
-
-
-            std::size_t n = 0;
-            n = network::getfrom(sync  , msg, n);
-            n = network::getfrom(cycles, msg, n);
-
-            /* sensorimotor data */
-            for (unsigned i = 0; i < motors.size(); ++i) {
-                auto& m = motors[i];
-                n = network::getfrom(m.id               , msg, n);
-                n = network::getfrom(m.position         , msg, n);
-                n = network::getfrom(m.last_p           , msg, n);
-                n = network::getfrom(m.velocity         , msg, n);
-                n = network::getfrom(m.current          , msg, n);
-                n = network::getfrom(m.voltage_supply   , msg, n);
-//                n = network::getfrom(m.voltage_backemf  , msg, n);
-//TODO                n = network::getfrom(m.last_output      , msg, n);
-                n = network::getfrom(m.temperature      , msg, n);
-//TODO                n = network::getfrom(m.is_connected     , msg, n);
-//                n = network::getfrom(m.acceleration.x   , msg, n);
-//                n = network::getfrom(m.acceleration.y   , msg, n);
-//                n = network::getfrom(m.acceleration.z   , msg, n);
-//TODO                n = network::getfrom(m.connection_losses, msg, n);
-//TODO                n = network::getfrom(m.target_voltage   , msg, n);
- //TODO               n = network::getfrom(m.dir              , msg, n);
- //TODO               n = network::getfrom(m.scale            , msg, n);
- //TODO               n = network::getfrom(m.offset           , msg, n);
-            } /* for each motor */
-
-            /* timing */
-            /**TODO
-            auto& t = timing;
-            n = network::getfrom(t.mean                     , msg, n);
-            n = network::getfrom(t.maxv                     , msg, n);
-            n = network::getfrom(t.syncfaults               , msg, n);
-            n = network::getfrom(t.board_dropouts           , msg, n);
-            n = network::getfrom(t.transparent_errors       , msg, n);
-            n = network::getfrom(t.transparent_packets_recv , msg, n);
-            n = network::getfrom(t.collected_ids            , msg, n);
-            */
-
-            /* control read back */
-            auto& c = control;
-            n = network::getfrom(c.enabled  , msg, n);
-            n = network::getfrom(c.def_pos  , msg, n);
-            n = network::getfrom(c.amplitude, msg, n);
-            n = network::getfrom(c.modulate , msg, n);
-            n = network::getfrom(c.inputgain, msg, n);
-            n = network::getfrom(c.mode     , msg, n);
-
-            /* checksum */
-            n = network::getfrom(chksum, msg, n);
-
-            assertion(network::validate(msg, n), "Invalid checksum: 0x%x for %u bytes", chksum, n);
-
-            receiver.acknowledge();
-            //sts_msg("%ub, 0x%x: %lu ", n, sync, cycles);
-        }
-
+    supreme::Cycle_Timing_Stats_t const& get_cycle_timing(void) const { return timing; }
+
+    void execute_cycle(void) { get_UDP_data(); }
+
+    /* takes over the newest state from the receive thread, no system call */
+    bool get_UDP_data(void) {
+        if (not receiver.update())
+            return false;
+
+        auto const& s = receiver.get_state();
+        sync       = s.sync;
+        cycles     = s.cycles;
+        sample_us   = s.sample_us;
+        command_seq = s.command_seq;
+        actuated_us = s.actuated_us;
+        chksum     = s.chksum;
+        motors     = s.motors; /* same size, no allocation */
+        timing     = s.timing;
+        arrival_ns = s.arrival_ns;
+        link       = s.link;
+        clock      = s.clock;
+        static_cast<Telemetry_Control_State_t&>(control) = s.control;
+        return true;
     }
 
 };
@@ -160,19 +128,24 @@ class Application : public Application_Base
 public:
     Application(int argc, char** argv, Event_Manager& em)
     : Application_Base(argc, argv, em, "Flatcat UDP Terminal", 1024, 1024)
+    , settings(argc, argv)
     , midi(1, /*verbose=*/true)
-    //, settings(argc, argv)
     , remote()
-    , flatcat_UDP()
+    , encoder()
+    , flatcat_UDP(settings.group, settings.port, settings.unit_id, settings.number_of_joints(settings.unit_id), settings.update_rate_Hz, settings.subscribe_decimation)
     , flatcat_gfx(flatcat_UDP, flatcat_UDP.control.user_target_position)
     , watch()
+    , latency()
     {
         do_pause.disable(); // do not start in pause mode
         fast_forward.enable();
 
-       assert(flatcat_UDP.control.user_target_position.size() == supreme::constants::FlatcatMidiMap.size());
        remote.open_connection(network::hostname_to_ip("flatcat2.local").c_str()/*"192.168.1.106"*/, 7332);
        remote.send("HELLO\n");
+       remote.send("UNT=%u\n", settings.unit_id); /* commands address the observed unit */
+       remote.send("BIN=1\n"); /* stream commands as binary frames */
+       remote.send("DEC=%u\n", settings.subscribe_decimation); /* telemetry every n-th cycle */
+       remote.send("FLD=%s\n", settings.subscribe_fields.c_str());
 
     }
 
@@ -195,16 +168,34 @@ public:
     void send_control_mode(supreme::ControlMode_t mode) { remote.send("CTL=%u\n", mode); }
     void send_parameter_id(unsigned id) { remote.send("PAR=%u\n", id); }
 
+    void append_command(supreme::Command_t cmd, float value, uint8_t index = 0) {
+        remote.append("%s", encoder.encode(cmd, value, index));
+    }
+
+    void measure_latency(void);
+
+    void send_cpg_wave(float phase_per_joint) {
+        for (std::size_t i = 0; i < flatcat_UDP.get_motors().size(); ++i)
+            append_command(supreme::Command_t::cpg_phase, phase_per_joint * i, i);
+    }
+
 private:
+    supreme::FlatcatSettings   settings;
     MidiIn                     midi;
 
     network::Socket_Client     remote;
+    supreme::Binary_Command_Encoder encoder;
 
     supreme::FlatcatUDPRobot   flatcat_UDP;
     supreme::FlatcatGraphics   flatcat_gfx;
 
     Stopwatch                  watch;
 
+    supreme::Latency_Monitor   latency;
+    uint16_t                   stamped_seq  = static_cast<uint16_t>(-1); /* nothing encoded yet */
+    uint32_t                   ping_id      = 0;
+    uint64_t                   last_ping_us = 0;
+
     double                     j_val[32]; // joystick
     bool                       j_enable = false;
     bool                       j_axis_changed = false;
@@ -30,21 +30,37 @@ Application::draw(const pref& p) const
     set_color(colors::white);
 
     auto const& ctrl = robot.control;
-   /**TODO:
-    auto const& ts = robot.get_spinalcord_timing();
-    glprintf(-1.f, 0.97f, 0.f, .025f, "(stat) <%x> sync_err=%u (dropped=%u) [trans_error=%u] %4.1f %5.1f\n"
-                                    , ts.collected_ids
-                                    , ts.syncfaults
-                                    , ts.board_dropouts
-                                    , ts.transparent_errors
-                                    , ts.mean, ts.maxv );
-    */
+    auto const& ts = robot.get_cycle_timing();
+    for (unsigned i = 0; i < supreme::constants::num_phases; ++i)
+        glprintf(-1.f, 0.97f - 0.03f*i, 0.f, .025f, "%-4s %5.3f %5.3f %5.3f ms"
+                                                 , supreme::constants::phase_str[i]
+                                                 , 1e-3f*ts[i].mean_us, 1e-3f*ts[i].p99_us, 1e-3f*ts[i].max_us);
     glprintf(+.4f, 0.97f, 0.f, .025f, "I = %4.2f M = %4.2f A = %4.2f %s\n", ctrl.inputgain
                                                                           , ctrl.modulate
                                                                           , ctrl.amplitude
                                                                           , (ctrl.enabled) ? "EN" : "--");
     glprintf(+.7f, .94f, .0f, .025f, "MODE = %s", supreme::constants::mode_str[(unsigned)ctrl.mode]);
-    glprintf(+.7f, .90f, .0f, .025f, "CONN = %s", connection_status? "OK":"NO");
+    if (robot.is_replaying())
+        glprintf(+.7f, .90f, .0f, .025f, "REPLAY %llu/%llu", (unsigned long long) robot.replay->get_position()
+                                                           , (unsigned long long) robot.replay->get_count());
+    else
+        glprintf(+.7f, .90f, .0f, .025f, "CONN = %s", connection_status? "OK":"NO");
+
+    auto const& link = robot.link;
+    glprintf(+.4f, .86f, .0f, .025f, "LINK loss %4.1f%% jitter %5.2f ms drops %llu/%llu"
+                                   , 100.0 * link.get_loss_rate(), 1e-3 * link.get_jitter_us()
+                                   , (unsigned long long) link.get_consecutive_lost(), (unsigned long long) link.get_max_consecutive_lost());
+    glprintf(+.4f, .83f, .0f, .025f, "AGE  %5.2f ms", 1e-6 * (supreme::monotonic_time_ns() - robot.arrival_ns));
+
+    if (not robot.is_replaying()) {
+        auto const& clk = robot.clock;
+        auto const& s2s = latency.get_sensor_to_screen();
+        auto const& c2a = latency.get_command_to_actuator();
+        glprintf(+.4f, .80f, .0f, .025f, "CLK  %s offset %+8.3f ms drift %+6.2f ppm rtt %5.2f ms"
+                                       , clk.valid ? "" : "--", 1e-3 * clk.offset_us, clk.drift_ppm, 1e-3 * clk.delay_us);
+        glprintf(+.4f, .77f, .0f, .025f, "S2S  %5.2f %5.2f %5.2f ms", 1e-3f*s2s.mean_us, 1e-3f*s2s.p99_us, 1e-3f*s2s.max_us);
+        glprintf(+.4f, .74f, .0f, .025f, "C2A  %5.2f %5.2f %5.2f ms", 1e-3f*c2a.mean_us, 1e-3f*c2a.p99_us, 1e-3f*c2a.max_us);
+    }
 
 
     glprintf(+.4f, -0.97f, .0f, .025f, "%05.2f ms %llu", time_passed_ms, cycles);
@@ -56,29 +72,93 @@ Application::loop(void)
 
 
     /* get controller status from midi buttons and pots */
-    if (midi.has_changed(33)) remote.append("POS=%u\n", (unsigned) midi[33]);
-    if (midi.has_changed(23)) remote.append("ENA=%u\n", (unsigned) midi[23]);
-    if (midi.has_changed(22)) remote.append("AMP=%f\n", clip(midi.get(22), 0.f, 1.f));
-    if (midi.has_changed(21)) remote.append("MOD=%f\n", clip(midi.get(21), 0.f, 1.f));
-    if (midi.has_changed(20)) remote.append("ING=%f\n", clip(midi.get(20), 0.f, 1.f));
+    using supreme::Command_t;
+    if (midi.has_changed(33)) append_command(Command_t::user_position, (unsigned) midi[33]);
+    if (midi.has_changed(23)) append_command(Command_t::enable       , (unsigned) midi[23]);
+    if (midi.has_changed(22)) append_command(Command_t::amplitude    , clip(midi.get(22), 0.f, 1.f));
+    if (midi.has_changed(21)) append_command(Command_t::modulate     , clip(midi.get(21), 0.f, 1.f));
+    if (midi.has_changed(20)) append_command(Command_t::inputgain    , clip(midi.get(20), 0.f, 1.f));
 
     auto& ctrl = robot.control;
 
-    for (std::size_t i = 0; i < ctrl.user_target_position.size(); ++i) {
+    /* the korg kontrol covers the first three joints */
+    const std::size_t num_channels = std::min(ctrl.user_target_position.size(), supreme::constants::FlatcatMidiMap.size());
+    for (std::size_t i = 0; i < num_channels; ++i) {
         auto const& idx = supreme::constants::FlatcatMidiMap[i];
         if (midi.has_changed(idx)) {
             ctrl.user_target_position[i] = midi.get(idx);
-            remote.append("MDI%02u=%f\n", i, clip(ctrl.user_target_position[i], -1.f, 1.f));
+            append_command(Command_t::midi, clip(ctrl.user_target_position[i], -1.f, 1.f), i);
         }
         if (j_axis_changed) {
             ctrl.user_target_position[i] = j_val[i];
-            remote.append("MDI%02u=%f\n", i, clip(ctrl.user_target_position[i], -1.f, 1.f));
+            append_command(Command_t::midi, clip(ctrl.user_target_position[i], -1.f, 1.f), i);
         }
     }
     j_axis_changed = false;
 
 
-    connection_status = robot.execute_cycle();
+    if (robot.is_replaying())
+        replay_cycles();
+    else {
+        /* keeps the last good state through short drop outs */
+        robot.execute_cycle();
+        connection_status = robot.link.is_alive(/*timeout_ms=*/250);
+        learning_cycle();
+        remote.flush();
+        measure_latency();
+    }
+
+    midi.fetch();
+    time_passed_ms = watch.get_time_passed_us()/1000.0;
+    return true;
+}
+
+/* one learning step per recorded cycle, as many as fit into one frame,
+   quits after saving when the recording is through */
+void
+Application::replay_cycles(void)
+{
+    const uint64_t t0 = supreme::monotonic_time_ns();
+    while (robot.execute_cycle()) {
+        learning_cycle();
+        if (supreme::monotonic_time_ns() - t0 > replay_frame_budget_ns)
+            break;
+    }
+    connection_status = not robot.replay_at_end();
+
+    if (robot.replay_at_end() and not replay_finished) {
+        replay_finished = true;
+        sts_msg("Replay finished after %llu records.", (unsigned long long) robot.replay->get_replayed());
+        save(settings.save_folder);
+        quit();
+    }
+}
+
+/* live only, after the flush: stamps the commands just sent, pings for the clock
+   once in a while and takes the latencies of the newest state */
+void
+Application::measure_latency(void)
+{
+    const uint64_t now_us = supreme::monotonic_time_ns() / supreme::constants::ns_per_us;
+
+    /* all commands of a cycle leave together, the robot echoes the last one applied */
+    if (encoder.get_last_seq() != stamped_seq) {
+        stamped_seq = encoder.get_last_seq();
+        latency.command_sent(stamped_seq, now_us);
+    }
+
+    if (now_us - last_ping_us >= supreme::constants::ping_interval_us) {
+        last_ping_us = now_us;
+        remote.send("PNG=%u,%llu\n", ++ping_id, (unsigned long long) now_us);
+    }
+
+    latency.sample_shown  (robot.cycles, robot.sample_us, robot.clock, now_us);
+    latency.command_echoed(robot.command_seq, robot.actuated_us, robot.clock);
+}
+
+void
+Application::learning_cycle(void)
+{
     gmes_joint_group         .execute_cycle();
     super_layer              .execute_cycle();
 
@@ -100,16 +180,10 @@ Application::loop(void)
     if (eigenzeit.has_progressed())
         reward.clear_aggregations();
 
-    remote.flush();
-    midi.fetch();
-
     cycles++;
-    time_passed_ms = watch.get_time_passed_us()/1000.0;
 
     if (cycles % (settings.save_cycles_s*100) == 0)
         save(settings.save_folder); // save each minute
-
-    return true;
 }
 
 void
@@ -123,12 +197,14 @@ Application::user_callback_key_pressed(const SDL_Keysym& key)
         case SDLK_3 : send_control_mode(supreme::ControlMode_t::csl_hold); break;
         case SDLK_4 : send_control_mode(supreme::ControlMode_t::so2_osc ); break;
         case SDLK_5 : send_control_mode(supreme::ControlMode_t::behavior); break;
+        case SDLK_6 : send_control_mode(supreme::ControlMode_t::cpg     ); break;
+        case SDLK_7 : send_control_mode(supreme::ControlMode_t::trajectory); break;
 
-        case SDLK_r : remote.send("RST\n"); break;
+        case SDLK_r : send_text("RST\n"); break;
 
-        case SDLK_c : remote.send("CEN\n"); break; // calibration enable
-        case SDLK_v : remote.send("CID\n"); break; // calibration index
-        case SDLK_b : remote.send("CAB\n"); break; // calibration abort
+        case SDLK_c : send_text("CEN\n"); break; // calibration enable
+        case SDLK_v : send_text("CID\n"); break; // calibration index
+        case SDLK_b : send_text("CAB\n"); break; // calibration abort
 
         default:
             break;
@@ -177,9 +253,12 @@ void Application::user_callback_joystick_motion_axis(SDL_JoyAxisEvent const& joy
 void
 Application::finish(void)
 {
+    robot.link.print_statistics();
+    if (not robot.is_replaying())
+        latency.print_statistics(robot.clock);
     sts_msg("Finished shutting down all subsystems.");
     quit();
-    remote.send("EXIT\n");
+    send_text("EXIT\n");
 }
 
 
@@ -2,6 +2,7 @@
 #define FLATCAT_CONTROL_UDP_HPP
 
 #include <array>
+#include <memory>
 #include <experimental/filesystem>
 
 #include <common/basic.h>
@@ -21,6 +22,11 @@
 
 #include <flatcat_graphics.hpp>
 #include <flatcat_control.hpp>
+#include <command_protocol.hpp>
+#include <flatcat_telemetry.hpp>
+#include <telemetry_receiver.hpp>
+#include <latency_monitor.hpp>
+#include <flight_replay.hpp>
 
 #include <robots/robot.h>
 #include <robots/accel.h>
@@ -55,12 +61,21 @@ namespace constants {
 
 class FlatcatUDPRobot : public robots::Robot_Interface {
 public:
-    typedef std::array<float, constants::num_joints> TargetPosition_t;
+    typedef std::vector<float> TargetPosition_t;
 
-    network::UDPReceiver<113> receiver;
+    /* either the live stream, received in its own thread, single and batched
+       datagrams alike, or the replay of a flight recorder file */
+    std::unique_ptr<Flight_Replay<supreme::interface_data>>      replay;
+    std::unique_ptr<Telemetry_Receiver<supreme::interface_data>> receiver;
+    Telemetry_Source<supreme::interface_data>&                   source;
+
+    const uint8_t unit_id;
 
     uint16_t sync   = 0;
     uint64_t cycles = 0;
+    uint64_t sample_us   = 0; /* robot clock, see telemetry_schema.hpp */
+    uint16_t command_seq = 0;
+    uint64_t actuated_us = 0;
     uint8_t  chksum = 0;
 
     typedef std::vector<supreme::interface_data> Motordata_t;
@@ -69,105 +84,80 @@ public:
     robots::Jointvector_t      joints;
     robots::Accelvector_t      accels;
 
-    struct Control_t {
-        bool enabled = false;
-        bool def_pos = false;
-        float amplitude = 0.f;
-        float modulate  = 0.f;
-        float inputgain = 0.f;
-        supreme::ControlMode_t mode = ControlMode_t::none;
-        TargetPosition_t user_target_position = TargetPosition_t{.0};
+    supreme::Cycle_Timing_Stats_t timing;
+
+    uint64_t        arrival_ns = 0; /* monotonic arrival time of the newest frame */
+    Link_Statistics link;           /* as of the newest frame */
+    Clock_Estimate_t clock;         /* robot minus terminal clock, not when replaying */
+
+    struct Control_t : Telemetry_Control_State_t {
+        TargetPosition_t user_target_position;
     } control;
 
 
-    FlatcatUDPRobot()
-    : receiver("239.255.255.252", 7331)
-    , motors(3 /**TODO determine automatically*/)
+    FlatcatUDPRobot( std::string const& group
+                   , unsigned port
+                   , unsigned unit_id
+                   , unsigned number_of_joints
+                   , double update_rate_Hz
+                   , unsigned decimation = 1
+                   , std::string const& replay_file = ""
+                   , double replay_speed = .0 )
+    : replay(replay_file.empty() ? nullptr : new Flight_Replay<supreme::interface_data>(replay_file, unit_id, number_of_joints, update_rate_Hz, replay_speed))
+    , receiver(replay ? nullptr : new Telemetry_Receiver<supreme::interface_data>(group, port, unit_id, number_of_joints, update_rate_Hz, decimation))
+    , source(replay ? static_cast<Telemetry_Source<supreme::interface_data>&>(*replay) : *receiver)
+    , unit_id(unit_id)
+    , motors(number_of_joints)
     , joints()
     , accels()
+    , timing()
+    , link(update_rate_Hz)
+    , clock()
     , control()
     {
-        sts_msg("Creating Flatcat UDP Robot.");
+        sts_msg("Creating Flatcat UDP Robot for unit %u with %u joints.", unit_id, number_of_joints);
+        control.user_target_position.assign(number_of_joints, .0f);
 
         /* define joints */
-        joints.emplace_back( 0, robots::Joint_Type_Normal,  0, "head" , -0.75, +0.75, .0 );
-        joints.emplace_back( 1, robots::Joint_Type_Normal,  1, "body" , -0.75, +0.75, .0 );
-        joints.emplace_back( 2, robots::Joint_Type_Normal,  2, "tail" , -0.75, +0.75, .0 );
+        for (unsigned i = 0; i < number_of_joints; ++i)
+            joints.emplace_back( i, robots::Joint_Type_Normal,  i, joint_name(i, number_of_joints), -0.75, +0.75, .0 );
     }
 
     Motordata_t const& get_motors(void) const { return motors; }
 
+    supreme::Cycle_Timing_Stats_t const& get_cycle_timing(void) const { return timing; }
+
     bool execute_cycle(void) {
         bool result = get_UDP_data();
         read_spinalcord();
         return result;
     }
 
+    /* takes over the newest state from the receive thread without a system
+       call, or the next record of the replay */
     bool get_UDP_data(void) {
-        receiver.receive_message();
-        if (receiver.data_received())
-        {
-            const uint8_t* msg = receiver.get_message();
-            std::size_t n = 0;
-            n = network::getfrom(sync  , msg, n);
-            n = network::getfrom(cycles, msg, n);
-
-            /* sensorimotor data */
-            for (unsigned i = 0; i < motors.size(); ++i) {
-                auto& m = motors[i];
-                n = network::getfrom(m.id               , msg, n);
-                n = network::getfrom(m.position         , msg, n);
-                n = network::getfrom(m.last_p           , msg, n);
-                n = network::getfrom(m.velocity         , msg, n);
-                n = network::getfrom(m.current          , msg, n);
-                n = network::getfrom(m.voltage_supply   , msg, n);
-                n = network::getfrom(m.output_voltage   , msg, n);
-            //  n = network::getfrom(m.voltage_backemf  , msg, n);
-            //  n = network::getfrom(m.last_output      , msg, n);
-                n = network::getfrom(m.temperature      , msg, n);
-            //  n = network::getfrom(m.is_connected     , msg, n);
-            //  n = network::getfrom(m.acceleration.x   , msg, n);
-            //  n = network::getfrom(m.acceleration.y   , msg, n);
-            //  n = network::getfrom(m.acceleration.z   , msg, n);
-            //  n = network::getfrom(m.connection_losses, msg, n);
-            //  n = network::getfrom(m.dir              , msg, n);
-            //  n = network::getfrom(m.scale            , msg, n);
-            //  n = network::getfrom(m.offset           , msg, n);
-            } /* for each motor */
-
-            /* timing */
-            /*
-            auto& t = timing;
-            n = network::getfrom(t.mean                     , msg, n);
-            n = network::getfrom(t.maxv                     , msg, n);
-            n = network::getfrom(t.syncfaults               , msg, n);
-            n = network::getfrom(t.board_dropouts           , msg, n);
-            n = network::getfrom(t.transparent_errors       , msg, n);
-            n = network::getfrom(t.transparent_packets_recv , msg, n);
-            n = network::getfrom(t.collected_ids            , msg, n);
-            */
-
-            /* control read back */
-            auto& c = control;
-            n = network::getfrom(c.enabled  , msg, n);
-            n = network::getfrom(c.def_pos  , msg, n);
-            n = network::getfrom(c.amplitude, msg, n);
-            n = network::getfrom(c.modulate , msg, n);
-            n = network::getfrom(c.inputgain, msg, n);
-            n = network::getfrom(c.mode     , msg, n);
-
-            /* checksum */
-            n = network::getfrom(chksum, msg, n);
-
-            assertion(network::validate(msg, n), "Invalid checksum: 0x%x for %u bytes", chksum, n);
-
-            receiver.acknowledge();
-            //sts_msg("%ub, 0x%x: %lu ", n, sync, cycles);
-            return true;
-        }
-        return false;
+        if (not source.update())
+            return false;
+
+        auto const& s = source.get_state();
+        sync       = s.sync;
+        cycles     = s.cycles;
+        sample_us   = s.sample_us;
+        command_seq = s.command_seq;
+        actuated_us = s.actuated_us;
+        chksum     = s.chksum;
+        motors     = s.motors; /* same size, no allocation */
+        timing     = s.timing;
+        arrival_ns = s.arrival_ns;
+        link       = s.link;
+        clock      = s.clock;
+        static_cast<Telemetry_Control_State_t&>(control) = s.control;
+        return true;
     }
 
+    bool is_replaying  (void) const { return replay != nullptr; }
+    bool replay_at_end (void) const { return replay and replay->at_end(); }
+
     std::size_t get_number_of_joints(void) const { return motors.size(); }
     std::size_t get_number_of_symmetric_joints(void) const { return 0; }
     virtual std::size_t get_number_of_accel_sensors(void) const { return 0; }
@@ -226,6 +216,8 @@ class RemoteRobotActions : public Action_Module_Interface {
 
 
     network::Socket_Client& remote;
+    supreme::Binary_Command_Encoder& encoder;
+    const bool send_commands; /* not when replaying */
 
     unsigned applied_policy = 0;
     unsigned applied_action = 0;
@@ -247,7 +239,8 @@ class RemoteRobotActions : public Action_Module_Interface {
 
 public:
 
-    RemoteRobotActions(network::Socket_Client& remote) : remote(remote) {}
+    RemoteRobotActions(network::Socket_Client& remote, supreme::Binary_Command_Encoder& encoder, bool send_commands = true)
+    : remote(remote), encoder(encoder), send_commands(send_commands) {}
 
     std::size_t get_number_of_actions(void) const { return modes.size(); }
     std::size_t get_number_of_actions_available(void) const { return modes.size(); }
@@ -265,9 +258,12 @@ public:
                                    , modes.at(applied_action).tail );
 
 
-       remote.append("MDI00=%f\nMDI01=%f\nMDI02=%f\n", modes.at(applied_action).head
-                                                     , modes.at(applied_action).body
-                                                     , modes.at(applied_action).tail );
+       if (not send_commands) return;
+
+       auto const& m = modes.at(applied_action);
+       remote.append("%s", encoder.encode(supreme::Command_t::midi, m.head, 0));
+       remote.append("%s", encoder.encode(supreme::Command_t::midi, m.body, 1));
+       remote.append("%s", encoder.encode(supreme::Command_t::midi, m.tail, 2));
     }
 
 };
@@ -280,8 +276,9 @@ public:
     , settings(argc, argv)
     , midi(1, /*verbose=*/true)
     , remote()
-    , robot()
-    , actions(remote)
+    , encoder()
+    , robot(settings.group, settings.port, settings.unit_id, settings.number_of_joints(settings.unit_id), settings.update_rate_Hz, settings.subscribe_decimation, settings.replay_file, settings.replay_speed)
+    , actions(remote, encoder, not robot.is_replaying())
     , reward()
     , gmes_joint_group( robot.get_joints()
                       , 64     // settings.number_of_experts
@@ -307,6 +304,7 @@ public:
     /* utilities */
     , watch()
     , views(4)
+    , latency()
 
     /* graphics */
     , gfx_robot(robot, robot.control.user_target_position)
@@ -335,9 +333,18 @@ public:
         do_pause.disable(); // do not start in pause mode
         fast_forward.enable(); /**TODO why is that needed... cycle time seems to be 3 times as fast*/
 
-        assert(robot.control.user_target_position.size() == supreme::constants::FlatcatMidiMap.size());
-        remote.open_connection(network::hostname_to_ip("flatcat2.local").c_str()/*"192.168.1.106"*/, 7332);
-        remote.send("HELLO\n");
+        if (robot.is_replaying()) {
+            /* no robot to talk to */
+            if (settings.replay_from_cycle > 0)
+                robot.replay->seek(settings.replay_from_cycle);
+        } else {
+            remote.open_connection(network::hostname_to_ip("flatcat2.local").c_str()/*"192.168.1.106"*/, 7332);
+            remote.send("HELLO\n");
+            remote.send("UNT=%u\n", settings.unit_id); /* commands address the observed unit */
+            remote.send("BIN=1\n"); /* stream commands as binary frames */
+            remote.send("DEC=%u\n", settings.subscribe_decimation); /* telemetry every n-th cycle */
+            remote.send("FLD=%s\n", settings.subscribe_fields.c_str());
+        }
         gfx_super_gmes.set_position(0.5,-0.5).set_scale(1.0);
 
 
@@ -356,8 +363,20 @@ public:
     void user_callback_joystick_motion_axis    (SDL_JoyAxisEvent   const& e);
   //void user_callback_joystick_motion_hat     (SDL_JoyHatEvent    const& e);
 
-    void send_control_mode(supreme::ControlMode_t mode) { remote.send("CTL=%u\n", mode); }
-    void send_parameter_id(unsigned id) { remote.send("PAR=%u\n", id); }
+    /* commands reach the robot only when it is live */
+    void send_text(const char* msg) { if (not robot.is_replaying()) remote.send("%s", msg); }
+
+    void send_control_mode(supreme::ControlMode_t mode) { if (not robot.is_replaying()) remote.send("CTL=%u\n", mode); }
+    void send_parameter_id(unsigned id) { if (not robot.is_replaying()) remote.send("PAR=%u\n", id); }
+
+    void append_command(supreme::Command_t cmd, float value, uint8_t index = 0) {
+        if (not robot.is_replaying())
+            remote.append("%s", encoder.encode(cmd, value, index));
+    }
+
+    void learning_cycle(void);
+    void replay_cycles(void);
+    void measure_latency(void);
 
     void save(std::string f) {
         sts_msg("Saving state: %s", settings.save_state_name.c_str());
@@ -377,6 +396,7 @@ private:
     supreme::FlatcatSettings             settings;
     MidiIn                               midi;
     network::Socket_Client               remote;
+    supreme::Binary_Command_Encoder      encoder;
 
     supreme::FlatcatUDPRobot             robot;
     RemoteRobotActions                   actions;
@@ -395,6 +415,7 @@ private:
     /* utilities */
     Stopwatch                            watch;
     View_Manager                         views;
+    supreme::Latency_Monitor             latency;
 
     /* graphics */
     supreme::FlatcatGraphics             gfx_robot;
@@ -409,6 +430,14 @@ private:
     bool                       j_axis_changed = false;
 
     bool connection_status = false;
+    bool replay_finished   = false;
+
+    uint16_t stamped_seq  = static_cast<uint16_t>(-1); /* nothing encoded yet */
+    uint32_t ping_id      = 0;
+    uint64_t last_ping_us = 0;
+
+    /* full speed replay, learning steps between two frames */
+    static const uint64_t replay_frame_budget_ns = 20000000;
 
     float time_passed_ms = 0.f;
 };
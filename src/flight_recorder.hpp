@@ -0,0 +1,351 @@
+#ifndef FLIGHT_RECORDER_HPP
+#define FLIGHT_RECORDER_HPP
+
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <common/log_messages.h>
+
+#include <flatcat_settings.hpp>
+#include <flatcat_telemetry.hpp>
+#include <command_queue.hpp>
+#include <periodic_scheduler.hpp>
+
+/* Flight recorder, persists the state of every unit and cycle on the robot.
+
+   file := header page | record * capacity
+
+   The file is preallocated and holds the records as a ring, the oldest ones
+   are overwritten. A record holds what the telemetry frame holds plus the
+   controller outputs, the user targets, the target mode and the commands
+   applied in that cycle. The header counts the records written, so the
+   newest one is at (written - 1) % capacity, and the records before it
+   that the file holds (valid), usually min(written, capacity).
+
+   The control loop only writes to an anonymous ring in memory of the same
+   layout, populated on start (and locked if rt_enable and rt_lock_memory
+   are set). It never touches file-backed pages, so it cannot fault into
+   the file system. A background thread copies the new records to the file
+   with pwrite once per sync interval, then the header, and syncs the file.
+   If that thread falls behind by a whole ring, it copies all but the slot
+   the loop writes next, which then holds no valid record (valid is one
+   short of the capacity), and the oldest records of the copy may be
+   overwritten meanwhile, counted as overruns.
+
+   Disabled by default. A file left from the previous run is kept as
+   <file>.prev. */
+
+namespace supreme {
+namespace recorder {
+
+const uint32_t magic   = 0x52544346; /* "FCTR" */
+const uint16_t version = 2;
+
+const std::size_t max_commands_per_record = 8;
+const std::size_t header_size             = 4096;
+
+struct Command_Entry_t {
+    Command_t type;
+    uint8_t   index;
+    float     value;
+};
+
+struct Record_t {
+    uint64_t             time_ns;  /* monotonic */
+    telemetry::Records_t state;    /* as in the telemetry frame, header holds unit and cycle */
+
+    std::array<float, constants::max_joints_per_unit> joint_output; /* controller output */
+    std::array<float, constants::max_joints_per_unit> user_target;  /* usr_params */
+
+    ControlMode_t target_mode;
+    uint8_t       number_of_commands;
+    uint16_t      commands_dropped; /* more than max_commands_per_record in this cycle */
+    std::array<Command_Entry_t, max_commands_per_record> commands;
+};
+
+struct File_Header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t layout;          /* telemetry layout of the state records */
+    uint32_t record_size;
+    uint32_t update_rate_Hz;
+    uint32_t number_of_units;
+    uint64_t capacity;        /* records */
+    uint64_t written;         /* records written so far */
+    uint64_t valid;           /* records in the file, ending with record written - 1 */
+    uint64_t start_time_ns;   /* monotonic */
+};
+
+static_assert(std::is_trivially_copyable<Record_t>::value, "Records are written to the file as they are.");
+static_assert(sizeof(File_Header_t) <= header_size, "File header exceeds its page.");
+
+} /* namespace recorder */
+
+
+class Flight_Recorder
+{
+public:
+    Flight_Recorder(FlatcatSettings const& settings)
+    : filename(settings.recorder_file)
+    , sync_interval_ms(settings.recorder_sync_interval_ms)
+    , pending()
+    {
+        if (filename.empty()) {
+            sts_msg("Flight recorder disabled.");
+            return;
+        }
+        const uint64_t capacity = static_cast<uint64_t>(settings.recorder_duration_s)
+                                * settings.update_rate_Hz * settings.number_of_units();
+        if (open_file(capacity)) {
+            file_header.update_rate_Hz  = settings.update_rate_Hz;
+            file_header.number_of_units = settings.number_of_units();
+            write_header();
+            sync_thread = std::thread(&Flight_Recorder::sync_loop, this);
+            sts_msg("Flight recorder: %s, %llu records of %u bytes (%u s)"
+                   , filename.c_str(), (unsigned long long) capacity, (unsigned) sizeof(recorder::Record_t)
+                   , settings.recorder_duration_s);
+        }
+    }
+
+    ~Flight_Recorder() { close(); }
+
+    Flight_Recorder(const Flight_Recorder& other) = delete;
+    Flight_Recorder& operator=(const Flight_Recorder& other) = delete;
+
+    bool is_enabled(void) const { return records != nullptr; }
+
+    /* control loop, remembers a command for the next record of its unit */
+    void note_command(Command const& cmd) {
+        if (not is_enabled() or cmd.unit >= pending.size()) return;
+        Pending_t& p = pending[cmd.unit];
+        if (p.count < recorder::max_commands_per_record)
+            p.commands[p.count++] = { cmd.type, cmd.index, cmd.value };
+        else
+            ++p.dropped;
+    }
+
+    /* control loop, writes the record of one unit in place, no allocation */
+    template <typename Control_t>
+    void record(FlatcatRobot const& flatcat, Control_t const& control, uint64_t cycles)
+    {
+        if (not is_enabled()) return;
+
+        const uint64_t n = written.load(std::memory_order_relaxed);
+        recorder::Record_t& rec = records[n % capacity];
+
+        rec.time_ns = monotonic_time_ns();
+        make_telemetry_records(rec.state, flatcat, control, cycles);
+
+        auto const& joints = flatcat.get_joints();
+        for (std::size_t i = 0; i < joints.size(); ++i) {
+            rec.joint_output[i] = joints[i].motor.get();
+            rec.user_target [i] = control.usr_params[i];
+        }
+        rec.target_mode = control.tar_mode;
+
+        Pending_t& p = pending[flatcat.get_unit_id()];
+        rec.number_of_commands = p.count;
+        rec.commands_dropped   = p.dropped;
+        for (std::size_t i = 0; i < p.count; ++i)
+            rec.commands[i] = p.commands[i];
+        p.count   = 0;
+        p.dropped = 0;
+
+        written.store(n + 1, std::memory_order_release);
+    }
+
+    /* stops the sync thread, flushes everything and closes the file */
+    void close(void)
+    {
+        if (not is_enabled()) return;
+
+        {   std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wakeup.notify_one();
+        if (sync_thread.joinable())
+            sync_thread.join();
+
+        flush();
+        print_statistics();
+
+        munmap(records, capacity * sizeof(recorder::Record_t));
+        ::close(fd);
+        records = nullptr;
+        fd = -1;
+    }
+
+    void print_statistics(void) const {
+        sts_msg("Flight recorder: %llu records written, %llu syncs, max sync %.1f ms, %llu overruns, %llu errors"
+               , (unsigned long long) written.load(), (unsigned long long) syncs, 1e-6 * max_sync_ns
+               , (unsigned long long) overruns, (unsigned long long) errors);
+    }
+
+private:
+    struct Pending_t {
+        std::array<recorder::Command_Entry_t, recorder::max_commands_per_record> commands;
+        uint8_t  count   = 0;
+        uint16_t dropped = 0;
+    };
+
+    bool open_file(uint64_t number_of_records)
+    {
+        if (number_of_records == 0) {
+            wrn_msg("Flight recorder: no capacity, disabled.");
+            return false;
+        }
+        if (access(filename.c_str(), F_OK) == 0 and rename(filename.c_str(), (filename + ".prev").c_str()) != 0)
+            wrn_msg("Flight recorder: could not keep previous file: %s", strerror(errno));
+
+        fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            wrn_msg("Flight recorder: could not open %s: %s, disabled.", filename.c_str(), strerror(errno));
+            return false;
+        }
+
+        const std::size_t ring_size = number_of_records * sizeof(recorder::Record_t);
+        const int err = posix_fallocate(fd, 0, recorder::header_size + ring_size);
+        if (err != 0) {
+            wrn_msg("Flight recorder: could not allocate %llu bytes: %s, disabled.", (unsigned long long) (recorder::header_size + ring_size), strerror(err));
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+
+        void* addr = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (addr == MAP_FAILED) {
+            wrn_msg("Flight recorder: could not allocate the ring: %s, disabled.", strerror(errno));
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+
+        /* touch every page once, so the control loop does not take the first write faults */
+        memset(addr, 0, ring_size);
+
+        records  = static_cast<recorder::Record_t*>(addr);
+        capacity = number_of_records;
+
+        file_header.magic         = recorder::magic;
+        file_header.version       = recorder::version;
+        file_header.layout        = telemetry::layout;
+        file_header.record_size   = sizeof(recorder::Record_t);
+        file_header.capacity      = capacity;
+        file_header.written       = 0;
+        file_header.start_time_ns = monotonic_time_ns();
+        return true;
+    }
+
+    void sync_loop(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (not quit) {
+            wakeup.wait_for(lock, std::chrono::milliseconds(sync_interval_ms));
+            if (quit) break;
+            lock.unlock();
+            flush();
+            lock.lock();
+        }
+    }
+
+    /* copies the records since the last flush to the file and syncs it */
+    void flush(void)
+    {
+        const uint64_t n = written.load(std::memory_order_acquire);
+        if (n == synced) return;
+
+        /* the slot of record n is the next the loop writes, leave it out when a whole ring is new */
+        const bool     whole_ring = (n - synced >= capacity);
+        const uint64_t first      = whole_ring ? n - capacity + 1 : synced;
+
+        const uint64_t t0 = monotonic_time_ns();
+        const uint64_t begin = first % capacity;
+        const uint64_t end   = n     % capacity;
+        if (begin < end)
+            write_range(begin, end);
+        else {
+            write_range(begin, capacity);
+            write_range(0, end);
+        }
+
+        /* the loop went on meanwhile and may have overwritten the oldest ones copied */
+        const uint64_t now_written = written.load(std::memory_order_acquire);
+        if (now_written >= first + capacity)
+            overruns += std::min(now_written - (first + capacity) + 1, n - first);
+
+        file_header.written = n;
+        file_header.valid   = whole_ring ? capacity - 1 : std::min(n, capacity);
+        write_header();
+        if (fdatasync(fd) != 0)
+            ++errors;
+
+        synced = n;
+        ++syncs;
+        max_sync_ns = std::max(max_sync_ns, monotonic_time_ns() - t0);
+    }
+
+    void write_range(uint64_t first, uint64_t last)
+    {
+        if (first >= last) return;
+        write_all(records + first, (last - first) * sizeof(recorder::Record_t)
+                 , recorder::header_size + first * sizeof(recorder::Record_t));
+    }
+
+    void write_header(void) { write_all(&file_header, sizeof(file_header), 0); }
+
+    void write_all(const void* data, std::size_t size, std::size_t offset)
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        while (size > 0) {
+            const ssize_t n = pwrite(fd, p, size, static_cast<off_t>(offset));
+            if (n < 0 and errno == EINTR) continue;
+            if (n <= 0) { ++errors; return; }
+            p += n; offset += n; size -= n;
+        }
+    }
+
+    const std::string filename;
+    const unsigned    sync_interval_ms;
+
+    int         fd       = -1;
+    uint64_t    capacity = 0;
+
+    recorder::Record_t* records = nullptr; /* anonymous ring, written by the control loop */
+
+    /* owned by the control loop */
+    std::array<Pending_t, constants::max_units> pending;
+
+    std::atomic<uint64_t> written{0};
+
+    /* owned by the sync thread */
+    recorder::File_Header_t file_header = {};
+    uint64_t synced      = 0;
+    uint64_t overruns    = 0;
+    uint64_t syncs       = 0;
+    uint64_t max_sync_ns = 0;
+    uint64_t errors      = 0;
+
+    std::thread             sync_thread;
+    std::mutex              mutex;
+    std::condition_variable wakeup;
+    bool                    quit = false;
+};
+
+} /* namespace supreme */
+
+#endif /* FLIGHT_RECORDER_HPP */
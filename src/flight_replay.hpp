@@ -0,0 +1,186 @@
+#ifndef FLIGHT_REPLAY_HPP
+#define FLIGHT_REPLAY_HPP
+
+#include <string>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <common/log_messages.h>
+
+#include <periodic_scheduler.hpp>
+#include <flight_recorder.hpp>
+#include <telemetry_receiver.hpp>
+
+/* Offline replay of a flight recorder file (see flight_recorder.hpp).
+   Feeds FlatcatUDPRobot with the recorded states of one unit, oldest first,
+   one record per update(). Without pacing (speed = 0) every update() yields
+   the next record, so learners run as fast as the CPU allows. With pacing
+   the records are released at speed times the recorded update rate.
+
+   The file is mapped read-only, positions count records in the order they
+   were written, starting with the oldest one still in the ring. */
+
+namespace supreme {
+
+template <typename Motor_t>
+class Flight_Replay : public Telemetry_Source<Motor_t>
+{
+public:
+    typedef Telemetry_State_t<Motor_t> State_t;
+
+    Flight_Replay( std::string const& filename
+                 , uint8_t unit_id
+                 , std::size_t number_of_motors
+                 , double update_rate_Hz
+                 , double speed )
+    : filename(filename)
+    , unit_id(unit_id)
+    , number_of_motors(number_of_motors)
+    , speed(speed)
+    , state(number_of_motors, update_rate_Hz)
+    {
+        open_file();
+        period_ns = (speed > 0) ? 1e9 / (header->update_rate_Hz * speed) : .0;
+        sts_msg("Replaying %s: unit %u, %llu records, cycles %llu..%llu, %s"
+               , filename.c_str(), unit_id, (unsigned long long) count
+               , (unsigned long long) cycles_at(0), (unsigned long long) cycles_at(count > 0 ? count - 1 : 0)
+               , (speed > 0) ? "paced" : "full speed");
+    }
+
+    ~Flight_Replay() {
+        if (mapping != nullptr)
+            munmap(const_cast<uint8_t*>(mapping), mapping_size);
+    }
+
+    Flight_Replay(const Flight_Replay& other) = delete;
+    Flight_Replay& operator=(const Flight_Replay& other) = delete;
+
+    /* next record of the unit, false if it is not due yet or the end is reached */
+    bool update(void)
+    {
+        const uint64_t now = monotonic_time_ns();
+        while (position < count)
+        {
+            recorder::Record_t const& rec = record_at(position);
+            if (rec.state.header.unit_id != unit_id) {
+                ++position;
+                continue;
+            }
+            if (rec.state.header.number_of_motors != number_of_motors) {
+                if (mismatched++ == 0)
+                    wrn_msg("Replay: unit %u has %u motors in the recording, expected %u."
+                           , unit_id, (unsigned) rec.state.header.number_of_motors, (unsigned) number_of_motors);
+                ++position;
+                continue;
+            }
+            if (period_ns > 0) {
+                if (not paced) {
+                    paced        = true;
+                    start_ns     = now;
+                    start_cycles = rec.state.header.cycles;
+                }
+                else if (now < start_ns + static_cast<uint64_t>(period_ns * (rec.state.header.cycles - start_cycles)))
+                    return false; /* not due yet */
+            }
+
+            apply_telemetry_records(state, rec.state);
+            state.arrival_ns = now;
+            state.link.update(rec.state.header.cycles, now / constants::ns_per_us);
+            ++position;
+            ++replayed;
+            return true;
+        }
+        return false;
+    }
+
+    State_t const& get_state(void) const { return state; }
+
+    /* continues with the first record at or after the given cycle */
+    void seek(uint64_t cycles)
+    {
+        uint64_t lo = 0, hi = count;
+        while (lo < hi) {
+            const uint64_t mid = lo + (hi - lo) / 2;
+            if (cycles_at(mid) < cycles) lo = mid + 1;
+            else hi = mid;
+        }
+        position = lo;
+        paced    = false; /* pacing starts over */
+        sts_msg("Replay: seek to cycle %llu, record %llu of %llu"
+               , (unsigned long long) cycles, (unsigned long long) position, (unsigned long long) count);
+    }
+
+    bool     at_end      (void) const { return position >= count; }
+    uint64_t get_position(void) const { return position; }
+    uint64_t get_count   (void) const { return count; }
+    uint64_t get_replayed(void) const { return replayed; }
+
+private:
+    void open_file(void)
+    {
+        const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        assertion(fd >= 0, "Cannot open replay file %s: %s", filename.c_str(), strerror(errno));
+
+        struct stat st;
+        assertion(fstat(fd, &st) == 0 and static_cast<std::size_t>(st.st_size) >= recorder::header_size
+                 , "Replay file %s is too small.", filename.c_str());
+        mapping_size = st.st_size;
+
+        void* addr = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        assertion(addr != MAP_FAILED, "Cannot map replay file %s: %s", filename.c_str(), strerror(errno));
+        madvise(addr, mapping_size, MADV_SEQUENTIAL);
+
+        mapping = static_cast<const uint8_t*>(addr);
+        header  = reinterpret_cast<recorder::File_Header_t const*>(mapping);
+        records = reinterpret_cast<recorder::Record_t const*>(mapping + recorder::header_size);
+
+        assertion(header->magic == recorder::magic, "%s is no flight recorder file.", filename.c_str());
+        assertion(header->version == recorder::version and header->record_size == sizeof(recorder::Record_t)
+                 , "Replay file %s has version %u with %u byte records, expected version %u with %u bytes."
+                 , filename.c_str(), header->version, header->record_size, recorder::version, (unsigned) sizeof(recorder::Record_t));
+        assertion(header->layout == telemetry::layout, "Replay file %s has telemetry layout 0x%04x, expected 0x%04x."
+                 , filename.c_str(), header->layout, telemetry::layout);
+        assertion(recorder::header_size + header->capacity * sizeof(recorder::Record_t) <= mapping_size
+                 , "Replay file %s is truncated.", filename.c_str());
+
+        count  = std::min(header->valid, std::min(header->written, header->capacity));
+        oldest = (header->written - count) % std::max<uint64_t>(header->capacity, 1);
+    }
+
+    recorder::Record_t const& record_at(uint64_t pos) const { return records[(oldest + pos) % header->capacity]; }
+    uint64_t cycles_at(uint64_t pos) const { return (count > 0) ? record_at(pos).state.header.cycles : 0; }
+
+    const std::string filename;
+    const uint8_t     unit_id;
+    const std::size_t number_of_motors;
+    const double      speed;
+
+    const uint8_t*                 mapping      = nullptr;
+    std::size_t                    mapping_size = 0;
+    recorder::File_Header_t const* header       = nullptr;
+    recorder::Record_t const*      records      = nullptr;
+
+    uint64_t count    = 0;
+    uint64_t oldest   = 0;
+    uint64_t position = 0;
+
+    double   period_ns    = .0;
+    bool     paced        = false;
+    uint64_t start_ns     = 0;
+    uint64_t start_cycles = 0;
+    uint64_t replayed     = 0;
+    uint64_t mismatched   = 0;
+
+    State_t state;
+};
+
+} /* namespace supreme */
+
+#endif /* FLIGHT_REPLAY_HPP */
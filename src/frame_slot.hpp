@@ -0,0 +1,94 @@
+#ifndef FRAME_SLOT_HPP
+#define FRAME_SLOT_HPP
+
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include <common/log_messages.h>
+
+#include <triple_buffer.hpp>
+
+namespace supreme {
+
+/* Lock-free single-producer/single-consumer slot for the latest frame.
+   A triple buffer of frames, the producer signals an eventfd after each
+   publish, so the consumer blocks until there is something new to send.
+
+   overwritten: frames replaced by the producer before the consumer took them */
+template <std::size_t MaxSize>
+class Frame_Slot
+{
+public:
+    struct Frame_t {
+        std::array<uint8_t, MaxSize> data;
+        std::size_t size;
+        uint64_t    seq;
+    };
+
+    Frame_Slot()
+    : frames(Frame_t())
+    , event_fd(eventfd(0, EFD_CLOEXEC))
+    {
+        assertion(event_fd >= 0, "Could not create eventfd for frame slot.");
+    }
+
+    ~Frame_Slot() { if (event_fd >= 0) close(event_fd); }
+
+    Frame_Slot(const Frame_Slot& other) = delete;
+    Frame_Slot& operator=(const Frame_Slot& other) = delete;
+
+    /* producer side, called once per cycle */
+    void publish(const uint8_t* data, std::size_t size)
+    {
+        assert(size <= MaxSize);
+        memcpy(acquire(), data, size);
+        commit(size);
+    }
+
+    /* producer side, alternative to publish() for frames assembled in place:
+       fill the buffer returned by acquire(), then commit() the used size */
+    uint8_t* acquire(void) { return frames.write_buffer().data.data(); }
+
+    void commit(std::size_t size)
+    {
+        assert(size <= MaxSize);
+        Frame_t& f = frames.write_buffer();
+        f.size = size;
+        f.seq  = frames.get_published() + 1;
+        frames.publish();
+
+        const uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) != sizeof(one))
+            wrn_msg("Could not signal frame slot.");
+    }
+
+    /* consumer side, blocks until a frame was published or timeout */
+    bool wait_for_frame(int timeout_ms)
+    {
+        struct pollfd pfd = { event_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout_ms) <= 0)
+            return false;
+
+        uint64_t count;
+        return read(event_fd, &count, sizeof(count)) == sizeof(count);
+    }
+
+    /* consumer side, returns the newest frame or nullptr if there is none */
+    Frame_t const* take(void) { return frames.update() ? &frames.read() : nullptr; }
+
+    uint64_t get_published  (void) const { return frames.get_published();   }
+    uint64_t get_overwritten(void) const { return frames.get_overwritten(); }
+
+private:
+    Triple_Buffer<Frame_t> frames;
+    int event_fd;
+};
+
+} /* namespace supreme */
+
+#endif /* FRAME_SLOT_HPP */
@@ -0,0 +1,253 @@
+#ifndef GAIT_LIBRARY_HPP
+#define GAIT_LIBRARY_HPP
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <common/log_messages.h>
+
+#include <so2_controller.hpp>
+
+/* Gait library, parameter sets of the oscillator controllers.
+
+   file := File_Header_t | gait * number_of_gaits
+   gait := float frequency (-1..1) | so2::Params_t * number_of_joints
+
+   A background thread reads the file into a buffer of its own and checks
+   it, a gait is looked up in that buffer, so switching gaits costs nothing
+   but an index. The file is checked every reload interval and read anew
+   when it was replaced or changed. The control loop takes the new buffer
+   over in update(), a pointer exchange, and hands the old one back to the
+   thread to free. Loop and thread never wait for each other, and nothing
+   done to the file afterwards can touch the gaits in use.
+
+   Replace the file by writing a new one and renaming it over the old
+   (e.g. mv). A file rewritten in place may be read half-written, it is
+   rejected if it does not match its header and read again when it
+   changes. */
+
+namespace supreme {
+namespace gait {
+
+const uint32_t magic   = 0x54494147; /* "GAIT" */
+const uint16_t version = 1;
+
+struct File_Header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t number_of_joints;
+    uint32_t number_of_gaits;
+    uint32_t reserved;
+};
+
+inline std::size_t gait_size(std::size_t number_of_joints) {
+    return sizeof(float) + number_of_joints * sizeof(jcl::so2::Params_t);
+}
+
+} /* namespace gait */
+
+
+class Gait_Library
+{
+    struct Gaits_t {
+        std::vector<uint8_t> data;
+        gait::File_Header_t  header;
+    };
+
+public:
+    Gait_Library( std::string const& filename
+                , std::size_t number_of_joints
+                , std::size_t max_number_of_gaits
+                , unsigned reload_interval_ms )
+    : filename(filename)
+    , number_of_joints(number_of_joints)
+    , max_number_of_gaits(max_number_of_gaits)
+    , reload_interval_ms(reload_interval_ms)
+    {
+        check_file();
+        update();
+        if (current == nullptr)
+            sts_msg("No gaits loaded from %s.", filename.c_str());
+        if (reload_interval_ms > 0)
+            watch_thread = std::thread(&Gait_Library::watch_loop, this);
+    }
+
+    ~Gait_Library()
+    {
+        {   std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wakeup.notify_one();
+        if (watch_thread.joinable())
+            watch_thread.join();
+
+        release(pending.exchange(nullptr));
+        release(retired.exchange(nullptr));
+        release(current);
+    }
+
+    Gait_Library(const Gait_Library& other) = delete;
+    Gait_Library& operator=(const Gait_Library& other) = delete;
+
+    /* control loop, takes a reloaded file over, returns true if so */
+    bool update(void)
+    {
+        if (retired.load(std::memory_order_acquire) != nullptr)
+            return false; /* the thread did not release the previous one yet */
+
+        Gaits_t* next = pending.exchange(nullptr, std::memory_order_acq_rel);
+        if (next == nullptr)
+            return false;
+
+        retired.store(current, std::memory_order_release);
+        current = next;
+        ++generation;
+        return true;
+    }
+
+    std::size_t size(void) const { return (current != nullptr) ? current->header.number_of_gaits : 0; }
+
+    /* counts the files taken over */
+    uint64_t get_generation(void) const { return generation; }
+
+    float get_frequency(std::size_t id) const {
+        float f;
+        memcpy(&f, gait_data(id), sizeof(f));
+        return f;
+    }
+
+    jcl::so2::Params_t get_params(std::size_t id, std::size_t joint) const {
+        assert(joint < number_of_joints);
+        jcl::so2::Params_t p;
+        memcpy(&p, gait_data(id) + sizeof(float) + joint * sizeof(p), sizeof(p));
+        return p;
+    }
+
+private:
+    const uint8_t* gait_data(std::size_t id) const {
+        assert(id < size());
+        return current->data.data() + sizeof(gait::File_Header_t) + id * gait::gait_size(number_of_joints);
+    }
+
+    void watch_loop(void)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (not quit) {
+            wakeup.wait_for(lock, std::chrono::milliseconds(reload_interval_ms));
+            if (quit) break;
+            lock.unlock();
+            release(retired.exchange(nullptr, std::memory_order_acq_rel));
+            check_file();
+            lock.lock();
+        }
+    }
+
+    /* reads the file if it changed since the last check */
+    void check_file(void)
+    {
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0) {
+            file_known = false;
+            return;
+        }
+        if (file_known and st.st_ino == file_stat.st_ino and st.st_size == file_stat.st_size
+            and st.st_mtim.tv_sec == file_stat.st_mtim.tv_sec and st.st_mtim.tv_nsec == file_stat.st_mtim.tv_nsec)
+            return;
+        file_stat  = st;
+        file_known = true;
+
+        Gaits_t* gaits = read_file();
+        if (gaits == nullptr) return;
+
+        sts_msg("%s gaits from %s: %u sets for %u joints.", (files_read++ > 0) ? "Reloaded" : "Loaded"
+               , filename.c_str(), gaits->header.number_of_gaits, gaits->header.number_of_joints);
+
+        /* one not taken over yet was never seen by the loop */
+        release(pending.exchange(gaits, std::memory_order_acq_rel));
+    }
+
+    Gaits_t* read_file(void)
+    {
+        const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            wrn_msg("Cannot open gait file %s: %s", filename.c_str(), strerror(errno));
+            return nullptr;
+        }
+        Gaits_t* gaits = new Gaits_t();
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            gaits->data.resize(st.st_size);
+            std::size_t got = 0;
+            while (got < gaits->data.size()) {
+                const ssize_t n = read(fd, gaits->data.data() + got, gaits->data.size() - got);
+                if (n < 0 and errno == EINTR) continue;
+                if (n <= 0) break;
+                got += n;
+            }
+            gaits->data.resize(got);
+        }
+        ::close(fd);
+
+        if (gaits->data.size() < sizeof(gait::File_Header_t)) {
+            wrn_msg("Gait file %s is too small.", filename.c_str());
+            delete gaits;
+            return nullptr;
+        }
+        memcpy(&gaits->header, gaits->data.data(), sizeof(gait::File_Header_t));
+
+        const char* error = nullptr;
+        auto const& h = gaits->header;
+        if (h.magic != gait::magic or h.version != gait::version)
+            error = "is no gait file of this version";
+        else if (h.number_of_joints != number_of_joints)
+            error = "is for another number of joints";
+        else if (h.number_of_gaits == 0 or h.number_of_gaits > max_number_of_gaits)
+            error = "has no or more than max_number_of_gaits gaits";
+        else if (gaits->data.size() != sizeof(gait::File_Header_t) + h.number_of_gaits * gait::gait_size(number_of_joints))
+            error = "does not match its header in size";
+
+        if (error != nullptr) {
+            wrn_msg("Gait file %s %s, kept the gaits loaded before.", filename.c_str(), error);
+            delete gaits;
+            return nullptr;
+        }
+        return gaits;
+    }
+
+    static void release(Gaits_t* gaits) { delete gaits; }
+
+    const std::string filename;
+    const std::size_t number_of_joints;
+    const std::size_t max_number_of_gaits;
+    const unsigned    reload_interval_ms;
+
+    Gaits_t*                current    = nullptr;  /* owned by the control loop */
+    uint64_t                generation = 0;
+    std::atomic<Gaits_t*>   pending{nullptr};      /* read, not yet taken over */
+    std::atomic<Gaits_t*>   retired{nullptr};      /* taken over, to be freed */
+
+    struct stat             file_stat;      /* watching side */
+    bool                    file_known   = false;
+    unsigned                files_read   = 0;
+
+    std::thread             watch_thread;
+    std::mutex              mutex;
+    std::condition_variable wakeup;
+    bool                    quit = false;
+};
+
+} /* namespace supreme */
+
+#endif /* GAIT_LIBRARY_HPP */
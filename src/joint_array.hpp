@@ -0,0 +1,119 @@
+#ifndef JOINT_ARRAY_HPP
+#define JOINT_ARRAY_HPP
+
+#include <array>
+#include <vector>
+#include <cassert>
+#include <utility>
+
+/* Per-joint storage and loops for the control path, specialized on the
+   number of joints at compile time. NumJoints = dynamic_joints selects
+   the runtime-sized variant (std::vector, plain loop), any other value
+   a std::array with loops unrolled by the compiler.
+   Element access is unchecked, asserted only in debug builds. */
+
+namespace supreme {
+
+const std::size_t dynamic_joints = 0;
+
+namespace detail {
+
+    template <std::size_t... I> struct index_list {};
+
+    template <std::size_t N, std::size_t... I>
+    struct make_index_list : make_index_list<N - 1, N - 1, I...> {};
+
+    template <std::size_t... I>
+    struct make_index_list<0, I...> { typedef index_list<I...> type; };
+
+    template <typename T, typename Make_fn, std::size_t... I>
+    std::array<T, sizeof...(I)> make_array(Make_fn& make, index_list<I...>) { return {{ make(I)... }}; }
+
+    template <std::size_t I, std::size_t N>
+    struct Unrolled {
+        template <typename Fn> static void apply(Fn& fn) { fn(I); Unrolled<I + 1, N>::apply(fn); }
+    };
+
+    template <std::size_t N>
+    struct Unrolled<N, N> {
+        template <typename Fn> static void apply(Fn&) {}
+    };
+
+} /* namespace detail */
+
+
+/* calls fn(i) for every joint index i */
+template <std::size_t NumJoints>
+struct Joint_Loop {
+    template <typename Fn>
+    static void apply(std::size_t number_of_joints, Fn&& fn) {
+        assert(number_of_joints == NumJoints); (void) number_of_joints;
+        detail::Unrolled<0, NumJoints>::apply(fn);
+    }
+};
+
+template <>
+struct Joint_Loop<dynamic_joints> {
+    template <typename Fn>
+    static void apply(std::size_t number_of_joints, Fn&& fn) {
+        for (std::size_t i = 0; i < number_of_joints; ++i) fn(i);
+    }
+};
+
+
+/* elements are created with make(i), so they need not be default-constructible */
+template <typename T, std::size_t NumJoints>
+class Joint_Array
+{
+public:
+    template <typename Make_fn>
+    Joint_Array(std::size_t number_of_joints, Make_fn make)
+    : elements(detail::make_array<T>(make, typename detail::make_index_list<NumJoints>::type()))
+    {
+        assert(number_of_joints == NumJoints); (void) number_of_joints;
+    }
+
+    static constexpr std::size_t size(void) { return NumJoints; }
+
+    T const& operator[](std::size_t i) const { assert(i < NumJoints); return elements[i]; }
+    T      & operator[](std::size_t i)       { assert(i < NumJoints); return elements[i]; }
+
+    typename std::array<T, NumJoints>::const_iterator begin(void) const { return elements.begin(); }
+    typename std::array<T, NumJoints>::const_iterator end  (void) const { return elements.end();   }
+    typename std::array<T, NumJoints>::iterator       begin(void)       { return elements.begin(); }
+    typename std::array<T, NumJoints>::iterator       end  (void)       { return elements.end();   }
+
+private:
+    std::array<T, NumJoints> elements;
+};
+
+template <typename T>
+class Joint_Array<T, dynamic_joints>
+{
+public:
+    template <typename Make_fn>
+    Joint_Array(std::size_t number_of_joints, Make_fn make)
+    : elements()
+    {
+        elements.reserve(number_of_joints);
+        for (std::size_t i = 0; i < number_of_joints; ++i)
+            elements.emplace_back(make(i));
+    }
+
+    std::size_t size(void) const { return elements.size(); }
+
+    T const& operator[](std::size_t i) const { assert(i < elements.size()); return elements[i]; }
+    T      & operator[](std::size_t i)       { assert(i < elements.size()); return elements[i]; }
+
+    typename std::vector<T>::const_iterator begin(void) const { return elements.begin(); }
+    typename std::vector<T>::const_iterator end  (void) const { return elements.end();   }
+    typename std::vector<T>::iterator       begin(void)       { return elements.begin(); }
+    typename std::vector<T>::iterator       end  (void)       { return elements.end();   }
+
+private:
+    std::vector<T> elements;
+};
+
+} /* namespace supreme */
+
+#endif /* JOINT_ARRAY_HPP */
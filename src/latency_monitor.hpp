@@ -0,0 +1,94 @@
+#ifndef LATENCY_MONITOR_HPP
+#define LATENCY_MONITOR_HPP
+
+#include <array>
+#include <cstdint>
+
+#include <common/log_messages.h>
+
+#include <cycle_timing.hpp>
+#include <clock_sync.hpp>
+
+/* End-to-end latencies as seen by a terminal, robot times are taken to
+   the terminal's clock with the current clock estimate:
+
+     sensor-to-screen    : bus transaction which read a sample (sample_us)
+                           until the terminal shows it the first time
+     command-to-actuator : sending a binary command until the bus transaction
+                           which carried its outputs to the motors (actuated_us)
+
+   Both keep mean, max and 99th percentile over the last Phase_Timer::window
+   samples, updated every few samples, since commands are sparse.
+   Nothing is measured before the clock is synchronized. */
+
+namespace supreme {
+
+class Latency_Monitor
+{
+public:
+    /* remembers when a binary command left, by its seq */
+    void command_sent(uint16_t seq, uint64_t local_us) {
+        Sent_t& s = sent[seq % sent.size()];
+        s.valid    = true;
+        s.seq      = seq;
+        s.local_us = local_us;
+    }
+
+    /* a new sample is shown */
+    void sample_shown(uint64_t cycles, uint64_t sample_us, Clock_Estimate_t const& clock, uint64_t now_us) {
+        if (not clock.valid or sample_us == 0 or cycles == last_shown)
+            return;
+        last_shown = cycles;
+        sensor_to_screen.add_sample(elapsed_ns(clock.to_local_us(sample_us), now_us));
+    }
+
+    /* the robot echoed the last command actuated */
+    void command_echoed(uint16_t seq, uint64_t actuated_us, Clock_Estimate_t const& clock) {
+        if (not clock.valid or actuated_us == 0 or actuated_us == last_actuated_us)
+            return;
+        last_actuated_us = actuated_us;
+        Sent_t& s = sent[seq % sent.size()];
+        if (not s.valid or s.seq != seq)
+            return; /* not ours, or too old */
+        s.valid = false;
+        command_to_actuator.add_sample(elapsed_ns(s.local_us, clock.to_local_us(actuated_us)));
+    }
+
+    Timing_Stats_t const& get_sensor_to_screen   (void) const { return sensor_to_screen.get_stats();    }
+    Timing_Stats_t const& get_command_to_actuator(void) const { return command_to_actuator.get_stats(); }
+
+    void print_statistics(Clock_Estimate_t const& clock) const {
+        sts_msg("Clock: offset %.0f us, drift %.2f ppm, round trip %.0f us, %llu samples%s"
+               , clock.offset_us, clock.drift_ppm, clock.delay_us, (unsigned long long) clock.samples
+               , clock.valid ? "" : " (not synchronized)");
+        print_stats("sensor-to-screen   ", get_sensor_to_screen());
+        print_stats("command-to-actuator", get_command_to_actuator());
+    }
+
+private:
+    struct Sent_t {
+        bool     valid    = false;
+        uint16_t seq      = 0;
+        uint64_t local_us = 0;
+    };
+
+    /* negative latencies are estimation errors, counted as zero */
+    static uint64_t elapsed_ns(uint64_t from_us, uint64_t to_us) {
+        return (to_us > from_us) ? (to_us - from_us) * constants::ns_per_us : 0;
+    }
+
+    static void print_stats(const char* name, Timing_Stats_t const& s) {
+        sts_msg("Latency %s: mean %8.1f us, p99 %8.1f us, max %8.1f us", name, s.mean_us, s.p99_us, s.max_us);
+    }
+
+    std::array<Sent_t, 256> sent;
+    uint64_t last_shown       = 0;
+    uint64_t last_actuated_us = 0;
+
+    Phase_Timer sensor_to_screen    = Phase_Timer(/*update_interval=*/16);
+    Phase_Timer command_to_actuator = Phase_Timer(/*update_interval=*/4);
+};
+
+} /* namespace supreme */
+
+#endif /* LATENCY_MONITOR_HPP */
@@ -0,0 +1,173 @@
+#ifndef PERIODIC_SCHEDULER_HPP
+#define PERIODIC_SCHEDULER_HPP
+
+#include <time.h>
+#include <errno.h>
+#include <array>
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+#include <common/log_messages.h>
+
+namespace supreme {
+
+namespace constants {
+    const uint64_t ns_per_sec = 1000*1000*1000;
+    const uint64_t ns_per_us  = 1000;
+}
+
+inline uint64_t monotonic_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * constants::ns_per_sec + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+/* what to do when a cycle took longer than one period:
+    catch_up: keep the deadline grid, run missed cycles back to back.
+    skip    : drop missed cycles and continue at the next grid point. */
+enum class OverrunPolicy_t : uint8_t { catch_up, skip };
+
+inline OverrunPolicy_t overrun_policy_from_string(std::string const& str) {
+    if (str == "skip") return OverrunPolicy_t::skip;
+    if (str != "catchup") wrn_msg("Unknown overrun policy '%s', using 'catchup'.", str.c_str());
+    return OverrunPolicy_t::catch_up;
+}
+
+
+/* wake-up latency histogram with power-of-two bins in microseconds,
+   bin 0 = [0,1)us, bin k = [2^(k-1), 2^k)us, last bin collects the rest.
+   Counters are atomic, so other threads may query while the loop runs. */
+class Jitter_Histogram
+{
+public:
+    static const unsigned num_bins = 20;
+
+    void add_sample(uint64_t latency_ns) {
+        const uint64_t us = latency_ns / constants::ns_per_us;
+        unsigned k = 0;
+        while (k < num_bins - 1 and (1ull << k) <= us) ++k;
+        bins[k].fetch_add(1, std::memory_order_relaxed);
+
+        if (latency_ns > maxv.load(std::memory_order_relaxed))
+            maxv.store(latency_ns, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t get_bin  (unsigned k) const { return bins[k].load(std::memory_order_relaxed); }
+    uint64_t get_total(void)       const { return total  .load(std::memory_order_relaxed); }
+    uint64_t get_max  (void)       const { return maxv   .load(std::memory_order_relaxed); }
+
+    void reset(void) {
+        for (auto& b : bins) b.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        maxv .store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, num_bins> bins = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> maxv{0};
+};
+
+
+/* Periodic main loop timing with absolute deadlines on CLOCK_MONOTONIC,
+   slow cycles do not shift the following ones. Unpaced, it never sleeps
+   (e.g. to run the simulation faster than real time). */
+class Periodic_Scheduler
+{
+public:
+    Periodic_Scheduler(unsigned rate_Hz, OverrunPolicy_t policy, bool paced = true)
+    : period_ns(constants::ns_per_sec / (rate_Hz > 0 ? rate_Hz : 1))
+    , policy(policy)
+    , paced(paced)
+    , deadline_ns(0)
+    , histogram()
+    {
+        assertion(rate_Hz > 0, "Update rate must be greater than zero.");
+        sts_msg("Periodic scheduler: %u Hz (%u us), overrun policy: %s"
+               , rate_Hz, (unsigned) (period_ns/constants::ns_per_us)
+               , (policy == OverrunPolicy_t::skip) ? "skip" : "catchup");
+        if (not paced) wrn_msg("Scheduler is free running, no real-time pacing.");
+    }
+
+    void start(void) { deadline_ns = monotonic_time_ns() + period_ns; }
+
+    /* sleeps until the next deadline, returns false if the last cycle overran */
+    bool wait_for_next_cycle(void)
+    {
+        if (not paced) return true;
+        if (deadline_ns == 0) start();
+
+        bool in_time = true;
+        uint64_t now = monotonic_time_ns();
+
+        if (now >= deadline_ns) {
+            in_time = false;
+            const uint64_t behind = (now - deadline_ns) / period_ns; /* number of missed cycles */
+            overruns.fetch_add(1, std::memory_order_relaxed);
+
+            if (policy == OverrunPolicy_t::skip or behind >= max_catch_up_cycles) {
+                deadline_ns += (behind + 1) * period_ns; /* re-align to the grid */
+                skipped.fetch_add(behind + 1, std::memory_order_relaxed);
+            } else {
+                histogram.add_sample(now - deadline_ns);
+                deadline_ns += period_ns; /* run immediately, keep the grid */
+                return in_time;
+            }
+        }
+
+        struct timespec ts;
+        ts.tv_sec  = deadline_ns / constants::ns_per_sec;
+        ts.tv_nsec = deadline_ns % constants::ns_per_sec;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) { /* retry */ }
+
+        histogram.add_sample(monotonic_time_ns() - deadline_ns);
+        deadline_ns += period_ns;
+        return in_time;
+    }
+
+    uint64_t get_period_ns(void) const { return period_ns; }
+    uint64_t get_overruns (void) const { return overruns.load(std::memory_order_relaxed); }
+    uint64_t get_skipped  (void) const { return skipped .load(std::memory_order_relaxed); }
+
+    Jitter_Histogram const& get_histogram(void) const { return histogram; }
+
+    void reset_statistics(void) {
+        histogram.reset();
+        overruns.store(0, std::memory_order_relaxed);
+        skipped .store(0, std::memory_order_relaxed);
+    }
+
+    void print_statistics(void) const
+    {
+        typedef unsigned long long ull;
+        sts_msg("Scheduler: %llu cycles, %llu overruns, %llu skipped, max. latency %llu us"
+               , (ull) histogram.get_total(), (ull) get_overruns(), (ull) get_skipped()
+               , (ull) histogram.get_max()/constants::ns_per_us);
+        for (unsigned k = 0; k < Jitter_Histogram::num_bins; ++k) {
+            const uint64_t count = histogram.get_bin(k);
+            if (count == 0) continue;
+            if (k < Jitter_Histogram::num_bins - 1)
+                sts_msg("  < %7llu us: %llu", 1ull << k, (ull) count);
+            else
+                sts_msg(" >= %7llu us: %llu", 1ull << (k-1), (ull) count);
+        }
+    }
+
+private:
+    static const uint64_t max_catch_up_cycles = 10;
+
+    const uint64_t        period_ns;
+    const OverrunPolicy_t policy;
+    const bool            paced;
+    uint64_t              deadline_ns;
+
+    Jitter_Histogram      histogram;
+    std::atomic<uint64_t> overruns{0};
+    std::atomic<uint64_t> skipped{0};
+};
+
+} /* namespace supreme */
+
+#endif /* PERIODIC_SCHEDULER_HPP */
@@ -0,0 +1,165 @@
+#ifndef REALTIME_PROFILE_HPP
+#define REALTIME_PROFILE_HPP
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <string>
+#include <thread>
+#include <cstdlib>
+#include <algorithm>
+
+#include <common/log_messages.h>
+#include <flatcat_settings.hpp>
+
+/* Real-time execution profile for the control loop:
+    + SCHED_FIFO for the main loop at a configurable priority
+    + main loop pinned to its own (ideally isolated) core,
+      communication and background threads pinned to the remaining ones
+    + all memory locked, stack prefaulted
+   Every step that fails (e.g. missing CAP_SYS_NICE/CAP_IPC_LOCK or
+   RLIMIT_MEMLOCK) is reported and skipped, the loop then continues
+   with normal scheduling. */
+
+namespace supreme {
+namespace realtime {
+
+const std::size_t prefault_stack_size = 512*1024;
+
+/* parses cpu lists like "3" or "0,1" or "0-2" */
+inline bool parse_cpu_list(std::string const& str, cpu_set_t& cpus)
+{
+    CPU_ZERO(&cpus);
+    const char* p = str.c_str();
+    bool any = false;
+    while (*p) {
+        char* end;
+        const long lo = strtol(p, &end, 10);
+        if (end == p or lo < 0 or lo >= CPU_SETSIZE) return false;
+        long hi = lo;
+        p = end;
+        if (*p == '-') {
+            hi = strtol(p + 1, &end, 10);
+            if (end == p + 1 or hi < lo or hi >= CPU_SETSIZE) return false;
+            p = end;
+        }
+        for (long c = lo; c <= hi; ++c) CPU_SET(c, &cpus);
+        any = true;
+        if (*p == ',') ++p;
+        else if (*p != '\0') return false;
+    }
+    return any;
+}
+
+inline bool pin_thread(pthread_t thread, std::string const& cpu_list, const char* name)
+{
+    if (cpu_list.empty()) return false;
+
+    cpu_set_t cpus;
+    if (not parse_cpu_list(cpu_list, cpus)) {
+        wrn_msg("Invalid cpu list '%s' for %s thread, not pinned.", cpu_list.c_str(), name);
+        return false;
+    }
+    const int err = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+    if (err != 0) {
+        wrn_msg("Cannot pin %s thread to cpu(s) %s: %s", name, cpu_list.c_str(), strerror(err));
+        return false;
+    }
+    sts_msg("Pinned %s thread to cpu(s) %s.", name, cpu_list.c_str());
+    return true;
+}
+
+inline bool set_fifo_priority(pthread_t thread, int priority, const char* name)
+{
+    const int lo = sched_get_priority_min(SCHED_FIFO);
+    const int hi = sched_get_priority_max(SCHED_FIFO);
+    struct sched_param param;
+    param.sched_priority = std::min(std::max(priority, lo), hi);
+
+    const int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    if (err != 0) {
+        wrn_msg("Cannot set SCHED_FIFO priority %d for %s thread: %s%s", param.sched_priority, name, strerror(err)
+               , (err == EPERM) ? " (needs root or CAP_SYS_NICE), continuing with normal scheduling" : "");
+        return false;
+    }
+    sts_msg("Running %s thread with SCHED_FIFO priority %d.", name, param.sched_priority);
+    return true;
+}
+
+inline bool lock_memory(void)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        const int err = errno;
+        wrn_msg("Cannot lock memory: %s%s", strerror(err)
+               , (err == EPERM or err == ENOMEM) ? " (needs CAP_IPC_LOCK or a higher RLIMIT_MEMLOCK), page faults may occur" : "");
+        return false;
+    }
+    sts_msg("Locked all current and future memory.");
+    return true;
+}
+
+/* touch the stack once, so the pages are mapped before the loop starts */
+__attribute__((noinline)) inline void prefault_stack(void)
+{
+    volatile unsigned char dummy[prefault_stack_size];
+    for (std::size_t i = 0; i < prefault_stack_size; i += 4096)
+        dummy[i] = 0;
+    (void) dummy[0];
+}
+
+
+class Profile
+{
+public:
+    Profile(FlatcatSettings const& settings)
+    : enabled     (settings.rt_enable      )
+    , priority    (settings.rt_priority    )
+    , control_cpus(settings.rt_control_cpus)
+    , comm_cpus   (settings.rt_comm_cpus   )
+    , lock_mem    (settings.rt_lock_memory )
+    {
+        if (not enabled) {
+            sts_msg("Real-time profile disabled.");
+            return;
+        }
+        /* threads inherit the affinity of the thread starting them, so the background
+           threads started from here on (flight recorder, gait library) run on the
+           communication cpus too, until apply_to_control_thread() moves this one */
+        pin_thread(pthread_self(), comm_cpus, "startup");
+    }
+
+    /* locks the memory of the threads already running as well as all future allocations */
+    void lock_and_prefault(void) {
+        if (not enabled or not lock_mem) return;
+        if (lock_memory())
+            prefault_stack();
+    }
+
+    void apply_to_communication_thread(std::thread& thread, const char* name) {
+        if (not enabled) return;
+        pin_thread(thread.native_handle(), comm_cpus, name);
+    }
+
+    /* call from the control loop thread itself */
+    void apply_to_control_thread(void) {
+        if (not enabled) return;
+        pin_thread(pthread_self(), control_cpus, "control");
+        set_fifo_priority(pthread_self(), priority, "control");
+    }
+
+private:
+    const bool        enabled;
+    const int         priority;
+    const std::string control_cpus;
+    const std::string comm_cpus;
+    const bool        lock_mem;
+};
+
+} /* namespace realtime */
+} /* namespace supreme */
+
+#endif /* REALTIME_PROFILE_HPP */
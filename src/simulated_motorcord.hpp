@@ -0,0 +1,178 @@
+#ifndef SIMULATED_MOTORCORD_HPP
+#define SIMULATED_MOTORCORD_HPP
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <cassert>
+
+#include <common/log_messages.h>
+#include <common/modules.h>
+
+/* Simulated stand-in for supreme::motorcord, selected at compile time
+   with FLATCAT_SIMULATION. Every joint is a geared DC motor driving a
+   body segment:
+
+     i = (U - ke*w) / R
+     J dw/dt = kt*i - b*w - c*sgn(w) - m*g*l*sin(q)
+     Cth dT/dt = R*i^2 - (T - Tamb)/Rth
+
+   integrated with semi-implicit Euler in sub-steps. execute_cycle()
+   never blocks, so the loop runs as fast as the scheduler allows. */
+
+namespace supreme {
+namespace sim {
+
+enum class Controller_t : uint8_t { none, voltage };
+
+struct Motor_Params_t {
+    float resistance    = 2.5f;   /* Ohm              */
+    float k_motor       = 0.6f;   /* Nm/A = Vs/rad, after gearbox */
+    float inertia       = 0.01f;  /* kg m^2           */
+    float friction_visc = 0.05f;  /* Nm s/rad         */
+    float friction_coul = 0.05f;  /* Nm               */
+    float gravity_load  = 0.3f;   /* m*g*l in Nm      */
+    float angle_limit   = 0.8f;   /* mechanical stop in units of pi */
+    float supply        = 12.0f;  /* V                */
+    float heat_capacity = 20.0f;  /* J/K              */
+    float heat_resist   = 5.0f;   /* K/W              */
+    float ambient       = 25.0f;  /* deg C            */
+};
+
+/* same field names as the hardware interface data */
+struct Motor_Data_t {
+    uint8_t id             = 0;
+    float   position       = .0f;
+    float   last_p         = .0f;
+    float   velocity       = .0f;
+    float   current        = .0f;
+    float   voltage_supply = .0f;
+    float   output_voltage = .0f;
+    float   temperature    = .0f;
+};
+
+
+class Motor
+{
+public:
+    Motor(uint8_t id, Motor_Params_t const& params)
+    : params(params)
+    , data()
+    , temperature(params.ambient)
+    {
+        data.id = id;
+        data.voltage_supply = params.supply;
+        data.temperature    = params.ambient;
+    }
+
+    uint8_t get_id(void) const { return data.id; }
+    Motor_Data_t const& get_data(void) const { return data; }
+
+    void set_target_voltage(double v) { target_voltage = clip(static_cast<float>(v), voltage_limit); }
+    void set_voltage_limit (float lim) { voltage_limit = clip(lim, 0.f, 1.f); }
+    void set_controller_type(Controller_t type) { controller = type; }
+
+    void set_direction  (int16_t d) { dir   = (d < 0) ? -1 : +1; }
+    void set_scalefactor(double  s) { scale = static_cast<float>(s); }
+    void set_offset     (float   o) { offset = o; }
+    void add_offset     (float   o) { offset += o; }
+    float get_offset    (void) const { return offset; }
+
+    void step(float dt, unsigned substeps)
+    {
+        const Motor_Params_t& p = params;
+        const float u = (controller == Controller_t::voltage) ? dir * target_voltage * p.supply : .0f;
+        const float h = dt / substeps;
+        float i = .0f;
+
+        for (unsigned s = 0; s < substeps; ++s)
+        {
+            i = (u - p.k_motor * w) / p.resistance;
+            const float drive = p.k_motor * i - p.gravity_load * sinf(q);
+
+            if (w == .0f and fabsf(drive) <= p.friction_coul)
+                continue; /* sticking */
+
+            const float sgn = (w > .0f) ? 1.f : (w < .0f) ? -1.f : (drive > .0f ? 1.f : -1.f);
+            const float torque = drive - p.friction_visc * w - p.friction_coul * sgn;
+            const float w_next = w + h * torque / p.inertia;
+
+            /* coulomb friction must not reverse the motion within one step */
+            w = (w != .0f and w * w_next < .0f) ? .0f : w_next;
+            q += h * w;
+
+            const float qmax = p.angle_limit * M_PI;
+            if (q > +qmax) { q = +qmax; w = std::min(w, .0f); }
+            if (q < -qmax) { q = -qmax; w = std::max(w, .0f); }
+        }
+
+        temperature += dt * (p.resistance * i * i - (temperature - p.ambient) / p.heat_resist) / p.heat_capacity;
+
+        data.last_p         = data.position;
+        data.position       = dir * scale * q / M_PI + offset;
+        data.velocity       = dir * scale * w / M_PI;
+        data.current        = fabsf(i);
+        data.output_voltage = (controller == Controller_t::voltage) ? target_voltage : .0f;
+        data.temperature    = temperature;
+    }
+
+private:
+    Motor_Params_t const& params;
+    Motor_Data_t data;
+
+    Controller_t controller = Controller_t::none;
+    float target_voltage = .0f;
+    float voltage_limit  = 1.f;
+
+    int   dir    = +1;
+    float scale  = 1.f;
+    float offset = .0f;
+
+    float q = .0f; /* angle, rad    */
+    float w = .0f; /* speed, rad/s  */
+    float temperature;
+};
+
+
+class motorcord
+{
+public:
+    motorcord(unsigned number_of_motors, float update_rate_Hz, bool verbose)
+    : params()
+    , motors()
+    , dt(1.f / update_rate_Hz)
+    {
+        motors.reserve(number_of_motors);
+        for (unsigned i = 0; i < number_of_motors; ++i)
+            motors.emplace_back(i, params);
+        if (verbose) sts_msg("Created simulated motorcord with %u motors.", number_of_motors);
+    }
+
+    /* the motors refer to params, a copy would leave them with the original's */
+    motorcord(const motorcord& other) = delete;
+    motorcord& operator=(const motorcord& other) = delete;
+
+    std::size_t size(void) const { return motors.size(); }
+
+    Motor const& operator[](std::size_t i) const { assert(i < motors.size()); return motors[i]; }
+    Motor      & operator[](std::size_t i)       { assert(i < motors.size()); return motors[i]; }
+
+    void execute_cycle(void) {
+        for (auto& m : motors)
+            m.step(dt, substeps);
+    }
+
+    Motor_Params_t& set_params(void) { return params; }
+
+private:
+    static const unsigned substeps = 10;
+
+    Motor_Params_t     params;
+    std::vector<Motor> motors;
+    const float        dt;
+};
+
+} /* namespace sim */
+} /* namespace supreme */
+
+#endif /* SIMULATED_MOTORCORD_HPP */
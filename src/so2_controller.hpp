@@ -2,9 +2,12 @@
 #define SO2_CONTROLLER_HPP_INCLUDED
 
 #include <math.h>
+#include <vector>
 #include <common/modules.h>
 #include <robots/robot.h>
 #include <controller/csl_control.hpp>
+#include <joint_array.hpp>
+#include <so2_oscillator.hpp>
 
 namespace jcl {
 
@@ -19,118 +22,116 @@ namespace so2 {
         float maxv;
     };
 
-    const unsigned num_joints = 3;
-
     const float max_val = 0.25f;
     const float preamp = 2.f;
+    const float phase_per_joint = 60.f; /* travelling wave from head to tail */
 
-    /*                             pctrl |   off |  amp | phase |  min |  max | joint name */
-    Params_t pset[num_joints] = { {  0.5 ,  0.00 ,  0.2 ,     0 , -1.0 , +1.0 } // 0 head
-                                , {  0.5 ,  0.00 ,  0.2 ,    60 , -1.0 , +1.0 } // 1 body
-                                , {  0.5 ,  0.00 ,  0.2 ,   120 , -1.0 , +1.0 } // 2 tail
+    /* same parameters for all joints, phase shifted along the body:
+       head 0, body 60, tail 120 degrees for the three-segment flatcat */
+    inline Params_t default_params(unsigned joint_index) {
+        /*               pctrl |   off |  amp | phase                                      |  min |  max */
+        return Params_t{ 0.5f  , 0.00f , 0.2f , fmodf(phase_per_joint * joint_index, 360.f), -1.f , +1.f };
+    }
 
-                                };
+    /* linear from a (m = 0) to b (m = 1), the phase along the shorter way round */
+    inline Params_t blend(Params_t const& a, Params_t const& b, float m) {
+        float dphs = fmodf(b.phs - a.phs, 360.f);
+        if      (dphs >  180.f) dphs -= 360.f;
+        else if (dphs < -180.f) dphs += 360.f;
+        return Params_t{ a.pctrl + m*(b.pctrl - a.pctrl)
+                       , a.off   + m*(b.off   - a.off  )
+                       , a.amp   + m*(b.amp   - a.amp  )
+                       , a.phs   + m*dphs
+                       , a.minv  + m*(b.minv  - a.minv )
+                       , a.maxv  + m*(b.maxv  - a.maxv ) };
+    }
 
 }
 
 
+template <std::size_t NumJoints>
 class SO2_Controller {
 
-    typedef std::array<float, so2::num_joints> UserParameter_t;
+    typedef supreme::Joint_Array<float                , NumJoints> UserParameter_t;
+    typedef supreme::Joint_Array<supreme::csl_control , NumJoints> Controls_t;
+    typedef supreme::Joint_Array<so2::Params_t        , NumJoints> Parameters_t;
 
 
     robots::Robot_Interface& robot;
-    std::vector<supreme::csl_control>& controls;
+    Controls_t& controls;
     UserParameter_t const& usr_params;
+    Parameters_t pset;
 
-    float x1 = .001f;
-    float x2 = .0f;
-
-    float w11 = .0f;
-    float w12 = .0f;
-    float w21 = .0f;
-    float w22 = .0f;
+    /* cos and sin of the constant phase of each joint */
+    supreme::Joint_Array<so2::Projection_t, NumJoints> projection;
 
     float freq= 0.85f;
+
+    /* a single oscillator, shifted in phase for each joint */
+    SO2_Bank osc;
+
     float volume = 1.f; //remove if not needed
 
-    float get_amp(unsigned idx) { return usr_params.at(idx    ); }
-    float get_phs(unsigned /*idx*/) { return 0.0; } //TODO: usr_params.at(idx + 3); }
+    float get_amp(unsigned idx) { return usr_params[idx]; }
+    float get_phs(unsigned /*idx*/) { return 0.0; } //TODO: usr_params.at(idx + 3); } then update the projection on change
 
 
 public:
 
-    SO2_Controller(robots::Robot_Interface& robot, std::vector<supreme::csl_control>& controls, UserParameter_t const& usr_params)
+    SO2_Controller(robots::Robot_Interface& robot, Controls_t& controls, UserParameter_t const& usr_params)
     : robot(robot)
     , controls(controls)
-    , usr_params(usr_params) {
+    , usr_params(usr_params)
+    , pset(usr_params.size(), so2::default_params)
+    , projection(usr_params.size(), [this](std::size_t i) { return so2::phase_projection(pset[i].phs + 180.f*get_phs(i)); })
+    , osc(1, freq)
+    {
 
-        sts_msg("num usr params = %u", usr_params.size());
+        sts_msg("num usr params = %u", (unsigned) usr_params.size());
         //TODO assert(usr_params.size() == robot.get_joints().size()*2);
     }
 
     void set_frequency(float f /*-1..1*/) { freq = 0.75f + 0.2f*clip(f); }
 
-    void reset(void) { x1 = .001f; x2 = .0f; }
+    /* gait parameters of joint i */
+    void set_params(std::size_t i, so2::Params_t const& p) {
+        pset[i] = p;
+        projection[i] = so2::phase_projection(p.phs + 180.f*get_phs(i));
+    }
+
+    void reset(void) { osc.reset(); }
+
+    /* continues a wave given as the oscillator's state, e.g. the CPG's (see CPG_Controller::get_wave) */
+    void synchronize(float x1, float x2) { osc.set_state(0, x1, x2); }
+
+    SO2_Bank const& get_oscillator(void) const { return osc; }
 
     void execute_cycle(void)
     {
-        update_weights(freq);
-
-        float y1 = tanh(w11*x1 + w12*x2);
-        float y2 = tanh(w21*x1 + w22*x2);
-        x1 = y1;
-        x2 = y2;
+        osc.set_frequency(0, freq); /* weights change only with the frequency */
+        osc.step();
 
         robots::Jointvector_t& joints = robot.set_joints();
 
         assert(joints.size() == controls.size());
-        for (std::size_t i = 0; i < joints.size(); ++i)
+        supreme::Joint_Loop<NumJoints>::apply(joints.size(), [&](std::size_t i)
         {
-            /* get desired phase and create phase shifted motor signals */
-            const float q = M_PI*(so2::pset[i].phs/180.f + get_phs(i));
-            const float a = cos(q);
-            const float b = sin(q);
-            const float u = a*x1 + b*x2;
+            /* phase shifted motor signals */
+            const float u = osc.output(0, projection[i]);
 
-            const float A = so2::preamp * so2::pset[i].amp * get_amp(i); // amplitude
-            const float out = clip( A*u, so2::max_val * so2::pset[i].minv
-                                       , so2::max_val * so2::pset[i].maxv );
+            const float A = so2::preamp * pset[i].amp * get_amp(i); // amplitude
+            const float out = clip( A*u, so2::max_val * pset[i].minv
+                                       , so2::max_val * pset[i].maxv );
 
             /* amplitude  * ( soll - ist) */
-            const float target = clip(so2::pset[i].pctrl * (so2::pset[i].off - joints[i].s_ang),0.5)
+            const float target = clip(pset[i].pctrl * (pset[i].off - joints[i].s_ang),0.5)
                                + out;
 
-            joints[i].motor = controls.at(i).step(joints[i].s_ang, clip(target));
-        }
-
-
-
-    }
-
-    void update_weights(float freq)
-    {
-        /*
-            (x1,x2)^T  <-- tanh[ (1+eps) * r(dp) * (x1,x2)^T ]
-
-            r(dp) = [ cos(dp), sin(dp)
-                     -sin(dp), cos(dp) ]
-        */
-        const float val = clip(freq, .0f, 1.f);
-
-        /* step size of oscillator (determines frequency) */
-        const float dp = M_PI/(8.f + 42.f*val);  // pi/8 .. pi/50
+            joints[i].motor = controls[i].step(joints[i].s_ang, clip(target));
+        });
 
-        /* add non-linearity */
-        const float k = 1.0f + 1.5f*dp; // useful range: 1 + 1dp ... 1 + 2dp
 
-        /* determine self and ring coupling */
-        const float s = cos(dp) * k;
-        const float r = sin(dp) * k;
 
-        /* rotation matrix */
-        w11 =  s; w12 = r;
-        w21 = -r; w22 = s;
     }
 
 };
@@ -0,0 +1,200 @@
+#ifndef SO2_OSCILLATOR_HPP
+#define SO2_OSCILLATOR_HPP
+
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+/* A bank of SO(2) oscillators, each a pair of neurons coupled by a
+   rotation scaled beyond one (see SO2_Controller::execute_cycle):
+
+     (x1,x2)^T  <-- tanh[ k * r(dp) * (x1,x2)^T + (i1,i2)^T ]
+
+   with an optional input i (e.g. coupling to other oscillators, zero
+   unless set).
+
+   The weights are recomputed only when an oscillator's frequency changes.
+   The state is stored as arrays of x1, x2 and weights, padded to blocks of
+   'lanes' oscillators. A block is stepped at once with gcc's vector
+   extension. This compiles to SSE or NEON where the target has it and to
+   scalar code elsewhere, with no intrinsics and at -O2. Plain loops are
+   not vectorized there because of the clamp in fast_tanh.
+
+   fast_tanh is the [7/6] Lambert continued fraction clamped at +-4.8:
+
+     |fast_tanh(x) - tanh(x)| < 1e-4   for all x
+                              < 5e-7   for |x| <= 2.5
+
+   The second bound covers the oscillators, whose inputs are bounded by
+   k * sqrt(2) < 2.3. Per step, the state differs from step_reference()
+   with std::tanh by less than 5e-7. The phase is neutrally stable, so the
+   difference accumulates as a slow phase shift. Over 1e5 cycles (1000 s
+   at 100 Hz) it stays below 5e-5 at any frequency, which the bench
+   checks as "so2/bank_deviation". */
+
+namespace jcl {
+namespace so2 {
+
+    const std::size_t lanes = 4;
+
+    typedef float Lanes_t __attribute__((vector_size(lanes * sizeof(float))));
+
+    /* initial state, a tiny kick to leave the fixed point at zero */
+    const float x1_init = .001f;
+    const float x2_init = .0f;
+
+    const float tanh_clamp = 4.8f;
+
+    /* x already clamped, float or Lanes_t */
+    template <typename T>
+    inline T tanh_rational(T x) {
+        const T x2 = x*x;
+        return x * (135135.f + x2 * (17325.f + x2 * (378.f + x2)))
+                 / (135135.f + x2 * (62370.f + x2 * (3150.f + 28.f * x2)));
+    }
+
+    inline float fast_tanh(float x) {
+        x = (x < -tanh_clamp) ? -tanh_clamp : x;
+        x = (x > +tanh_clamp) ? +tanh_clamp : x;
+        return tanh_rational(x);
+    }
+
+    /* lane-wise, same results as the scalar version */
+    inline Lanes_t fast_tanh(Lanes_t x) {
+        x = (x < -tanh_clamp) ? -tanh_clamp : x;
+        x = (x > +tanh_clamp) ? +tanh_clamp : x;
+        return tanh_rational(x);
+    }
+
+    struct Weights_t {
+        float s; /* self coupling */
+        float r; /* ring coupling */
+    };
+
+    /* freq 0..1 */
+    inline Weights_t rotation_weights(float freq) {
+        const float val = std::min(std::max(freq, .0f), 1.f);
+
+        /* step size of oscillator (determines frequency) */
+        const float dp = M_PI/(8.f + 42.f*val);  // pi/8 .. pi/50
+
+        /* add non-linearity */
+        const float k = 1.0f + 1.5f*dp; // useful range: 1 + 1dp ... 1 + 2dp
+
+        return Weights_t{ std::cos(dp) * k, std::sin(dp) * k };
+    }
+
+    /* phase shifted output of an oscillator, u = a*x1 + b*x2 */
+    struct Projection_t {
+        float a;
+        float b;
+    };
+
+    inline Projection_t phase_projection(float phase_deg) {
+        const float q = M_PI*(phase_deg/180.f);
+        return Projection_t{ std::cos(q), std::sin(q) };
+    }
+
+} /* namespace so2 */
+
+
+class SO2_Bank
+{
+public:
+    explicit SO2_Bank(std::size_t number_of_oscillators, float freq = .0f)
+    : number_of_oscillators(number_of_oscillators)
+    , padded((number_of_oscillators + so2::lanes - 1) / so2::lanes * so2::lanes)
+    , x1(padded, .0f)
+    , x2(padded, .0f)
+    , s (padded, .0f)  /* zero weights keep the padding at rest */
+    , r (padded, .0f)
+    , i1(padded, .0f)
+    , i2(padded, .0f)
+    , freq(number_of_oscillators, std::numeric_limits<float>::quiet_NaN())
+    {
+        set_frequency(freq);
+        reset();
+    }
+
+    std::size_t size(void) const { return number_of_oscillators; }
+
+    void set_frequency(std::size_t i, float f) {
+        assert(i < number_of_oscillators);
+        if (f == freq[i]) return; /* NaN at first */
+        freq[i] = f;
+        const so2::Weights_t w = so2::rotation_weights(f);
+        s[i] = w.s;
+        r[i] = w.r;
+    }
+
+    void set_frequency(float f) {
+        for (std::size_t i = 0; i < number_of_oscillators; ++i) set_frequency(i, f);
+    }
+
+    /* added to the activations of the following steps */
+    void set_input(std::size_t i, float in1, float in2) {
+        assert(i < number_of_oscillators);
+        i1[i] = in1;
+        i2[i] = in2;
+    }
+
+    /* places an oscillator at a state, e.g. on its limit cycle */
+    void set_state(std::size_t i, float x1_, float x2_) {
+        assert(i < number_of_oscillators);
+        x1[i] = x1_;
+        x2[i] = x2_;
+    }
+
+    void reset(std::size_t i) { x1[i] = so2::x1_init; x2[i] = so2::x2_init; }
+    void reset(void) { for (std::size_t i = 0; i < number_of_oscillators; ++i) reset(i); }
+
+    /* one step of all oscillators */
+    void step(void) {
+        for (std::size_t b = 0; b < padded; b += so2::lanes)
+            step_block(&x1[b], &x2[b], &s[b], &r[b], &i1[b], &i2[b]);
+    }
+
+    /* same step with std::tanh, to check the error bound against */
+    void step_reference(void) {
+        for (std::size_t i = 0; i < number_of_oscillators; ++i) {
+            const float y1 = std::tanh( s[i]*x1[i] + r[i]*x2[i] + i1[i]);
+            const float y2 = std::tanh(-r[i]*x1[i] + s[i]*x2[i] + i2[i]);
+            x1[i] = y1;
+            x2[i] = y2;
+        }
+    }
+
+    float get_x1(std::size_t i) const { assert(i < number_of_oscillators); return x1[i]; }
+    float get_x2(std::size_t i) const { assert(i < number_of_oscillators); return x2[i]; }
+
+    float output(std::size_t i, so2::Projection_t const& p) const { return p.a*x1[i] + p.b*x2[i]; }
+
+private:
+    /* unaligned loads and stores, the vectors' memory need not be aligned for Lanes_t */
+    static so2::Lanes_t load(const float* p) { so2::Lanes_t v; memcpy(&v, p, sizeof(v)); return v; }
+    static void store(float* p, so2::Lanes_t const& v) { memcpy(p, &v, sizeof(v)); }
+
+    static void step_block(float* x1p, float* x2p, const float* sp, const float* rp, const float* i1p, const float* i2p)
+    {
+        const so2::Lanes_t x1 = load(x1p), x2 = load(x2p);
+        const so2::Lanes_t s  = load(sp ), r  = load(rp );
+        store(x1p, so2::fast_tanh( s*x1 + r*x2 + load(i1p)));
+        store(x2p, so2::fast_tanh(-r*x1 + s*x2 + load(i2p)));
+    }
+
+    const std::size_t number_of_oscillators;
+    const std::size_t padded;
+
+    std::vector<float> x1, x2;
+    std::vector<float> s, r;
+    std::vector<float> i1, i2;
+    std::vector<float> freq;
+};
+
+} /* namespace jcl */
+
+#endif /* SO2_OSCILLATOR_HPP */
@@ -0,0 +1,181 @@
+#ifndef TELEMETRY_LINK_HPP
+#define TELEMETRY_LINK_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include <common/log_messages.h>
+
+#include <periodic_scheduler.hpp>
+#include <flatcat_telemetry.hpp>
+
+/* Link quality of the telemetry stream as seen by a terminal.
+   Every accepted frame is classified by its cycle counter against the
+   newest frame so far:
+
+    in order  : cycles = newest + 1
+    gap       : cycles > newest + 1, the frames in between count as lost
+    duplicate : cycles = newest
+    late      : newest - reorder_window <= cycles < newest, reordered,
+                no longer counted as lost
+    restart   : cycles dropped further back, the robot was restarted
+
+   Duplicate and late frames are not applied, so the terminal keeps the
+   newest good state (see Telemetry_Receiver). Frames failing the checks are counted as corrupt
+   (truncated, sync, size, checksum) or incompatible (version, layout).
+   Corrupt frames of other units are included, since their unit is unknown.
+
+   With decimation n (DEC=) only every n-th cycle is expected, a gap
+   counts the multiples of n skipped, so compact key frames sent in
+   between do not distort the loss.
+
+   Loss rate is taken over windows of 'window' expected frames, jitter is
+   the smoothed deviation of the inter-arrival time from the nominal
+   period (RFC 3550). Frames batched into one datagram arrive together,
+   so jitter includes the batching interval there. */
+
+namespace supreme {
+
+class Link_Statistics
+{
+public:
+    enum class Arrival_t : uint8_t { first, in_order, gap, duplicate, late, restart };
+
+    static const uint64_t reorder_window = 100; /* cycles */
+    static const uint64_t window         = 100; /* expected frames */
+
+    Link_Statistics(double update_rate_Hz, unsigned decimation = 1)
+    : period_us(update_rate_Hz > 0 ? 1e6 / update_rate_Hz : .0)
+    , decimation(decimation > 0 ? decimation : 1)
+    {}
+
+    Arrival_t update(uint64_t cycles) { return update(cycles, monotonic_time_ns() / constants::ns_per_us); }
+
+    Arrival_t update(uint64_t cycles, uint64_t arrival_us)
+    {
+        ++received;
+        last_arrival_us = arrival_us;
+
+        if (not has_frame) {
+            has_frame = true;
+            accept(cycles, arrival_us, 1);
+            return Arrival_t::first;
+        }
+
+        if (cycles == newest) {
+            ++duplicates;
+            return Arrival_t::duplicate;
+        }
+
+        if (cycles < newest) {
+            if (cycles + reorder_window >= newest) {
+                ++reordered;
+                if (lost > 0) --lost;
+                if (window_lost > 0) --window_lost;
+                return Arrival_t::late;
+            }
+            ++restarts;
+            consecutive_lost = 0;
+            accept(cycles, arrival_us, 1);
+            return Arrival_t::restart;
+        }
+
+        const uint64_t missing = (cycles - newest - 1) / decimation;
+        lost += missing;
+        window_lost += missing;
+        consecutive_lost = missing;
+        max_consecutive_lost = std::max(max_consecutive_lost, missing);
+
+        /* inter-arrival jitter against the nominal period */
+        const double expected_us = period_us * (cycles - newest);
+        const double deviation   = std::fabs(static_cast<double>(arrival_us - newest_arrival_us) - expected_us);
+        jitter_us += (deviation - jitter_us) / 16.0;
+
+        accept(cycles, arrival_us, missing + 1);
+        return (missing > 0) ? Arrival_t::gap : Arrival_t::in_order;
+    }
+
+    void count_rejected(Telemetry_Result_t result) {
+        switch (result) {
+        case Telemetry_Result_t::bad_version:
+        case Telemetry_Result_t::bad_layout : ++incompatible; break;
+        case Telemetry_Result_t::missing_key: ++missing_key;  break;
+        case Telemetry_Result_t::ok:
+        case Telemetry_Result_t::other_unit :
+        case Telemetry_Result_t::stale      : break;
+        default                             : ++corrupt;      break;
+        }
+    }
+
+    /* no frame accepted for longer than timeout */
+    bool is_alive(double timeout_ms) const {
+        return has_frame and (monotonic_time_ns() / constants::ns_per_us - last_arrival_us) < 1e3 * timeout_ms;
+    }
+
+    double   get_loss_rate           (void) const { return loss_rate;            }
+    double   get_jitter_us           (void) const { return jitter_us;            }
+    uint64_t get_consecutive_lost    (void) const { return consecutive_lost;     }
+    uint64_t get_max_consecutive_lost(void) const { return max_consecutive_lost; }
+
+    uint64_t get_received    (void) const { return received;     }
+    uint64_t get_lost        (void) const { return lost;         }
+    uint64_t get_duplicates  (void) const { return duplicates;   }
+    uint64_t get_reordered   (void) const { return reordered;    }
+    uint64_t get_corrupt     (void) const { return corrupt;      }
+    uint64_t get_incompatible(void) const { return incompatible; }
+    uint64_t get_missing_key (void) const { return missing_key;  }
+    uint64_t get_restarts    (void) const { return restarts;     }
+
+    void print_statistics(void) const {
+        typedef unsigned long long ull;
+        sts_msg("Telemetry link: %llu received, %llu lost (%4.1f%% recent), %llu duplicated, %llu reordered"
+               , (ull) received, (ull) lost, 100.0 * loss_rate, (ull) duplicates, (ull) reordered);
+        sts_msg("                %llu corrupt, %llu incompatible, %llu without key frame, %llu restarts"
+               , (ull) corrupt, (ull) incompatible, (ull) missing_key, (ull) restarts);
+        sts_msg("                jitter %5.1f us, max %llu consecutive frames lost"
+               , jitter_us, (ull) max_consecutive_lost);
+    }
+
+private:
+    void accept(uint64_t cycles, uint64_t arrival_us, uint64_t expected) {
+        newest            = cycles;
+        newest_arrival_us = arrival_us;
+
+        window_expected += expected;
+        if (window_expected >= window) {
+            loss_rate = static_cast<double>(window_lost) / window_expected;
+            window_expected = window_lost = 0;
+        }
+    }
+
+    double   period_us; /* not const, copies are published by the receive thread */
+    uint64_t decimation;
+
+    bool     has_frame         = false;
+    uint64_t newest            = 0;
+    uint64_t newest_arrival_us = 0;
+    uint64_t last_arrival_us   = 0;
+
+    uint64_t window_expected = 0;
+    uint64_t window_lost     = 0;
+    double   loss_rate       = .0;
+    double   jitter_us       = .0;
+
+    uint64_t consecutive_lost     = 0;
+    uint64_t max_consecutive_lost = 0;
+
+    uint64_t received     = 0;
+    uint64_t lost         = 0;
+    uint64_t duplicates   = 0;
+    uint64_t reordered    = 0;
+    uint64_t corrupt      = 0;
+    uint64_t incompatible = 0;
+    uint64_t missing_key  = 0;
+    uint64_t restarts     = 0;
+};
+
+
+} /* namespace supreme */
+
+#endif /* TELEMETRY_LINK_HPP */
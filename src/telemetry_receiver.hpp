@@ -0,0 +1,252 @@
+#ifndef TELEMETRY_RECEIVER_HPP
+#define TELEMETRY_RECEIVER_HPP
+
+#include <array>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <common/log_messages.h>
+
+#include <periodic_scheduler.hpp>
+#include <flatcat_telemetry.hpp>
+#include <telemetry_link.hpp>
+#include <triple_buffer.hpp>
+#include <clock_sync.hpp>
+#include <udp_batch.hpp>
+
+/* Terminal side telemetry reception in a background thread.
+   The thread blocks in epoll on the socket, drains all pending datagrams
+   with recvmmsg (single frames or batches alike) and decodes each frame with
+   the arrival time the kernel stamped on its datagram. Frames in order are written into a triple buffer,
+   which is published once per wake up, so the GUI and learning loops only
+   pick up the newest state with update(), without any system call.
+
+   The link statistics and the clock estimate are owned by the thread,
+   copies are published along with each state, so they are as of the
+   newest frame. Answers to pings (pongs) arrive on the same socket and
+   only update the clock estimate. */
+
+namespace supreme {
+
+#define FLATCAT_TELEMETRY_DECLARE_STATE(type, name, source) type name{};
+
+/* control read back, as much as the telemetry carries */
+struct Telemetry_Control_State_t { FLATCAT_TELEMETRY_CONTROL_FIELDS(FLATCAT_TELEMETRY_DECLARE_STATE) };
+
+#undef FLATCAT_TELEMETRY_DECLARE_STATE
+
+
+/* everything a frame sets, same members as FlatcatUDPRobot */
+template <typename Motor_t>
+struct Telemetry_State_t {
+    uint16_t sync   = 0;
+    uint64_t cycles = 0;
+    uint64_t sample_us   = 0; /* robot clock, see telemetry_schema.hpp */
+    uint16_t command_seq = 0;
+    uint64_t actuated_us = 0;
+    uint8_t  chksum = 0;
+
+    std::vector<Motor_t>      motors;
+    Cycle_Timing_Stats_t      timing;
+    Telemetry_Control_State_t control;
+
+    uint64_t         arrival_ns = 0; /* monotonic, stamped by the kernel on arrival */
+    Link_Statistics  link;
+    Clock_Estimate_t clock;
+
+    Telemetry_State_t(std::size_t number_of_motors, double update_rate_Hz)
+    : motors(number_of_motors)
+    , timing()
+    , control()
+    , link(update_rate_Hz)
+    , clock()
+    {}
+};
+
+
+/* where FlatcatUDPRobot takes its state from, the live stream or a replay */
+template <typename Motor_t>
+class Telemetry_Source
+{
+public:
+    typedef Telemetry_State_t<Motor_t> State_t;
+
+    virtual ~Telemetry_Source() {}
+
+    /* takes over the next state if there is one */
+    virtual bool update(void) = 0;
+    virtual State_t const& get_state(void) const = 0;
+};
+
+
+template <typename Motor_t>
+class Telemetry_Receiver : public Telemetry_Source<Motor_t>
+{
+public:
+    typedef Telemetry_State_t<Motor_t> State_t;
+
+    static const std::size_t max_datagrams = 64;
+
+    Telemetry_Receiver( std::string const& group
+                      , unsigned port
+                      , uint8_t unit_id
+                      , std::size_t number_of_motors
+                      , double update_rate_Hz
+                      , unsigned decimation = 1 )
+    : socket(group, port)
+    , unit_id(unit_id)
+    , number_of_motors(number_of_motors)
+    , compact_key()
+    , link(update_rate_Hz, decimation)
+    , clock()
+    , state(State_t(number_of_motors, update_rate_Hz))
+    , epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+    , stop_fd(eventfd(0, EFD_CLOEXEC))
+    , thread()
+    {
+        assertion(epoll_fd >= 0, "Could not create epoll instance: %s", strerror(errno));
+        assertion(stop_fd  >= 0, "Could not create eventfd for telemetry receiver.");
+
+        watch(socket.get_fd());
+        watch(stop_fd);
+
+        thread = std::thread(&Telemetry_Receiver::receive_loop, this);
+        sts_msg("Telemetry receive thread started for unit %u.", unit_id);
+    }
+
+    ~Telemetry_Receiver()
+    {
+        const uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) != sizeof(one))
+            wrn_msg("Could not signal telemetry receive thread to stop.");
+        if (thread.joinable())
+            thread.join();
+        close(stop_fd);
+        close(epoll_fd);
+    }
+
+    Telemetry_Receiver(const Telemetry_Receiver& other) = delete;
+    Telemetry_Receiver& operator=(const Telemetry_Receiver& other) = delete;
+
+    /* consumer side, takes over the newest state if there is one */
+    bool update(void) { return state.update(); }
+
+    State_t const& get_state(void) const { return state.read(); }
+
+    /* states replaced by the thread before the consumer took them */
+    uint64_t get_published  (void) const { return state.get_published();   }
+    uint64_t get_overwritten(void) const { return state.get_overwritten(); }
+
+private:
+    void watch(int fd)
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events  = EPOLLIN;
+        ev.data.fd = fd;
+        assertion(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0, "Could not add fd to epoll: %s", strerror(errno));
+    }
+
+    void receive_loop(void)
+    {
+        std::array<struct epoll_event, 2> events;
+        while (true)
+        {
+            const int n = epoll_wait(epoll_fd, events.data(), events.size(), /*timeout_ms=*/-1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                wrn_msg("Telemetry receive thread: epoll failed: %s", strerror(errno));
+                return;
+            }
+            for (int i = 0; i < n; ++i)
+                if (events[i].data.fd == stop_fd)
+                    return;
+            if (n > 0)
+                drain();
+        }
+    }
+
+    /* empties the socket, publishes once if any frame was accepted */
+    void drain(void)
+    {
+        unsigned accepted = 0;
+        std::size_t n;
+        do {
+            n = socket.receive_messages();
+            for (std::size_t i = 0; i < n; ++i) {
+                const uint64_t arrival_ns = socket.get_arrival_ns(i);
+                accepted += for_each_telemetry_frame( socket.get_message(i), socket.get_length(i)
+                                                    , [this, arrival_ns](const uint8_t* frame, std::size_t len)
+                                                      { return receive_frame(frame, len, arrival_ns); });
+            }
+        } while (n == max_datagrams);
+
+        if (accepted > 0) {
+            state.write_buffer().link  = link;
+            state.write_buffer().clock = clock.get_estimate();
+            state.publish();
+        }
+    }
+
+    /* applies a frame to the write buffer only if it is newer than the last one */
+    Telemetry_Result_t receive_frame(const uint8_t* frame, std::size_t len, uint64_t arrival_ns)
+    {
+        if (len >= sizeof(telemetry::Compact_Header_t) and telemetry_layout(frame) == telemetry::pong_layout)
+            return receive_pong(frame, len, arrival_ns);
+
+        telemetry::Records_t records;
+        const Telemetry_Result_t result = decode_telemetry_records(unit_id, number_of_motors, compact_key, frame, len, records);
+        if (result != Telemetry_Result_t::ok) {
+            link.count_rejected(result);
+            return result;
+        }
+
+        const Link_Statistics::Arrival_t arrival = link.update(records.header.cycles, arrival_ns / constants::ns_per_us);
+        if (arrival == Link_Statistics::Arrival_t::duplicate or arrival == Link_Statistics::Arrival_t::late)
+            return Telemetry_Result_t::stale;
+
+        State_t& s = state.write_buffer();
+        apply_telemetry_records(s, records);
+        s.arrival_ns = arrival_ns;
+        return Telemetry_Result_t::ok;
+    }
+
+    /* the estimate goes out with the next frame, the write buffer holds
+       an older state and must not be published on its own */
+    Telemetry_Result_t receive_pong(const uint8_t* frame, std::size_t len, uint64_t arrival_ns)
+    {
+        telemetry::Pong_t pong;
+        const Telemetry_Result_t result = decode_pong(pong, frame, len);
+        if (result != Telemetry_Result_t::ok) {
+            link.count_rejected(result);
+            return result;
+        }
+        clock.add_sample(pong.t1_us, pong.t2_us, pong.t3_us, arrival_ns / constants::ns_per_us);
+        return Telemetry_Result_t::stale;
+    }
+
+    /* owned by the receive thread */
+    Batch_UDP_Receiver<max_datagrams> socket;
+    const uint8_t         unit_id;
+    const std::size_t     number_of_motors;
+    Compact_Telemetry_Key compact_key;
+    Link_Statistics       link;
+    Clock_Sync            clock;
+
+    Triple_Buffer<State_t> state;
+
+    int epoll_fd;
+    int stop_fd;
+    std::thread thread;
+};
+
+} /* namespace supreme */
+
+#endif /* TELEMETRY_RECEIVER_HPP */
@@ -0,0 +1,401 @@
+#ifndef TELEMETRY_SCHEMA_HPP
+#define TELEMETRY_SCHEMA_HPP
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include <common/log_messages.h>
+
+#include <flatcat_settings.hpp>
+#include <flatcat_control.hpp>
+#include <cycle_timing.hpp>
+
+/* Telemetry schema, the single source of the frame layout.
+
+   frame := header | motor record * number_of_motors | timing record * num_phases | control record | checksum
+
+   Each group is declared once as a field list X(type, name, source).
+   It generates the packed record, the field table, the encoder
+   (record.name = source) and the decoder (target.name = record.name).
+   The decoder's targets are FlatcatUDPRobot's motors, timing and control.
+
+   To add a field (e.g. voltage_backemf, connection_losses, acceleration)
+   uncomment or add it in the list. The layout id in the header is a hash
+   over all field lists, so receivers built from another schema reject
+   the frames instead of misreading them. Bump the version on changes
+   that keep the field lists but change their meaning.
+
+   The compact layout (telemetry_compact = 1) is derived from the same
+   records, see the compact field lists below and flatcat_telemetry.hpp.
+   Projections carry a subset of the fields for subscribers which asked
+   for less (FLD=), see the field mask below. */
+
+namespace supreme {
+namespace telemetry {
+
+const uint16_t sync    = 0xCA75;
+const uint8_t  version = 2;
+
+/* header, sources: flatcat = FlatcatRobot, cycles = cycle counter.
+   Times are monotonic on the robot in us: sample_us is the bus transaction
+   of this cycle, actuated_us the one which first carried the outputs of
+   the binary command command_seq to the motors (0 = none yet). */
+#define FLATCAT_TELEMETRY_HEADER_FIELDS(X)      \
+    X( uint16_t, sync             , telemetry::sync                 ) \
+    X( uint8_t , version          , telemetry::version              ) \
+    X( uint16_t, layout           , telemetry::layout               ) \
+    X( uint8_t , unit_id          , flatcat.get_unit_id()           ) \
+    X( uint8_t , number_of_motors , flatcat.get_motors().size()     ) \
+    X( uint64_t, cycles           , cycles                          ) \
+    X( uint64_t, sample_us        , flatcat.get_sample_time_us()    ) \
+    X( uint16_t, command_seq      , flatcat.get_command_seq()       ) \
+    X( uint64_t, actuated_us      , flatcat.get_actuated_us()       )
+
+/* motor record, sources: m = motor, d = m.get_data() */
+#define FLATCAT_TELEMETRY_MOTOR_FIELDS(X)       \
+    X( uint8_t , id               , m.get_id()       ) \
+    X( float   , position         , d.position       ) \
+    X( float   , last_p           , d.last_p         ) \
+    X( float   , velocity         , d.velocity       ) \
+    X( float   , current          , d.current        ) \
+    X( float   , voltage_supply   , d.voltage_supply ) \
+    X( float   , output_voltage   , d.output_voltage ) \
+ /* X( float   , voltage_backemf  , d.voltage_backemf) */ \
+ /* X( float   , last_output      , d.last_output    ) */ \
+    X( float   , temperature      , d.temperature    ) \
+ /* X( bool    , is_connected     , d.is_connected   ) */ \
+ /* X( uint32_t, connection_losses, m.connection_losses) */
+
+/* timing record per phase of the control cycle, source: s = stats of the phase */
+#define FLATCAT_TELEMETRY_TIMING_FIELDS(X)      \
+    X( float   , mean_us          , s.mean_us        ) \
+    X( float   , max_us           , s.max_us         ) \
+    X( float   , p99_us           , s.p99_us         )
+
+/* control state read back, source: c = FlatcatControl */
+#define FLATCAT_TELEMETRY_CONTROL_FIELDS(X)     \
+    X( bool         , enabled     , c.enabled        ) \
+    X( bool         , usr_pos     , c.usr_pos        ) \
+    X( float        , amplitude   , c.amplitude      ) \
+    X( float        , modulate    , c.modulate       ) \
+    X( float        , inputgain   , c.inputgain      ) \
+    X( ControlMode_t, mode        , c.cur_mode       )
+
+
+#define FLATCAT_TELEMETRY_DECLARE(type, name, source) type name;
+
+struct __attribute__((packed)) Header_t  { FLATCAT_TELEMETRY_HEADER_FIELDS (FLATCAT_TELEMETRY_DECLARE) };
+struct __attribute__((packed)) Motor_t   { FLATCAT_TELEMETRY_MOTOR_FIELDS  (FLATCAT_TELEMETRY_DECLARE) };
+struct __attribute__((packed)) Timing_t  { FLATCAT_TELEMETRY_TIMING_FIELDS (FLATCAT_TELEMETRY_DECLARE) };
+struct __attribute__((packed)) Control_t { FLATCAT_TELEMETRY_CONTROL_FIELDS(FLATCAT_TELEMETRY_DECLARE) };
+
+
+/* all records of one frame, assembled before encoding and after decoding */
+struct Records_t {
+    Header_t  header;
+    std::array<Motor_t , constants::max_joints_per_unit> motors;
+    std::array<Timing_t, constants::num_phases         > timing;
+    Control_t control;
+    uint8_t   checksum;
+};
+
+
+/* compact layout, fixed-point: stored = round(value * scale), saturated.
+   X(type, name, scale), names refer to the fields of the records above.
+
+   compact frame := compact header | cycles | times | motor * n | slow * n | timing * num_phases | control | checksum
+
+   Key frames carry the full cycle counter, sample time and slow fields.
+   The frames between two key frames carry the cycle and time offsets to
+   their key frame and, if delta coding is enabled, the slow fields as
+   offsets to the key frame. The command echo is sent as the age of the
+   actuation relative to the sample time, saturated (= none).
+   Receivers drop frames whose key frame they have not seen. */
+
+/* motor record, fast changing fields */
+#define FLATCAT_TELEMETRY_COMPACT_MOTOR_FIELDS(X) \
+    X( uint8_t , id               , 1.f   ) \
+    X( int16_t , position         , 1e4f  ) /* ±3.2767     */ \
+    X( int16_t , last_p           , 1e4f  ) \
+    X( int16_t , velocity         , 1e3f  ) /* ±32.767     */ \
+    X( int16_t , current          , 1e3f  ) /* ±32.767 A   */ \
+    X( int16_t , output_voltage   , 1e3f  ) /* ±32.767 V   */
+
+/* motor record, slowly changing fields */
+#define FLATCAT_TELEMETRY_COMPACT_SLOW_FIELDS(X) \
+    X( int16_t , voltage_supply   , 1e2f  ) /* ±327.67 V   */ \
+    X( int16_t , temperature      , 1e1f  ) /* ±3276.7 °C  */
+
+/* timing record per phase */
+#define FLATCAT_TELEMETRY_COMPACT_TIMING_FIELDS(X) \
+    X( uint16_t, mean_us          , 1.f   ) /* 0..65535 us */ \
+    X( uint16_t, max_us           , 1.f   ) \
+    X( uint16_t, p99_us           , 1.f   )
+
+/* the control record is sent unchanged */
+
+#define FLATCAT_TELEMETRY_DECLARE_COMPACT(type, name, scale) type name;
+#define FLATCAT_TELEMETRY_DECLARE_DELTA(type, name, scale) int8_t name;
+
+struct __attribute__((packed)) Compact_Motor_t  { FLATCAT_TELEMETRY_COMPACT_MOTOR_FIELDS (FLATCAT_TELEMETRY_DECLARE_COMPACT) };
+struct __attribute__((packed)) Compact_Slow_t   { FLATCAT_TELEMETRY_COMPACT_SLOW_FIELDS  (FLATCAT_TELEMETRY_DECLARE_COMPACT) };
+struct __attribute__((packed)) Delta_Slow_t     { FLATCAT_TELEMETRY_COMPACT_SLOW_FIELDS  (FLATCAT_TELEMETRY_DECLARE_DELTA  ) };
+struct __attribute__((packed)) Compact_Timing_t { FLATCAT_TELEMETRY_COMPACT_TIMING_FIELDS(FLATCAT_TELEMETRY_DECLARE_COMPACT) };
+
+#undef FLATCAT_TELEMETRY_DECLARE_COMPACT
+#undef FLATCAT_TELEMETRY_DECLARE_DELTA
+#undef FLATCAT_TELEMETRY_DECLARE
+
+/* same leading fields as Header_t, so unit id and number of motors
+   are found at the same place in both layouts */
+struct __attribute__((packed)) Compact_Header_t {
+    uint16_t sync;
+    uint8_t  version;
+    uint16_t layout;
+    uint8_t  unit_id;
+    uint8_t  number_of_motors;
+    uint8_t  flags;
+    uint8_t  key_id;
+};
+
+struct __attribute__((packed)) Compact_Echo_t {
+    uint16_t command_seq;
+    uint32_t actuated_age_us;
+};
+
+namespace compact_flags {
+    const uint8_t key_frame  = 0x1; /* cycles u64 and full slow fields follow */
+    const uint8_t delta_slow = 0x2; /* slow fields as int8 offsets to the key frame */
+}
+
+static_assert(offsetof(Compact_Header_t, layout          ) == offsetof(Header_t, layout          )
+          and offsetof(Compact_Header_t, unit_id         ) == offsetof(Header_t, unit_id         )
+          and offsetof(Compact_Header_t, number_of_motors) == offsetof(Header_t, number_of_motors)
+             , "Compact header must share the leading fields of the header.");
+
+
+/* layout id, FNV-1a over the field lists as written, folded to 16 bit */
+constexpr uint32_t fnv1a(const char* str, uint32_t hash = 2166136261u) {
+    return (*str == '\0') ? hash : fnv1a(str + 1, (hash ^ static_cast<uint8_t>(*str)) * 16777619u);
+}
+
+#define FLATCAT_TELEMETRY_STRINGIFY(type, name, source) #type " " #name ";"
+
+constexpr uint16_t fold(uint32_t hash) { return static_cast<uint16_t>((hash >> 16) ^ (hash & 0xffff)); }
+
+/* hashed per group to stay within the compiler's constexpr recursion depth */
+const uint16_t layout = fold( fnv1a("header:"  FLATCAT_TELEMETRY_HEADER_FIELDS (FLATCAT_TELEMETRY_STRINGIFY))
+                            ^ fnv1a("motor:"   FLATCAT_TELEMETRY_MOTOR_FIELDS  (FLATCAT_TELEMETRY_STRINGIFY)) * 3
+                            ^ fnv1a("timing:"  FLATCAT_TELEMETRY_TIMING_FIELDS (FLATCAT_TELEMETRY_STRINGIFY)) * 5
+                            ^ fnv1a("control:" FLATCAT_TELEMETRY_CONTROL_FIELDS(FLATCAT_TELEMETRY_STRINGIFY)) * 7 );
+
+#define FLATCAT_TELEMETRY_STRINGIFY_COMPACT(type, name, scale) #type " " #name " " #scale ";"
+
+/* compact layout id, covers the records it is derived from */
+const uint16_t compact_layout = fold( fnv1a("compact_motor:"  FLATCAT_TELEMETRY_COMPACT_MOTOR_FIELDS (FLATCAT_TELEMETRY_STRINGIFY_COMPACT))
+                                    ^ fnv1a("compact_slow:"   FLATCAT_TELEMETRY_COMPACT_SLOW_FIELDS  (FLATCAT_TELEMETRY_STRINGIFY_COMPACT)) * 3
+                                    ^ fnv1a("compact_timing:" FLATCAT_TELEMETRY_COMPACT_TIMING_FIELDS(FLATCAT_TELEMETRY_STRINGIFY_COMPACT)) * 5
+                                    ^ (uint32_t(layout) << 8) ^ 0x5a5au );
+
+static_assert(compact_layout != layout, "Compact and full layout must differ.");
+
+#undef FLATCAT_TELEMETRY_STRINGIFY
+#undef FLATCAT_TELEMETRY_STRINGIFY_COMPACT
+
+
+/* projection, full records reduced to the fields selected by a mask.
+
+   projection := header | field mask | motor * n | timing * num_phases | control | checksum
+
+   Bit i of the mask selects the i-th field after the header fields in the
+   field table below, motor fields first, then timing and control fields.
+   The selected fields keep their order and type, the records are packed.
+   The header is always sent in full. */
+struct __attribute__((packed)) Projection_Header_t {
+    Header_t header;
+    uint32_t fields;
+};
+
+const uint16_t projection_layout = fold(fnv1a("projection:") ^ (uint32_t(layout) << 8) ^ 0xa5a5u);
+
+static_assert(projection_layout != layout and projection_layout != compact_layout, "Projection layout must differ.");
+
+#define FLATCAT_TELEMETRY_COUNT(type, name, source) + 1
+
+const std::size_t number_of_header_fields  = 0 FLATCAT_TELEMETRY_HEADER_FIELDS (FLATCAT_TELEMETRY_COUNT);
+const std::size_t number_of_motor_fields   = 0 FLATCAT_TELEMETRY_MOTOR_FIELDS  (FLATCAT_TELEMETRY_COUNT);
+const std::size_t number_of_timing_fields  = 0 FLATCAT_TELEMETRY_TIMING_FIELDS (FLATCAT_TELEMETRY_COUNT);
+const std::size_t number_of_control_fields = 0 FLATCAT_TELEMETRY_CONTROL_FIELDS(FLATCAT_TELEMETRY_COUNT);
+
+#undef FLATCAT_TELEMETRY_COUNT
+
+const std::size_t number_of_selectable_fields = number_of_motor_fields + number_of_timing_fields + number_of_control_fields;
+
+static_assert(number_of_selectable_fields <= 32, "Field mask holds 32 fields at most.");
+
+const uint32_t all_fields = (number_of_selectable_fields == 32) ? ~0u : (1u << number_of_selectable_fields) - 1;
+
+
+/* answer to a terminal's ping (PNG=<id>,<t1>), sent to the terminal's
+   telemetry port, since the command channel only goes one way.
+   t1: terminal clock at sending the ping, t2: robot clock at receiving
+   it, t3: robot clock at sending the answer, all monotonic in us.
+   Shares the leading fields of the header, unit and number of motors are 0. */
+struct __attribute__((packed)) Pong_t {
+    uint16_t sync;
+    uint8_t  version;
+    uint16_t layout;
+    uint8_t  unit_id;
+    uint8_t  number_of_motors;
+    uint32_t id;
+    uint64_t t1_us;
+    uint64_t t2_us;
+    uint64_t t3_us;
+    uint8_t  checksum;
+};
+
+const uint16_t pong_layout = fold(fnv1a("pong:uint32 id;uint64 t1_us;uint64 t2_us;uint64 t3_us;") ^ 0x0f0fu);
+
+static_assert(pong_layout != layout and pong_layout != compact_layout and pong_layout != projection_layout, "Pong layout must differ.");
+static_assert(offsetof(Pong_t, layout) == offsetof(Header_t, layout), "Pong must share the leading fields of the header.");
+
+
+constexpr std::size_t frame_size(std::size_t number_of_motors) {
+    return sizeof(Header_t)
+         + sizeof(Motor_t) * number_of_motors
+         + sizeof(Timing_t) * constants::num_phases
+         + sizeof(Control_t)
+         + sizeof(uint8_t); /* checksum */
+}
+
+/* key frames are the largest compact frames */
+constexpr std::size_t compact_frame_size(std::size_t number_of_motors, bool key_frame, bool delta_slow) {
+    return sizeof(Compact_Header_t)
+         + (key_frame ? sizeof(uint64_t) : sizeof(uint16_t)) /* cycles or offset to the key frame */
+         + (key_frame ? sizeof(uint64_t) : sizeof(uint32_t)) /* sample time or offset to the key frame */
+         + sizeof(Compact_Echo_t)
+         + sizeof(Compact_Motor_t) * number_of_motors
+         + (key_frame or not delta_slow ? sizeof(Compact_Slow_t) : sizeof(Delta_Slow_t)) * number_of_motors
+         + sizeof(Compact_Timing_t) * constants::num_phases
+         + sizeof(Control_t)
+         + sizeof(uint8_t); /* checksum */
+}
+
+static_assert(compact_frame_size(constants::max_joints_per_unit, true, false) <= frame_size(constants::max_joints_per_unit)
+             , "Compact frames must not exceed full frames.");
+
+const std::size_t max_frame_size = frame_size(constants::max_joints_per_unit);
+const std::size_t max_batch_size = constants::max_units * max_frame_size;
+
+static_assert(max_frame_size < 1400, "Telemetry frame must fit into a single datagram without fragmentation.");
+
+
+/* field table, for printing and checking the layout at run-time */
+struct Field_t {
+    const char* group;
+    const char* name;
+    std::size_t offset;
+    std::size_t size;
+};
+
+#define FLATCAT_TELEMETRY_HEADER_ENTRY(type, name, source)  { "header" , #name, offsetof(Header_t , name), sizeof(type) },
+#define FLATCAT_TELEMETRY_MOTOR_ENTRY(type, name, source)   { "motor"  , #name, offsetof(Motor_t  , name), sizeof(type) },
+#define FLATCAT_TELEMETRY_TIMING_ENTRY(type, name, source)  { "timing" , #name, offsetof(Timing_t , name), sizeof(type) },
+#define FLATCAT_TELEMETRY_CONTROL_ENTRY(type, name, source) { "control", #name, offsetof(Control_t, name), sizeof(type) },
+
+const Field_t fields[] = {
+    FLATCAT_TELEMETRY_HEADER_FIELDS (FLATCAT_TELEMETRY_HEADER_ENTRY )
+    FLATCAT_TELEMETRY_MOTOR_FIELDS  (FLATCAT_TELEMETRY_MOTOR_ENTRY  )
+    FLATCAT_TELEMETRY_TIMING_FIELDS (FLATCAT_TELEMETRY_TIMING_ENTRY )
+    FLATCAT_TELEMETRY_CONTROL_FIELDS(FLATCAT_TELEMETRY_CONTROL_ENTRY)
+};
+
+#undef FLATCAT_TELEMETRY_HEADER_ENTRY
+#undef FLATCAT_TELEMETRY_MOTOR_ENTRY
+#undef FLATCAT_TELEMETRY_TIMING_ENTRY
+#undef FLATCAT_TELEMETRY_CONTROL_ENTRY
+
+enum class Group_t : uint8_t { motor, timing, control };
+
+/* table range of a group */
+inline std::size_t first_field(Group_t group) {
+    switch (group) {
+    case Group_t::motor : return number_of_header_fields;
+    case Group_t::timing: return number_of_header_fields + number_of_motor_fields;
+    default             : return number_of_header_fields + number_of_motor_fields + number_of_timing_fields;
+    }
+}
+
+inline std::size_t number_of_fields(Group_t group) {
+    switch (group) {
+    case Group_t::motor : return number_of_motor_fields;
+    case Group_t::timing: return number_of_timing_fields;
+    default             : return number_of_control_fields;
+    }
+}
+
+/* bit of a table entry in the field mask */
+inline uint32_t field_bit(std::size_t table_index) { return 1u << (table_index - number_of_header_fields); }
+
+/* size of one projected record of a group */
+inline std::size_t projected_size(Group_t group, uint32_t mask) {
+    std::size_t size = 0;
+    for (std::size_t i = first_field(group); i < first_field(group) + number_of_fields(group); ++i)
+        if (mask & field_bit(i)) size += fields[i].size;
+    return size;
+}
+
+inline std::size_t projection_frame_size(std::size_t number_of_motors, uint32_t mask) {
+    return sizeof(Projection_Header_t)
+         + projected_size(Group_t::motor, mask) * number_of_motors
+         + projected_size(Group_t::timing, mask) * constants::num_phases
+         + projected_size(Group_t::control, mask)
+         + sizeof(uint8_t); /* checksum */
+}
+
+/* parses a comma separated list of field and group names, or "all",
+   e.g. "position,velocity,timing", false on unknown names */
+inline bool parse_field_mask(std::string const& list, uint32_t& mask)
+{
+    uint32_t result = 0;
+    std::size_t begin = 0;
+    while (begin <= list.size()) {
+        std::size_t end = list.find(',', begin);
+        if (end == std::string::npos) end = list.size();
+        const std::string name = list.substr(begin, end - begin);
+        bool known = false;
+        if (name == "all") {
+            result = all_fields;
+            known  = true;
+        }
+        for (std::size_t i = number_of_header_fields; i < sizeof(fields)/sizeof(fields[0]); ++i)
+            if (name == fields[i].name or name == fields[i].group) {
+                result |= field_bit(i);
+                known   = true;
+            }
+        if (not known) return false;
+        begin = end + 1;
+    }
+    mask = result;
+    return true;
+}
+
+inline void print_schema(std::size_t number_of_motors) {
+    sts_msg("Telemetry schema v%u, layout 0x%04x, %u bytes per frame with %u motors"
+           , version, layout, (unsigned) frame_size(number_of_motors), (unsigned) number_of_motors);
+    for (auto const& f : fields)
+        sts_msg("  %-8s %-18s +%2u %u", f.group, f.name, (unsigned) f.offset, (unsigned) f.size);
+    sts_msg("Compact layout 0x%04x, %u bytes per key frame, %u bytes in between (%u without delta coding)"
+           , compact_layout
+           , (unsigned) compact_frame_size(number_of_motors, true , true )
+           , (unsigned) compact_frame_size(number_of_motors, false, true )
+           , (unsigned) compact_frame_size(number_of_motors, false, false));
+    sts_msg("Projection layout 0x%04x, field mask 0x%x selects all fields", projection_layout, all_fields);
+}
+
+} /* namespace telemetry */
+} /* namespace supreme */
+
+#endif /* TELEMETRY_SCHEMA_HPP */
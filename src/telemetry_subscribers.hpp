@@ -0,0 +1,277 @@
+#ifndef TELEMETRY_SUBSCRIBERS_HPP
+#define TELEMETRY_SUBSCRIBERS_HPP
+
+#include <array>
+#include <algorithm>
+#include <initializer_list>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+#include <common/log_messages.h>
+
+#include <udp_batch.hpp>
+#include <periodic_scheduler.hpp>
+#include <triple_buffer.hpp>
+#include <telemetry_schema.hpp>
+
+/* Receivers of the telemetry, each with its own address, decimation and
+   field mask. The table is owned by the TCP thread: command clients are
+   subscribed when they connect and unsubscribed when they say EXIT, they
+   negotiate what they get with DEC=<n> (every n-th cycle) and FLD=<fields>
+   (see telemetry::parse_field_mask). Further receivers (e.g. a logger) are
+   added with SUB=<ip>:<port>[,<decimation>[,<fields>]] and stay until
+   UNS=<ip>:<port>. Permanent entries (the multicast group, the subscribers
+   of the settings) stay for good. When full, the oldest non-permanent entry
+   makes room for a new one, command clients before SUB=... receivers. Only the entries of command clients expire,
+   when the client was not heard of within the timeout (keep_alive), e.g.
+   because the connection broke without EXIT.
+
+   Subscribers asking for the same decimation and fields share a stream,
+   each stream is built once per cycle by the sender, whatever the number
+   of its subscribers. Every change publishes a copy of the list with the
+   streams through a triple buffer, the UDP sender thread picks it up
+   before its next batch without locking. */
+
+namespace supreme {
+
+namespace constants {
+    const std::size_t max_subscribers = 8;
+}
+
+/* how long a subscriber stays */
+enum class Lifetime_t : uint8_t {
+    connection,         /* command client, expires when silent */
+    until_unsubscribed, /* SUB=..., until UNS=... */
+    permanent,
+};
+
+/* what a subscriber gets */
+struct Subscription_t {
+    unsigned decimation = 1;
+    uint32_t fields     = telemetry::all_fields;
+
+    bool operator==(Subscription_t const& other) const { return decimation == other.decimation and fields == other.fields; }
+};
+
+struct Subscriber_List_t {
+    std::array<Destination_t , constants::max_subscribers> entries; /* with the index of their stream */
+    std::array<Subscription_t, constants::max_subscribers> subscriptions;
+    std::array<Lifetime_t    , constants::max_subscribers> lifetime;
+    std::array<uint64_t      , constants::max_subscribers> last_seen_ns; /* TCP thread only */
+    std::size_t size = 0;
+
+    std::array<Subscription_t, constants::max_subscribers> streams; /* distinct subscriptions */
+    std::size_t number_of_streams = 0;
+};
+
+class Subscriber_Table
+{
+public:
+    Subscriber_Table(unsigned timeout_s = 0)
+    : timeout_ns(static_cast<uint64_t>(timeout_s) * 1000000000ull), list(), published() {}
+
+    /* TCP thread, adds or updates a receiver */
+    bool subscribe( std::string const& address, unsigned port
+                  , Subscription_t const& subscription = Subscription_t()
+                  , Lifetime_t lifetime = Lifetime_t::connection )
+    {
+        Destination_t dst;
+        if (not make_destination(dst, address, port)) {
+            wrn_msg("Invalid subscriber address: %s", address.c_str());
+            return false;
+        }
+
+        std::size_t i = find(dst);
+        if (i == list.size) {
+            if (list.size == constants::max_subscribers and not evict_oldest()) {
+                wrn_msg("No room for subscriber %s.", destination_str(dst).c_str());
+                return false;
+            }
+            i = list.size++;
+            list.lifetime[i] = lifetime;
+        }
+        list.entries      [i] = dst;
+        list.subscriptions[i] = checked(subscription);
+        list.lifetime     [i] = std::max(list.lifetime[i], lifetime); /* never shortened */
+        list.last_seen_ns [i] = monotonic_time_ns();
+        publish();
+        sts_msg("Telemetry subscriber %s, %s%s", destination_str(dst).c_str()
+               , subscription_str(list.subscriptions[i]).c_str(), lifetime_str(list.lifetime[i]));
+        return true;
+    }
+
+    /* TCP thread, changes what an existing receiver gets */
+    bool set_decimation(std::string const& address, unsigned port, unsigned decimation) {
+        return modify(address, port, [decimation](Subscription_t& s) { s.decimation = decimation; });
+    }
+
+    bool set_fields(std::string const& address, unsigned port, uint32_t fields) {
+        return modify(address, port, [fields](Subscription_t& s) { s.fields = fields; });
+    }
+
+    /* TCP thread, the receiver is still there, no change to publish */
+    void keep_alive(std::string const& address, unsigned port)
+    {
+        Destination_t dst;
+        if (not make_destination(dst, address, port))
+            return;
+        const std::size_t i = find(dst);
+        if (i < list.size)
+            list.last_seen_ns[i] = monotonic_time_ns();
+    }
+
+    /* TCP thread, drops command clients not heard of within the timeout */
+    void expire(void)
+    {
+        if (timeout_ns == 0) return;
+        const uint64_t now_ns = monotonic_time_ns();
+        bool changed = false;
+        for (std::size_t i = 0; i < list.size; )
+            if (list.lifetime[i] == Lifetime_t::connection and now_ns - list.last_seen_ns[i] > timeout_ns) {
+                wrn_msg("Telemetry subscriber %s timed out.", destination_str(list.entries[i]).c_str());
+                remove(i);
+                changed = true;
+            } else ++i;
+        if (changed) publish();
+    }
+
+    /* TCP thread, removes a receiver unless it is permanent */
+    bool unsubscribe(std::string const& address, unsigned port)
+    {
+        Destination_t dst;
+        if (not make_destination(dst, address, port))
+            return false;
+
+        const std::size_t i = find(dst);
+        if (i == list.size or list.lifetime[i] == Lifetime_t::permanent)
+            return false;
+        remove(i);
+        publish();
+        sts_msg("Telemetry unsubscribed %s", destination_str(dst).c_str());
+        return true;
+    }
+
+    /* sender thread, true if the list has changed since the last call */
+    bool update(void) { return published.update(); }
+    Subscriber_List_t const& get(void) const { return published.read(); }
+
+    void print(void) const {
+        sts_msg("Telemetry subscribers: %u in %u stream(s)", (unsigned) list.size, (unsigned) list.number_of_streams);
+        for (std::size_t i = 0; i < list.size; ++i)
+            sts_msg("  %-21s %s%s", destination_str(list.entries[i]).c_str()
+                   , subscription_str(list.subscriptions[i]).c_str(), lifetime_str(list.lifetime[i]));
+    }
+
+    static std::string subscription_str(Subscription_t const& s) {
+        char buf[64];
+        if (s.fields == telemetry::all_fields)
+            snprintf(buf, sizeof(buf), "every %u. cycle, all fields", s.decimation);
+        else
+            snprintf(buf, sizeof(buf), "every %u. cycle, fields 0x%x", s.decimation, s.fields);
+        return buf;
+    }
+
+private:
+    static const char* lifetime_str(Lifetime_t lifetime) {
+        switch (lifetime) {
+        case Lifetime_t::until_unsubscribed: return " (until unsubscribed)";
+        case Lifetime_t::permanent         : return " (permanent)";
+        default                            : return "";
+        }
+    }
+
+    static Subscription_t checked(Subscription_t s) {
+        if (s.decimation == 0) s.decimation = 1;
+        s.fields &= telemetry::all_fields;
+        if (s.fields == 0) s.fields = telemetry::all_fields; /* nothing selected, header only would be useless */
+        return s;
+    }
+
+    template <typename Modify_fn>
+    bool modify(std::string const& address, unsigned port, Modify_fn fn)
+    {
+        Destination_t dst;
+        if (not make_destination(dst, address, port))
+            return false;
+
+        const std::size_t i = find(dst);
+        if (i == list.size)
+            return false;
+        fn(list.subscriptions[i]);
+        list.subscriptions[i] = checked(list.subscriptions[i]);
+        publish();
+        sts_msg("Telemetry subscriber %s, %s", destination_str(dst).c_str(), subscription_str(list.subscriptions[i]).c_str());
+        return true;
+    }
+
+    std::size_t find(Destination_t const& dst) const {
+        std::size_t i = 0;
+        while (i < list.size and not (list.entries[i].address.sin_addr.s_addr == dst.address.sin_addr.s_addr
+                                  and list.entries[i].address.sin_port        == dst.address.sin_port))
+            ++i;
+        return i;
+    }
+
+    /* keeps the order of subscription */
+    void remove(std::size_t i) {
+        for (; i + 1 < list.size; ++i) {
+            list.entries      [i] = list.entries      [i+1];
+            list.subscriptions[i] = list.subscriptions[i+1];
+            list.lifetime     [i] = list.lifetime     [i+1];
+            list.last_seen_ns [i] = list.last_seen_ns [i+1];
+        }
+        --list.size;
+    }
+
+    /* the oldest command client goes first, then the oldest SUB=... */
+    bool evict_oldest(void) {
+        for (Lifetime_t lifetime : { Lifetime_t::connection, Lifetime_t::until_unsubscribed })
+            for (std::size_t i = 0; i < list.size; ++i)
+                if (list.lifetime[i] == lifetime) {
+                    wrn_msg("Dropping oldest telemetry subscriber %s.", destination_str(list.entries[i]).c_str());
+                    remove(i);
+                    return true;
+                }
+        return false;
+    }
+
+    /* assigns each receiver the stream of its subscription */
+    void assign_streams(void) {
+        list.number_of_streams = 0;
+        for (std::size_t i = 0; i < list.size; ++i) {
+            std::size_t s = 0;
+            while (s < list.number_of_streams and not (list.streams[s] == list.subscriptions[i]))
+                ++s;
+            if (s == list.number_of_streams)
+                list.streams[list.number_of_streams++] = list.subscriptions[i];
+            list.entries[i].stream = s;
+        }
+    }
+
+    void publish(void) {
+        assign_streams();
+        published.write_buffer() = list;
+        published.publish();
+    }
+
+    const uint64_t                    timeout_ns; /* 0 never */
+    Subscriber_List_t                 list;      /* owned by the TCP thread */
+    Triple_Buffer<Subscriber_List_t>  published;
+};
+
+/* <ip>:<port>[,<decimation>[,<fields>]], as in SUB=... and the subscribers setting */
+inline bool parse_subscriber(std::string const& str, std::string& address, unsigned& port, Subscription_t& subscription)
+{
+    char addr[16], fields[64] = "all";
+    subscription = Subscription_t();
+    if (sscanf(str.c_str(), "%15[0-9.]:%u,%u,%63s", addr, &port, &subscription.decimation, fields) < 2
+        or not telemetry::parse_field_mask(fields, subscription.fields))
+        return false;
+    address = addr;
+    return true;
+}
+
+} /* namespace supreme */
+
+#endif /* TELEMETRY_SUBSCRIBERS_HPP */
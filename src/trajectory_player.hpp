@@ -0,0 +1,322 @@
+#ifndef TRAJECTORY_PLAYER_HPP
+#define TRAJECTORY_PLAYER_HPP
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <common/log_messages.h>
+#include <robots/robot.h>
+
+#include <joint_array.hpp>
+
+/* Precomputed joint-space motions, played back by the control loop.
+
+   A trajectory is a cubic Hermite spline per joint through knots at
+   increasing times, the first at t = 0. Each knot holds a value and its
+   slope per joint. Position trajectories give the joint angle and its
+   velocity. Velocity trajectories give the velocity and its acceleration,
+   and the angle is integrated from where the joint was at the start.
+
+   Files live in lib_folder as trajectory_<id>.trj, <id> two digits, and
+   are loaded when the control starts. No file I/O happens in the loop.
+   Layout, host byte order:
+
+     File_Header_t
+     number_of_knots times { float time_s, number_of_joints times Knot_Value_t }
+
+   Playback is cycle-accurate, time advances by dt * time_scale every
+   control cycle, regardless of wall clock or network jitter. */
+
+namespace supreme {
+namespace trajectory {
+
+const uint32_t magic   = 0x4a525446; /* "FTRJ" */
+const uint16_t version = 1;
+
+enum class Type_t : uint8_t { position, velocity };
+
+struct File_Header_t {
+    uint32_t magic;
+    uint16_t version;
+    Type_t   type;
+    uint8_t  number_of_joints;
+    uint32_t number_of_knots;
+    uint32_t reserved;
+};
+
+struct Knot_Value_t {
+    float value;
+    float slope; /* per second */
+};
+
+/* value and rate of change at a point in time */
+struct Sample_t {
+    float value;
+    float rate;
+};
+
+inline std::string filename(std::string const& folder, unsigned id) {
+    char name[32];
+    snprintf(name, sizeof(name), "trajectory_%02u.trj", id);
+    return folder + name;
+}
+
+} /* namespace trajectory */
+
+
+class Trajectory
+{
+public:
+    Trajectory(trajectory::Type_t type = trajectory::Type_t::position, std::size_t number_of_joints = 0)
+    : type(type), number_of_joints(number_of_joints), times(), knots() {}
+
+    bool load(std::string const& filename)
+    {
+        const int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false; /* no such trajectory */
+
+        struct stat st;
+        std::vector<uint8_t> data;
+        if (fstat(fd, &st) == 0) {
+            data.resize(st.st_size);
+            std::size_t got = 0;
+            while (got < data.size()) {
+                const ssize_t n = read(fd, data.data() + got, data.size() - got);
+                if (n <= 0) break;
+                got += n;
+            }
+            data.resize(got);
+        }
+        close(fd);
+
+        trajectory::File_Header_t header;
+        if (data.size() < sizeof(header)) {
+            wrn_msg("Trajectory %s is too small.", filename.c_str());
+            return false;
+        }
+        memcpy(&header, data.data(), sizeof(header));
+        if (header.magic != trajectory::magic or header.version != trajectory::version) {
+            wrn_msg("%s is no trajectory of version %u.", filename.c_str(), trajectory::version);
+            return false;
+        }
+        if (header.type != trajectory::Type_t::position and header.type != trajectory::Type_t::velocity) {
+            wrn_msg("Trajectory %s has unknown type %u.", filename.c_str(), (unsigned) header.type);
+            return false;
+        }
+
+        const std::size_t knot_size = sizeof(float) + header.number_of_joints * sizeof(trajectory::Knot_Value_t);
+        if (header.number_of_knots < 2 or data.size() != sizeof(header) + header.number_of_knots * knot_size) {
+            wrn_msg("Trajectory %s is truncated or has less than two knots.", filename.c_str());
+            return false;
+        }
+
+        Trajectory loaded(header.type, header.number_of_joints);
+        std::vector<trajectory::Knot_Value_t> values(header.number_of_joints);
+        const uint8_t* p = data.data() + sizeof(header);
+        for (uint32_t k = 0; k < header.number_of_knots; ++k, p += knot_size) {
+            float time_s;
+            memcpy(&time_s, p, sizeof(time_s));
+            memcpy(values.data(), p + sizeof(time_s), values.size() * sizeof(trajectory::Knot_Value_t));
+            if (not loaded.add_knot(time_s, values.data())) {
+                wrn_msg("Trajectory %s is broken.", filename.c_str());
+                return false;
+            }
+        }
+        *this = std::move(loaded);
+        return true;
+    }
+
+    bool               empty           (void) const { return times.size() < 2; }
+    trajectory::Type_t get_type        (void) const { return type; }
+    std::size_t        get_number_of_joints(void) const { return number_of_joints; }
+    std::size_t        get_number_of_knots (void) const { return times.size(); }
+    float              get_duration    (void) const { return times.empty() ? .0f : times.back(); }
+
+    /* segment containing t, searched forward from a previous one */
+    std::size_t find_segment(float t, std::size_t segment) const {
+        while (segment + 2 < times.size() and t >= times[segment + 1]) ++segment;
+        return segment;
+    }
+
+    /* joint j's spline at time t within the segment */
+    trajectory::Sample_t evaluate(std::size_t segment, float t, std::size_t j) const
+    {
+        assert(segment + 1 < times.size() and j < number_of_joints);
+        const float h = times[segment + 1] - times[segment];
+        const float s = (t - times[segment]) / h;
+        const float s2 = s*s, s3 = s2*s;
+
+        auto const& k0 = knots[ segment      * number_of_joints + j];
+        auto const& k1 = knots[(segment + 1) * number_of_joints + j];
+        const float m0 = h * k0.slope, m1 = h * k1.slope;
+
+        return trajectory::Sample_t{ (2*s3 - 3*s2 + 1) * k0.value + (s3 - 2*s2 + s) * m0 + (-2*s3 + 3*s2) * k1.value + (s3 - s2) * m1
+                                   , ((6*s2 - 6*s) * k0.value + (3*s2 - 4*s + 1) * m0 + (-6*s2 + 6*s) * k1.value + (3*s2 - 2*s) * m1) / h };
+    }
+
+private:
+    /* appends a knot with one value per joint, times must increase, all of it finite */
+    bool add_knot(float time_s, const trajectory::Knot_Value_t* values)
+    {
+        if (not std::isfinite(time_s) or not (times.empty() ? time_s == .0f : time_s > times.back())) {
+            wrn_msg("Trajectory knot at %.3f s is out of order.", time_s);
+            return false;
+        }
+        for (std::size_t j = 0; j < number_of_joints; ++j)
+            if (not std::isfinite(values[j].value) or not std::isfinite(values[j].slope)) {
+                wrn_msg("Trajectory knot at %.3f s has an invalid value for joint %u.", time_s, (unsigned) j);
+                return false;
+            }
+        times.push_back(time_s);
+        knots.insert(knots.end(), values, values + number_of_joints);
+        return true;
+    }
+
+    trajectory::Type_t  type;
+    std::size_t         number_of_joints;
+    std::vector<float>  times;
+    std::vector<trajectory::Knot_Value_t> knots; /* knot-major */
+};
+
+
+/* plays the trajectories of a library, one at a time, at the control rate */
+template <std::size_t NumJoints>
+class Trajectory_Player
+{
+    typedef Joint_Array<float, NumJoints> Values_t;
+
+public:
+    Trajectory_Player(std::string const& folder, std::size_t number_of_joints, unsigned max_number_of_trajectories)
+    : library(max_number_of_trajectories)
+    , position(number_of_joints, [](std::size_t) { return .0f; })
+    , rate    (number_of_joints, [](std::size_t) { return .0f; })
+    , velocity(number_of_joints, [](std::size_t) { return .0f; })
+    {
+        unsigned count = 0;
+        for (unsigned id = 0; id < library.size(); ++id) {
+            Trajectory& t = library[id];
+            if (not t.load(trajectory::filename(folder, id))) continue;
+            if (t.get_number_of_joints() != number_of_joints) {
+                wrn_msg("Trajectory %u is for %u joints, not %u.", id, (unsigned) t.get_number_of_joints(), (unsigned) number_of_joints);
+                t = Trajectory();
+                continue;
+            }
+            sts_msg("Trajectory %u: %s, %u knots, %.2f s", id, t.get_type() == trajectory::Type_t::position ? "position" : "velocity"
+                   , (unsigned) t.get_number_of_knots(), t.get_duration());
+            ++count;
+        }
+        sts_msg("Loaded %u trajectories from %s.", count, folder.c_str());
+    }
+
+    /* takes effect with the next start() */
+    bool select(unsigned id) {
+        if (id < library.size() and not library[id].empty()) {
+            selected = id;
+            return true;
+        }
+        wrn_msg("No trajectory with ID = %u", id);
+        return false;
+    }
+
+    /* 0 pauses, false (and unchanged) if not finite */
+    bool set_time_scale(float scale) {
+        if (not std::isfinite(scale)) return false;
+        time_scale = std::max(scale, .0f);
+        return true;
+    }
+    void set_looping   (bool loop  ) { looping = loop; }
+
+    /* rewinds the selected trajectory, velocity trajectories integrate from the joints' current angles */
+    void start(robots::Jointvector_t const& joints)
+    {
+        time_s  = .0;
+        segment = 0;
+        playing = (selected < library.size());
+        if (not playing) { /* nothing selected, hold where the joints are */
+            for (std::size_t i = 0; i < position.size(); ++i) {
+                position[i] = joints[i].s_ang;
+                rate    [i] = velocity[i] = .0f;
+            }
+            return;
+        }
+
+        auto const& t = library[selected];
+        for (std::size_t i = 0; i < position.size(); ++i) {
+            const trajectory::Sample_t p = t.evaluate(0, .0f, i);
+            const bool is_position = (t.get_type() == trajectory::Type_t::position);
+            position[i] = is_position ? p.value : joints[i].s_ang;
+            rate    [i] = is_position ? p.rate  : p.value;
+            velocity[i] = rate[i] * time_scale;
+        }
+    }
+
+    /* advances by one control cycle, holds the last position at the end unless looping */
+    void execute_cycle(float dt)
+    {
+        if (not playing) return;
+        auto const& t = library[selected];
+
+        const double duration = t.get_duration();
+        const double previous = time_s;
+        time_s += static_cast<double>(dt) * time_scale;
+        double advance = time_s - previous; /* trajectory time */
+        if (time_s >= duration) {
+            if (looping) {
+                time_s  = std::fmod(time_s, duration);
+                segment = 0;
+            } else {
+                time_s  = duration;
+                advance = duration - previous;
+                playing = false;
+            }
+        }
+        segment = t.find_segment(time_s, segment);
+
+        for (std::size_t i = 0; i < position.size(); ++i) {
+            const trajectory::Sample_t p = t.evaluate(segment, time_s, i);
+            if (t.get_type() == trajectory::Type_t::position) {
+                position[i] = p.value;
+                rate    [i] = p.rate;
+            } else {
+                position[i] += .5f * (rate[i] + p.value) * advance; /* trapezoidal */
+                rate    [i]  = p.value;
+            }
+            velocity[i] = playing ? rate[i] * time_scale : .0f;
+        }
+    }
+
+    float get_position(std::size_t i) const { return position[i]; }
+    float get_velocity(std::size_t i) const { return velocity[i]; }
+
+    bool   is_playing  (void) const { return playing; }
+    double get_time    (void) const { return time_s; }
+    unsigned get_selected(void) const { return selected; }
+
+private:
+    std::vector<Trajectory> library; /* indexed by ID, empty where there is no file */
+
+    unsigned    selected   = static_cast<unsigned>(-1);
+    double      time_s     = .0;
+    std::size_t segment    = 0;
+    float       time_scale = 1.f;
+    bool        looping    = false;
+    bool        playing    = false;
+
+    Values_t    position;
+    Values_t    rate;       /* in trajectory time */
+    Values_t    velocity;   /* time scaled */
+};
+
+} /* namespace supreme */
+
+#endif /* TRAJECTORY_PLAYER_HPP */
@@ -0,0 +1,73 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace supreme {
+
+/* Lock-free single-producer/single-consumer exchange of the latest value.
+   Producer and consumer each own one buffer, the third one is exchanged
+   atomically. The consumer polls with update(), which costs one atomic
+   load when nothing is new and never enters the kernel. Buffers are
+   exchanged, not copied, so T may own memory as long as all three copies
+   are set up alike. */
+template <typename T>
+class Triple_Buffer
+{
+public:
+    explicit Triple_Buffer(T const& initial = T())
+    : buffers{{ initial, initial, initial }}
+    {}
+
+    Triple_Buffer(const Triple_Buffer& other) = delete;
+    Triple_Buffer& operator=(const Triple_Buffer& other) = delete;
+
+    /* producer side, fill the buffer and publish() it. The buffer holds
+       an older value, everything not written is stale. */
+    T& write_buffer(void) { return buffers[write_idx]; }
+
+    void publish(void)
+    {
+        const uint8_t prev = middle.exchange(write_idx | fresh, std::memory_order_acq_rel);
+        write_idx = prev & index_mask;
+        published.fetch_add(1, std::memory_order_relaxed);
+        if (prev & fresh)
+            overwritten.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /* consumer side, takes over the newest value if there is one,
+       returns false if read() is still up to date */
+    bool update(void)
+    {
+        if (not (middle.load(std::memory_order_acquire) & fresh))
+            return false;
+
+        const uint8_t prev = middle.exchange(read_idx, std::memory_order_acq_rel);
+        read_idx = prev & index_mask;
+        return true;
+    }
+
+    T const& read(void) const { return buffers[read_idx]; }
+
+    uint64_t get_published  (void) const { return published  .load(std::memory_order_relaxed); }
+    uint64_t get_overwritten(void) const { return overwritten.load(std::memory_order_relaxed); }
+
+private:
+    static const uint8_t fresh      = 0x4;
+    static const uint8_t index_mask = 0x3;
+
+    std::array<T, 3> buffers;
+
+    std::atomic<uint8_t> middle{2};
+    uint8_t write_idx = 0; /* owned by producer */
+    uint8_t read_idx  = 1; /* owned by consumer */
+
+    std::atomic<uint64_t> published{0};
+    std::atomic<uint64_t> overwritten{0};
+};
+
+} /* namespace supreme */
+
+#endif /* TRIPLE_BUFFER_HPP */
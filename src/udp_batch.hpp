@@ -0,0 +1,350 @@
+#ifndef UDP_BATCH_HPP
+#define UDP_BATCH_HPP
+
+#include <array>
+#include <string>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <common/log_messages.h>
+
+/* UDP sockets moving many datagrams per system call with sendmmsg/recvmmsg.
+   The sender queues complete datagrams and sends them all with one call
+   to their destinations (the telemetry subscribers). Each datagram belongs
+   to a stream and goes to the destinations of that stream only, e.g. full
+   frames to some subscribers and projections to others. The receiver drains
+   everything pending with one non-blocking call, its socket can be waited
+   on with poll/epoll via get_fd(). The kernel stamps each datagram when it
+   arrives (SO_TIMESTAMPNS), get_arrival_ns() tells that time on the
+   monotonic clock.
+   Datagram_Packer puts several consecutive frames of one channel (unit and
+   stream) into a single datagram to save the per-packet overhead on slow links. */
+
+namespace supreme {
+
+namespace constants {
+    /* stay below the ethernet MTU to avoid ip fragmentation */
+    const std::size_t max_datagram_size = 1400;
+}
+
+/* receiver of all datagrams of one stream */
+struct Destination_t {
+    struct sockaddr_in address;
+    unsigned           stream;
+};
+
+inline bool make_destination(Destination_t& dst, std::string const& address, unsigned port, unsigned stream = 0) {
+    memset(&dst, 0, sizeof(dst));
+    dst.address.sin_family = AF_INET;
+    dst.address.sin_port   = htons(port);
+    dst.stream             = stream;
+    return inet_pton(AF_INET, address.c_str(), &dst.address.sin_addr) == 1;
+}
+
+inline std::string destination_str(Destination_t const& dst) {
+    char buf[INET_ADDRSTRLEN] = "";
+    inet_ntop(AF_INET, &dst.address.sin_addr, buf, sizeof(buf));
+    return std::string(buf) + ":" + std::to_string(ntohs(dst.address.sin_port));
+}
+
+template <std::size_t MaxDatagrams, std::size_t MaxDestinations, std::size_t MaxSize = constants::max_datagram_size>
+class Batch_UDP_Sender
+{
+public:
+    Batch_UDP_Sender()
+    : fd(socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0))
+    , destinations()
+    , datagrams()
+    , iov()
+    , streams()
+    , msgs()
+    {
+        assertion(fd >= 0, "Could not create UDP socket: %s", strerror(errno));
+
+        const unsigned char ttl = 1; /* multicast stays in the local network */
+        if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != 0)
+            wrn_msg("Could not set multicast ttl: %s", strerror(errno));
+
+        for (std::size_t i = 0; i < MaxDatagrams; ++i)
+            iov[i].iov_base = datagrams[i].data();
+        for (auto& m : msgs) {
+            m.msg_hdr.msg_iovlen  = 1;
+            m.msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+    }
+
+    ~Batch_UDP_Sender() { if (fd >= 0) close(fd); }
+
+    Batch_UDP_Sender(const Batch_UDP_Sender& other) = delete;
+    Batch_UDP_Sender& operator=(const Batch_UDP_Sender& other) = delete;
+
+    /* same thread as add() and flush(), takes effect with the next flush */
+    void set_destinations(const Destination_t* list, std::size_t n) {
+        number_of_destinations = std::min(n, MaxDestinations);
+        std::copy(list, list + number_of_destinations, destinations.begin());
+    }
+
+    /* queues a copy of one datagram of a stream, sends the queue first if it is full */
+    void add(const uint8_t* data, std::size_t len, unsigned stream = 0) {
+        assertion(len <= MaxSize, "Datagram of %zu bytes exceeds %zu bytes.", len, MaxSize);
+        if (count == MaxDatagrams)
+            flush();
+        memcpy(datagrams[count].data(), data, len);
+        iov[count].iov_len = len;
+        streams[count] = stream;
+        ++count;
+    }
+
+    /* sends all queued datagrams to the destinations of their stream,
+       the messages refer to the queued data, nothing is copied per destination.
+       Returns the number of datagrams sent. */
+    std::size_t flush(void) {
+        if (count == 0)
+            return 0;
+
+        std::size_t num_msgs = 0;
+        for (std::size_t d = 0; d < number_of_destinations; ++d) {
+            for (std::size_t i = 0; i < count; ++i) {
+                if (streams[i] != destinations[d].stream)
+                    continue;
+                msgs[num_msgs].msg_hdr.msg_iov  = &iov[i];
+                msgs[num_msgs].msg_hdr.msg_name = &destinations[d].address;
+                ++num_msgs;
+            }
+        }
+
+        std::size_t sent = 0;
+        while (sent < num_msgs) {
+            const int n = sendmmsg(fd, &msgs[sent], num_msgs - sent, 0);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                ++errors;
+                break; /* drop the rest, next cycle brings new data */
+            }
+            sent += n;
+        }
+        if (num_msgs > 0)
+            ++syscalls;
+        datagrams_sent += sent;
+        count = 0;
+        return sent;
+    }
+
+    /* sends one datagram right away, outside of the queue, e.g. an answer
+       which is timestamped just before */
+    bool send_to(const uint8_t* data, std::size_t len, Destination_t const& dst) {
+        ++syscalls;
+        if (sendto(fd, data, len, 0, (const struct sockaddr*) &dst.address, sizeof(dst.address)) != (ssize_t) len) {
+            ++errors;
+            return false;
+        }
+        ++datagrams_sent;
+        return true;
+    }
+
+    uint64_t get_datagrams_sent(void) const { return datagrams_sent; }
+    uint64_t get_syscalls     (void) const { return syscalls;       }
+    uint64_t get_errors       (void) const { return errors;         }
+
+private:
+    int fd;
+
+    std::array<Destination_t, MaxDestinations> destinations;
+    std::size_t number_of_destinations = 0;
+
+    std::array<std::array<uint8_t, MaxSize>, MaxDatagrams> datagrams;
+    std::array<struct iovec , MaxDatagrams> iov;
+    std::array<unsigned     , MaxDatagrams> streams;
+    std::array<struct mmsghdr, MaxDatagrams * MaxDestinations> msgs;
+    std::size_t count = 0;
+
+    uint64_t datagrams_sent = 0;
+    uint64_t syscalls       = 0;
+    uint64_t errors         = 0;
+};
+
+
+template <std::size_t MaxDatagrams, std::size_t MaxSize = constants::max_datagram_size>
+class Batch_UDP_Receiver
+{
+public:
+    Batch_UDP_Receiver(std::string const& group, unsigned port)
+    : fd(socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0))
+    , datagrams()
+    , iov()
+    , controls()
+    , msgs()
+    {
+        assertion(fd >= 0, "Could not create UDP socket: %s", strerror(errno));
+
+        const int reuse = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0)
+            wrn_msg("Could not set address reuse: %s", strerror(errno));
+
+        struct sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family      = AF_INET;
+        local.sin_port        = htons(port);
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+        assertion(bind(fd, (struct sockaddr*) &local, sizeof(local)) == 0
+                 , "Could not bind UDP port %u: %s", port, strerror(errno));
+
+        struct ip_mreq mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        if (inet_pton(AF_INET, group.c_str(), &mreq.imr_multiaddr) == 1 and IN_MULTICAST(ntohl(mreq.imr_multiaddr.s_addr))) {
+            mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+            if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0)
+                wrn_msg("Could not join multicast group %s: %s", group.c_str(), strerror(errno));
+        }
+
+        const int stamp = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &stamp, sizeof(stamp)) != 0)
+            wrn_msg("Could not enable receive timestamps, taking the time after receiving: %s", strerror(errno));
+
+        for (std::size_t i = 0; i < MaxDatagrams; ++i) {
+            iov[i].iov_base = datagrams[i].data();
+            iov[i].iov_len  = MaxSize;
+            msgs[i].msg_hdr.msg_iov    = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = controls[i].data;
+        }
+        sts_msg("Batched UDP receiver on port %u.", port);
+    }
+
+    ~Batch_UDP_Receiver() { if (fd >= 0) close(fd); }
+
+    Batch_UDP_Receiver(const Batch_UDP_Receiver& other) = delete;
+    Batch_UDP_Receiver& operator=(const Batch_UDP_Receiver& other) = delete;
+
+    /* takes all pending datagrams (up to MaxDatagrams) without blocking,
+       returns their number */
+    std::size_t receive_messages(void) {
+        for (auto& m : msgs)
+            m.msg_hdr.msg_controllen = sizeof(Control_t::data); /* set to what was used by each call */
+        const int n = recvmmsg(fd, msgs.data(), MaxDatagrams, MSG_DONTWAIT, nullptr);
+        received_ns = clock_ns(CLOCK_MONOTONIC);
+        realtime_offset_ns = static_cast<int64_t>(received_ns - clock_ns(CLOCK_REALTIME));
+        if (n < 0) {
+            if (errno != EAGAIN and errno != EWOULDBLOCK and errno != EINTR)
+                ++errors;
+            count = 0;
+        } else {
+            count = n;
+            ++syscalls;
+            datagrams_received += count;
+        }
+        return count;
+    }
+
+    int            get_fd            (void)          const { return fd;    }
+    std::size_t    number_of_messages(void)          const { return count; }
+    const uint8_t* get_message       (std::size_t i) const { return datagrams[i].data(); }
+    std::size_t    get_length        (std::size_t i) const { return msgs[i].msg_len; }
+    bool           is_truncated      (std::size_t i) const { return msgs[i].msg_hdr.msg_flags & MSG_TRUNC; }
+
+    /* monotonic time the datagram arrived, the kernel's stamp moved from the
+       real-time clock, or the time after receiving if it carries none */
+    uint64_t get_arrival_ns(std::size_t i) const {
+        struct msghdr const& h = msgs[i].msg_hdr;
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&h); c != nullptr; c = CMSG_NXTHDR(const_cast<struct msghdr*>(&h), c))
+            if (c->cmsg_level == SOL_SOCKET and c->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+                const uint64_t arrival_ns = static_cast<uint64_t>(static_cast<int64_t>(to_ns(ts)) + realtime_offset_ns);
+                return std::min(arrival_ns, received_ns);
+            }
+        return received_ns;
+    }
+
+    uint64_t get_datagrams_received(void) const { return datagrams_received; }
+    uint64_t get_syscalls          (void) const { return syscalls;           }
+    uint64_t get_errors            (void) const { return errors;             }
+
+private:
+    static uint64_t to_ns(struct timespec const& ts) {
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+    }
+    static uint64_t clock_ns(clockid_t id) {
+        struct timespec ts;
+        clock_gettime(id, &ts);
+        return to_ns(ts);
+    }
+
+    struct Control_t {
+        alignas(struct cmsghdr) uint8_t data[CMSG_SPACE(sizeof(struct timespec))];
+    };
+
+    int fd;
+
+    std::array<std::array<uint8_t, MaxSize>, MaxDatagrams> datagrams;
+    std::array<struct iovec , MaxDatagrams> iov;
+    std::array<Control_t    , MaxDatagrams> controls;
+    std::array<struct mmsghdr, MaxDatagrams> msgs;
+    std::size_t count = 0;
+
+    uint64_t received_ns        = 0; /* monotonic, after the last call */
+    int64_t  realtime_offset_ns = 0; /* monotonic minus real-time clock */
+
+    uint64_t datagrams_received = 0;
+    uint64_t syscalls           = 0;
+    uint64_t errors             = 0;
+};
+
+
+/* packs up to frames_per_datagram consecutive frames of a channel into one
+   datagram, a datagram is handed to the sender when full or when the next
+   frame would not fit anymore. All frames of a channel belong to one stream. */
+template <std::size_t MaxChannels, std::size_t MaxSize = constants::max_datagram_size>
+class Datagram_Packer
+{
+public:
+    Datagram_Packer(unsigned frames_per_datagram)
+    : frames_per_datagram(frames_per_datagram > 0 ? frames_per_datagram : 1)
+    , channels()
+    {}
+
+    template <typename Sender_t>
+    void append(Sender_t& sender, std::size_t channel, const uint8_t* frame, std::size_t len, unsigned stream = 0) {
+        assertion(channel < MaxChannels and len <= MaxSize, "Cannot pack frame of %zu bytes for channel %zu.", len, channel);
+        Channel_t& c = channels[channel];
+        if (c.size + len > MaxSize or c.stream != stream)
+            emit(sender, c);
+        c.stream = stream;
+        memcpy(c.data.data() + c.size, frame, len);
+        c.size += len;
+        if (++c.frames >= frames_per_datagram)
+            emit(sender, c);
+    }
+
+    unsigned get_frames_per_datagram(void) const { return frames_per_datagram; }
+
+private:
+    struct Channel_t {
+        std::array<uint8_t, MaxSize> data;
+        std::size_t size   = 0;
+        unsigned    frames = 0;
+        unsigned    stream = 0;
+    };
+
+    template <typename Sender_t>
+    void emit(Sender_t& sender, Channel_t& c) {
+        if (c.size > 0)
+            sender.add(c.data.data(), c.size, c.stream);
+        c.size   = 0;
+        c.frames = 0;
+    }
+
+    const unsigned frames_per_datagram;
+    std::array<Channel_t, MaxChannels> channels;
+};
+
+} /* namespace supreme */
+
+#endif /* UDP_BATCH_HPP */